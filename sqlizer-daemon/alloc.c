@@ -0,0 +1,179 @@
+/***************************************************************
+ * alloc.c --   The voice allocator.  Claims a voice for a new
+ *              note, stealing a playing voice if it has to.
+ *
+ * Copyright:   Copyright (C) 2023 by Atomlab, LLC
+ *
+ * License:     This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the Version 2 of the GNU General
+ *              Public License as published by the Free Software Foundation.
+ *              GPL2.txt in the docs directory is a copy of this license.
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *              GNU General Public License for more details.
+ *
+ **************************************************************/
+
+/***************************************************************
+ * Overview:
+ *    Without the allocator a UI has to SELECT a free voice and
+ * then UPDATE it to inuse, two round trips per note, and two UIs
+ * can pick the same voice.  Instead a UI writes a noteid to the
+ * single row allocator table and the voice is claimed by the
+ * write callback.  SQL commands run one at a time on the SQL
+ * thread so no other command can claim the voice in between.
+ * The UI can send the UPDATE of the voice, by noteid, in the
+ * same packet.
+ *    A claimed voice gets the noteid and chordid, goes to inuse,
+ * and has its ADSR reset.  If no voice is free a playing voice is
+ * stolen.  The oldest is the one claimed longest ago and the
+ * quietest is the one with the lowest ADSR gain.  Voices in use
+ * but not yet playing are never stolen, since a UI is still
+ * setting them up.  With retrigger set a note that already has a
+ * playing voice gets that voice back.
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "sqlizer.h"
+
+
+/***************************************************************************
+ *  - Function prototypes and external references
+ ***************************************************************************/
+void   init_alloc();
+int    alloc_voice(struct ALLOC *pal);
+static int  pick_voice(struct ALLOC *pal);
+extern void mark_voice(int v);
+extern void force_field(int v, int offset);
+extern struct VOICE *voices;
+extern struct SYNTH synth;
+
+
+/***************************************************************************
+ *  - Variable allocation for this file
+ ***************************************************************************/
+struct ALLOC allocator;        // the allocator table
+static llong *claimseq;        // when each voice was claimed, by claim count
+static llong nclaims;          // voices claimed since startup
+
+
+/***************************************************************
+ * init_alloc(): - Set the allocator defaults.  This is called
+ * after init_synth() so the number of voices is known.
+ *
+ * Input:
+ * Output:
+ * Effects:      allocator table
+ ***************************************************************/
+void init_alloc()
+{
+    memset(&allocator, 0, sizeof(allocator));
+    allocator.policy = STEAL_OLDEST;
+    allocator.retrigger = 1;
+    allocator.voice = -1;
+    claimseq = calloc(synth.nvoices, sizeof(llong));
+    if (!claimseq) {
+        fprintf(stderr, "Unable to allocate voice allocator\n");
+        exit(1);
+    }
+    nclaims = 0;
+}
+
+
+/***************************************************************
+ * alloc_voice(): - Claim a voice for the note in the allocator
+ * row.  The voice is left in inuse with the note's IDs and its
+ * ADSR at the start, ready for the UI to set it up and turn it
+ * on.  The voice's index is put in the row.
+ *
+ * Input:        the allocator row as written
+ * Output:       0 if a voice was claimed, 1 if none could be
+ * Effects:      voices[], list of changed voices
+ ***************************************************************/
+int alloc_voice(
+    struct ALLOC *pal) // allocator row
+{
+    struct VOICE *pvoc;        // voice claimed
+    int      v;
+
+    pal->voice = -1;
+    if (pal->noteid[0] == (char) 0)
+        return 1;
+    v = pick_voice(pal);
+    if (v < 0)
+        return 1;
+
+    pvoc = &voices[v];
+    if ((pvoc->vstate != VSTATE_FREE) && (pvoc->vstate != VSTATE_INUSE) &&
+        (strncmp(pvoc->noteid, pal->noteid, NOTEID_LEN) != 0))
+        pal->steals++;
+    strncpy(pvoc->noteid, pal->noteid, NOTEID_LEN);
+    strncpy(pvoc->chordid, pal->chordid, CHORDID_LEN);
+    mark_voice(v);
+
+    // The render thread changes these so always send them
+    pvoc->vstate = VSTATE_INUSE;
+    pvoc->ontime = 0;
+    pvoc->adsridx = 0;
+    force_field(v, offsetof(struct VOICE, vstate));
+    force_field(v, offsetof(struct VOICE, ontime));
+    force_field(v, offsetof(struct VOICE, adsridx));
+
+    claimseq[v] = ++nclaims;
+    pal->voice = v;
+    return 0;
+}
+
+
+/***************************************************************
+ * pick_voice(): - Choose the voice for a note.  A playing voice
+ * with the same noteid comes first if retrigger is set, then the
+ * free voice with the lowest index, then a playing voice by the
+ * stealing policy.
+ *
+ * Input:        the allocator row
+ * Output:       index of the voice or -1 if none can be had
+ * Effects:
+ ***************************************************************/
+static int pick_voice(
+    struct ALLOC *pal) // allocator row
+{
+    struct VOICE *pvoc;        // voice being looked at
+    int      freev;            // first free voice
+    int      stealv;           // best voice to steal so far
+    int      v;
+
+    freev = -1;
+    stealv = -1;
+    for (v = 0; v < synth.nvoices; v++) {
+        pvoc = &voices[v];
+        if (pvoc->vstate == VSTATE_FREE) {
+            if (freev < 0)
+                freev = v;
+            continue;
+        }
+        if (pvoc->vstate == VSTATE_INUSE)
+            continue;
+        if (pal->retrigger && (strncmp(pvoc->noteid, pal->noteid, NOTEID_LEN) == 0))
+            return v;
+        if (stealv < 0)
+            stealv = v;
+        else if (pal->policy == STEAL_OLDEST) {
+            if (claimseq[v] < claimseq[stealv])
+                stealv = v;
+        }
+        else if (pal->policy == STEAL_QUIETEST) {
+            if (pvoc->envgain < voices[stealv].envgain)
+                stealv = v;
+        }
+    }
+    if (freev >= 0)
+        return freev;
+    if (pal->policy == STEAL_NONE)
+        return -1;
+    return stealv;
+}
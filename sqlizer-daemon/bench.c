@@ -0,0 +1,338 @@
+/***************************************************************
+ * bench.c --   Micro-benchmark of the oscillator waveform kernels.
+ *              Build with "make bench" and run ./sqlizer-bench.
+ *
+ * Copyright:   Copyright (C) 2023 by Atomlab, LLC
+ *
+ * License:     This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the Version 2 of the GNU General
+ *              Public License as published by the Free Software Foundation.
+ *              GPL2.txt in the docs directory is a copy of this license.
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *              GNU General Public License for more details.
+ *
+ **************************************************************/
+
+/***************************************************************
+ * Overview:
+ *    This links with osc.o and filt.o.  For each waveform type and each
+ * kernel the CPU supports it converts a block of phases over and
+ * over and reports the time per sample.  The band-limited types
+ * are always done in C so they report the same time for every
+ * kernel.
+ *    Then each way of computing a sine is timed the same way and
+ * its total harmonic distortion is measured.  The THD is taken
+ * from THD_LEN samples of a sine with exactly THD_CYCLES cycles
+ * in them, so the fundamental falls on one DFT bin and all of the
+ * error repeats every cycle.  The phases are computed exactly so
+ * only the sine itself adds distortion.  All kernels give the
+ * same output so the THD is measured once.
+ *    Last the filter bank is timed with a full group of voices,
+ * each with a 12 dB low pass filter, and the time is given per
+ * sample of one voice.
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "sqlizer.h"
+
+
+/***************************************************************************
+ *  - Limits and defines
+ ***************************************************************************/
+#define  BENCH_SAMPLES  4410000   // samples per test, 100 seconds of audio
+#define  BENCH_FREQ     1000.0    // oscillator frequency for the test
+#define  THD_LEN        65536     // samples in the THD test
+#define  THD_CYCLES     1021      // cycles in THD_LEN samples, prime
+
+
+/***************************************************************************
+ *  - Function prototypes and external references
+ ***************************************************************************/
+static double bench_one(int type, int kernel);
+static double bench_filt(int kernel);
+static double now();
+static double thd_db();
+static double dft_power(float *x, int n, int bin);
+extern void init_osc();
+extern int  osc_supported(int kernel);
+extern void osc_wave(int type, float *out, float *dt, uint32_t *noise, int nsamp);
+extern void filt_group(struct FILTGROUP *pg);
+
+
+/***************************************************************************
+ *  - Variable allocation for this file
+ ***************************************************************************/
+struct SYNTH synth;            // sample rate and defaults set by init_osc()
+struct RSET rset;              // osc.c reads the kernel from here
+
+// Waveforms to time and their names
+static const struct {
+    int   type;
+    char *name;
+} types[] = {
+    { OTYPE_SINE,       "sine" },
+    { OTYPE_SQUARE,     "square" },
+    { OTYPE_TRIANGLE,   "triangle" },
+    { OTYPE_NOISE,      "noise" },
+    { OTYPE_BLSQUARE,   "blsquare" },
+    { OTYPE_BLTRIANGLE, "bltriangle" },
+};
+#define NTYPES   (int)(sizeof(types) / sizeof(types[0]))
+static char *kernames[] = { "scalar", "sse2", "avx2" };
+static char *sinenames[] = { "quarter", "table", "poly" };
+
+
+int main()
+{
+    double   ns;               // time per sample in nanoseconds
+    int      t, k, m;
+
+    synth.srate = DEF_SRATE;
+    init_osc();
+    rset.osckernel = synth.osckernel;
+    rset.sinemode = synth.sinemode;
+
+    printf("%-12s", "ns/sample");
+    for (k = OSCK_SCALAR; k <= OSCK_AVX2; k++)
+        printf("%10s", kernames[k]);
+    printf("\n");
+
+    for (t = 0; t < NTYPES; t++) {
+        printf("%-12s", types[t].name);
+        for (k = OSCK_SCALAR; k <= OSCK_AVX2; k++) {
+            if (!osc_supported(k)) {
+                printf("%10s", "-");
+                continue;
+            }
+            ns = bench_one(types[t].type, k);
+            printf("%10.2f", ns);
+        }
+        printf("\n");
+    }
+
+    printf("\n%-12s%10s", "sinemode", "THD dB");
+    for (k = OSCK_SCALAR; k <= OSCK_AVX2; k++)
+        printf("%10s", kernames[k]);
+    printf("\n");
+    for (m = SINE_QUARTER; m <= SINE_POLY; m++) {
+        rset.sinemode = m;
+        printf("%-12s%10.1f", sinenames[m], thd_db());
+        for (k = OSCK_SCALAR; k <= OSCK_AVX2; k++) {
+            if (!osc_supported(k)) {
+                printf("%10s", "-");
+                continue;
+            }
+            ns = bench_one(OTYPE_SINE, k);
+            printf("%10.2f", ns);
+        }
+        printf("\n");
+    }
+
+    printf("\n%-12s%10s", "filter", "");
+    for (k = OSCK_SCALAR; k <= OSCK_AVX2; k++) {
+        if (!osc_supported(k)) {
+            printf("%10s", "-");
+            continue;
+        }
+        ns = bench_filt(k);
+        printf("%10.2f", ns);
+    }
+    printf("\n");
+    return 0;
+}
+
+
+/***************************************************************
+ * bench_one(): - Time one waveform on one kernel.  The phases
+ * are those of a BENCH_FREQ oscillator.  They are rebuilt for
+ * each block since osc_wave() overwrites them, and that time is
+ * not counted.
+ *
+ * Input:        waveform type, kernel
+ * Output:       nanoseconds per sample
+ * Effects:      rset.osckernel
+ ***************************************************************/
+static double bench_one(
+    int type,          // waveform type to time
+    int kernel)        // kernel to use
+{
+    float    phase[MX_BLOCK];  // phase of each sample
+    float    out[MX_BLOCK];    // phase in, waveform out
+    float    dt[MX_BLOCK];     // phase step of each sample
+    uint32_t noise[MX_BLOCK];  // white noise for each sample
+    float    phaseacc;         // phase accumulator
+    float    step;             // phase step
+    double   total;            // time in osc_wave()
+    double   start;
+    int      n, s;
+
+    rset.osckernel = kernel;
+    step = BENCH_FREQ / synth.srate;
+    phaseacc = 0.0;
+    for (s = 0; s < MX_BLOCK; s++) {
+        phaseacc += step;
+        if (phaseacc > 1.0)
+            phaseacc -= 1.0;
+        phase[s] = phaseacc;
+        dt[s] = step;
+        noise[s] = (uint32_t) rand();
+    }
+
+    total = 0.0;
+    for (n = 0; n < BENCH_SAMPLES; n += MX_BLOCK) {
+        for (s = 0; s < MX_BLOCK; s++)
+            out[s] = phase[s];
+        start = now();
+        osc_wave(type, out, dt, noise, MX_BLOCK);
+        total += now() - start;
+    }
+    return (total * 1e9 / (double) n);
+}
+
+
+/***************************************************************
+ * bench_filt(): - Time the filter bank on one kernel.  Each
+ * voice of the group has a 12 dB low pass filter at a different
+ * cutoff and filters white noise.  The filter state carries
+ * from block to block as it does in the renderer.
+ *
+ * Input:        kernel
+ * Output:       nanoseconds per sample of one voice
+ * Effects:      rset.osckernel
+ ***************************************************************/
+static double bench_filt(
+    int kernel)        // kernel to use
+{
+    static float in[FILT_LANES][MX_BLOCK];  // noise for each voice
+    static float buf[FILT_LANES][MX_BLOCK]; // signal in, filtered out
+    struct FILTGROUP grp;      // the voices
+    double   g, d;             // to simplify coefficient calculations
+    double   total;            // time in filt_group()
+    double   start;
+    int      n, l, s;
+
+    rset.osckernel = kernel;
+    memset(&grp, 0, sizeof(grp));
+    grp.nvoice = FILT_LANES;
+    grp.nsamp = MX_BLOCK;
+    for (l = 0; l < FILT_LANES; l++) {
+        for (s = 0; s < MX_BLOCK; s++)
+            in[l][s] = ((float) rand() / (float) RAND_MAX) - 0.5f;
+        grp.buf[l] = buf[l];
+        grp.nlive[l] = MX_BLOCK;
+        grp.stage2[l] = -1;
+        // Same low pass as derive_flt1() with a Q of 0.7
+        g = tan(M_PI * (500.0 + (l * 500.0)) / synth.srate);
+        d = (0.7 * g * g) + g + 0.7;
+        grp.b10[l] = grp.b20[l] = 0.7 * g * g / d;
+        grp.b11[l] = grp.b21[l] = 2.0 * grp.b10[l];
+        grp.b12[l] = grp.b22[l] = grp.b10[l];
+        grp.a11[l] = grp.a21[l] = 2.0 * 0.7 * ((g * g) - 1.0) / d;
+        grp.a12[l] = grp.a22[l] = ((0.7 * g * g) - g + 0.7) / d;
+    }
+
+    total = 0.0;
+    for (n = 0; n < BENCH_SAMPLES; n += MX_BLOCK) {
+        memcpy(buf, in, sizeof(buf));
+        start = now();
+        filt_group(&grp);
+        total += now() - start;
+    }
+    return (total * 1e9 / ((double) n * FILT_LANES));
+}
+
+
+/***************************************************************
+ * thd_db(): - Measure the total harmonic distortion of a sine
+ * made the way rset.sinemode says.  This is the power of
+ * everything but the fundamental over the power in the
+ * fundamental, in dB.  Harmonics above half the sample rate
+ * alias onto other bins, so the power not in the fundamental
+ * is found as the total power less the fundamental rather than
+ * by adding up the harmonic bins.
+ *
+ * Input:
+ * Output:       THD in dB
+ * Effects:      rset.osckernel
+ ***************************************************************/
+static double thd_db()
+{
+    static float x[THD_LEN];   // the test sine
+    static uint32_t noise[THD_LEN]; // not used by a sine
+    double   fund;             // power in the fundamental
+    double   total;            // power in all bins
+    double   harm;             // power in the harmonics
+    int      s;
+
+    // Cycle count times sample index, reduced exactly in integers
+    for (s = 0; s < THD_LEN; s++)
+        x[s] = (float) ((double) (((int64_t) s * THD_CYCLES) % THD_LEN) / THD_LEN);
+    rset.osckernel = OSCK_SCALAR;
+    for (s = 0; s < THD_LEN; s += MX_BLOCK)
+        osc_wave(OTYPE_SINE, &x[s], (float *) NULL, &noise[s], MX_BLOCK);
+
+    // The fundamental is in bins THD_CYCLES and THD_LEN - THD_CYCLES.
+    // By Parseval's theorem all bins add up to THD_LEN times the
+    // sum of the squares.
+    fund = 2.0 * dft_power(x, THD_LEN, THD_CYCLES);
+    total = 0.0;
+    for (s = 0; s < THD_LEN; s++)
+        total += (double) x[s] * (double) x[s];
+    total *= THD_LEN;
+    harm = total - fund;
+    if (harm <= 0.0)
+        return -999.9;
+    return (10.0 * log10(harm / fund));
+}
+
+
+/***************************************************************
+ * dft_power(): - Power in one bin of the DFT of a signal.  The
+ * angle of each term is reduced in integers first so the sum
+ * keeps the full precision of a double.
+ *
+ * Input:        signal, number of samples, bin
+ * Output:       squared magnitude of the bin
+ * Effects:
+ ***************************************************************/
+static double dft_power(
+    float *x,          // signal
+    int    n,          // number of samples
+    int    bin)        // DFT bin to measure
+{
+    double   re, im;           // the bin
+    double   angle;            // angle of one term
+    int      i;
+
+    re = 0.0;
+    im = 0.0;
+    for (i = 0; i < n; i++) {
+        angle = 2.0 * M_PI * (double) (((int64_t) bin * i) % n) / n;
+        re += x[i] * cos(angle);
+        im -= x[i] * sin(angle);
+    }
+    return ((re * re) + (im * im));
+}
+
+
+/***************************************************************
+ * now(): - Monotonic time in seconds.
+ *
+ * Input:
+ * Output:       seconds since an arbitrary start
+ * Effects:
+ ***************************************************************/
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double) ts.tv_sec + ((double) ts.tv_nsec / 1e9));
+}
@@ -0,0 +1,306 @@
+/***************************************************************
+ * events.c --  Voice changes scheduled to take effect at a given
+ *              sample.
+ *
+ * Copyright:   Copyright (C) 2023 by Atomlab, LLC
+ *
+ * License:     This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the Version 2 of the GNU General
+ *              Public License as published by the Free Software Foundation.
+ *              GPL2.txt in the docs directory is a copy of this license.
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *              GNU General Public License for more details.
+ *
+ **************************************************************/
+
+/***************************************************************
+ * Overview:
+ *    An UPDATE to the voices table takes effect at the start of
+ * the next block the render thread renders, so when a note starts
+ * depends on when the command arrives.  The events table lets a
+ * UI program say instead at which sample a change should happen.
+ *    The rows of the events table are queued in a binary heap
+ * ordered by time and then by row.  The heap lives on the SQL
+ * thread.  A little before an event is due, evlead ms, the SQL
+ * thread writes the change into voices[] as if it came from an
+ * UPDATE and sends it to the render thread with the sample it is
+ * due at.  All of the events due at the same sample go out as one
+ * batch.  The render thread splits its block at that sample so the
+ * change starts exactly where it was asked to.  The main loop uses
+ * ev_timeout() as its epoll timeout to wake up in time.
+ *    A row whose time is changed while it is queued is moved in
+ * the heap.  The heap remembers the time each row was queued with
+ * and a row whose time or state no longer agrees is put right
+ * when it reaches the top.
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sqlizer.h"
+
+
+/***************************************************************************
+ *  - Function prototypes and external references
+ ***************************************************************************/
+void   init_events();
+void   ev_queue(int row);
+void   ev_cancel(int row);
+int    ev_timeout();
+void   run_events();
+static void heap_remove(int pos);
+static void heap_sift(int pos);
+static int  heap_less(int a, int b);
+static void heap_put(int pos, int row);
+extern int  write_voicecol(int v, char *column, char *value);
+extern void sync_voices();
+extern void commit_voices_at(llong time);
+extern struct VOICE *voices;
+extern struct SYNTH synth;
+
+
+/***************************************************************************
+ *  - Variable allocation for this file
+ ***************************************************************************/
+struct VEVENT vevents[MX_VEVENTS]; // the events table
+static int   heap[MX_VEVENTS];     // queued rows, earliest at the top
+static int   nheap;                // number of rows in heap[]
+static int   hpos[MX_VEVENTS];     // place of each row in heap[], or -1
+static llong htime[MX_VEVENTS];    // time each row was queued with
+
+
+/***************************************************************
+ * init_events(): - Number the rows of the events table and mark
+ * them all free.
+ *
+ * Input:
+ * Output:
+ * Effects:      events table and heap
+ ***************************************************************/
+void init_events()
+{
+    int      i;
+
+    memset(vevents, 0, sizeof(vevents));
+    for (i = 0; i < MX_VEVENTS; i++) {
+        vevents[i].idx = i;
+        vevents[i].state = EV_FREE;
+        vevents[i].voice = -1;
+        hpos[i] = -1;
+    }
+    nheap = 0;
+}
+
+
+/***************************************************************
+ * ev_queue(): - Put a row of the events table in the heap at its
+ * time, or move it if it is already there.  This is called from
+ * the events write callback.
+ *
+ * Input:        row of the events table
+ * Output:
+ * Effects:      event heap
+ ***************************************************************/
+void ev_queue(
+    int row)           // row of the events table
+{
+    htime[row] = vevents[row].time;
+    if (hpos[row] < 0)
+        heap_put(nheap++, row);
+    heap_sift(hpos[row]);
+}
+
+
+/***************************************************************
+ * ev_cancel(): - Take a row of the events table out of the heap
+ * if it is there.
+ *
+ * Input:        row of the events table
+ * Output:
+ * Effects:      event heap
+ ***************************************************************/
+void ev_cancel(
+    int row)           // row of the events table
+{
+    if (hpos[row] >= 0)
+        heap_remove(hpos[row]);
+}
+
+
+/***************************************************************
+ * ev_timeout(): - Milliseconds until the next event should be
+ * sent to the render thread.  This is the main loop's epoll
+ * timeout.  It is rounded up since waking early just means the
+ * loop goes around once more.
+ *
+ * Input:
+ * Output:       ms to wait, 0 if one is due now, -1 if none queued
+ * Effects:
+ ***************************************************************/
+int ev_timeout()
+{
+    llong    wait;             // samples until the next event is sent
+
+    if (nheap == 0)
+        return (-1);
+    wait = htime[heap[0]] - synth.samples - ((llong) synth.evlead * synth.srate / 1000);
+    if (wait <= 0)
+        return (0);
+    return ((int) ((wait * 1000 + synth.srate - 1) / synth.srate));
+}
+
+
+/***************************************************************
+ * run_events(): - Send every event that is due within evlead ms
+ * to the render thread.  Each event is written into voices[] by
+ * the column's own write callback, just as an UPDATE would do it.
+ * Events at the same sample are sent together and each row is
+ * freed once it is sent.  This is called by the SQL thread each
+ * time around the main loop.
+ *
+ * Input:
+ * Output:
+ * Effects:      voices[], events table, change ring
+ ***************************************************************/
+void run_events()
+{
+    struct VEVENT *pev;        // event to send
+    llong    until;            // send events due before this sample
+    llong    batch;            // time of the batch being built
+    int      nbatch;           // events in the batch
+    int      row;              // row of the events table
+    int      v;
+
+    if (nheap == 0)
+        return;
+    until = synth.samples + ((llong) synth.evlead * synth.srate / 1000);
+    if (htime[heap[0]] > until)
+        return;
+
+    // Let the write callbacks see the voices as they are now playing
+    sync_voices();
+
+    batch = 0;
+    nbatch = 0;
+    while ((nheap > 0) && (htime[heap[0]] <= until)) {
+        row = heap[0];
+        heap_remove(0);
+        pev = &vevents[row];
+        if (pev->state != EV_QUEUED)
+            continue;
+        if (pev->time != htime[row]) {
+            ev_queue(row);     // moved since it was queued
+            continue;
+        }
+
+        // A new time starts a new batch
+        if ((nbatch > 0) && (pev->time != batch)) {
+            commit_voices_at(batch);
+            nbatch = 0;
+        }
+        batch = pev->time;
+        nbatch++;
+
+        if (pev->voice >= 0) {
+            if (pev->voice < synth.nvoices)
+                (void) write_voicecol(pev->voice, pev->column, pev->value);
+        }
+        else {
+            for (v = 0; v < synth.nvoices; v++) {
+                if (strncmp(voices[v].chordid, pev->chordid, CHORDID_LEN) == 0)
+                    (void) write_voicecol(v, pev->column, pev->value);
+            }
+        }
+        pev->state = EV_FREE;
+    }
+    if (nbatch > 0)
+        commit_voices_at(batch);
+}
+
+
+/***************************************************************
+ * heap_remove(): - Take the row at one place out of the heap.
+ * The last row fills the hole and is moved to where it belongs.
+ *
+ * Input:        place in heap[]
+ * Output:
+ * Effects:      event heap
+ ***************************************************************/
+static void heap_remove(
+    int pos)           // place in heap[] to empty
+{
+    hpos[heap[pos]] = -1;
+    nheap--;
+    if (pos == nheap)
+        return;
+    heap_put(pos, heap[nheap]);
+    heap_sift(pos);
+}
+
+
+/***************************************************************
+ * heap_sift(): - Move the row at one place up or down the heap
+ * until it is after its parent and before its children.
+ *
+ * Input:        place in heap[]
+ * Output:
+ * Effects:      event heap
+ ***************************************************************/
+static void heap_sift(
+    int pos)           // place in heap[] of the row to move
+{
+    int      row;              // the row being moved
+    int      child;            // earlier of the two children
+
+    row = heap[pos];
+    while ((pos > 0) && heap_less(row, heap[(pos - 1) / 2])) {
+        heap_put(pos, heap[(pos - 1) / 2]);
+        pos = (pos - 1) / 2;
+    }
+    while ((child = (2 * pos) + 1) < nheap) {
+        if ((child + 1 < nheap) && heap_less(heap[child + 1], heap[child]))
+            child++;
+        if (!heap_less(heap[child], row))
+            break;
+        heap_put(pos, heap[child]);
+        pos = child;
+    }
+    heap_put(pos, row);
+}
+
+
+/***************************************************************
+ * heap_less(): - Whether one row is due before another.  Rows
+ * at the same time go in row order so a batch is always applied
+ * in the same order.
+ *
+ * Input:        two rows of the events table
+ * Output:       1 if the first is due first, else 0
+ * Effects:
+ ***************************************************************/
+static int heap_less(
+    int a,             // a row of the events table
+    int b)             // another row
+{
+    if (htime[a] != htime[b])
+        return (htime[a] < htime[b]);
+    return (a < b);
+}
+
+
+/***************************************************************
+ * heap_put(): - Put a row at a place in the heap.
+ *
+ * Input:        place in heap[], row of the events table
+ * Output:
+ * Effects:      event heap
+ ***************************************************************/
+static void heap_put(
+    int pos,           // place in heap[]
+    int row)           // row to put there
+{
+    heap[pos] = row;
+    hpos[row] = pos;
+}
@@ -0,0 +1,546 @@
+/***************************************************************
+ * filt.c --    The voice filter bank.  This runs the filters of
+ *              a group of voices side by side for a block.
+ *
+ * Copyright:   Copyright (C) 2023 by Atomlab, LLC
+ *
+ * License:     This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the Version 2 of the GNU General
+ *              Public License as published by the Free Software Foundation.
+ *              GPL2.txt in the docs directory is a copy of this license.
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *              GNU General Public License for more details.
+ *
+ **************************************************************/
+
+/***************************************************************
+ * Overview:
+ *    Each voice has two biquad filters in the transposed direct
+ * form II.  Each output depends on the output one sample
+ * earlier so the samples of one voice can not be done in
+ * parallel.  The voices are independent though, so the SIMD
+ * kernels here run four or eight voices at once with one voice
+ * in each lane.  The block renderer gathers the voices into a
+ * struct FILTGROUP and calls filt_group().
+ *    The three ways the two filters are connected are done in
+ * every lane with masks instead of branches.  Filter #2 takes
+ * either the input or the output of filter #1, and the output
+ * is filter #1, filter #2, or their average.  The filter state
+ * of a lane only changes while the sample is one its voice
+ * plays, and filter #2 state only if the voice uses it, so each
+ * voice ends the block just as the reference renderer leaves it.
+ *    The kernel is the one set by rset.osckernel.  All three
+ * do the same float operations in the same order as do_voice()
+ * so the output is the same.
+ *    A filter that is fed silence decays toward zero through
+ * the denormal numbers, which are very slow on most CPUs.  The
+ * render threads call flush_denormals() so these are zero.
+ *    New filter parameters ramp in over a few milliseconds.  The
+ * parameters of a ramping voice are worked out for each sample
+ * until the ramp ends, and the kernels do that only up to the
+ * end of the longest ramp in the group.  Past that the loops
+ * are as they were, so a filter that is not changing costs the
+ * same as before.
+ *    The filter parameters are made from the tangent of the
+ * cutoff frequency in derive_flt1().  The cutoff is a whole
+ * number of Hz, so init_filt() makes a table of the tangent for
+ * every cutoff below the Nyquist frequency and a sweep does not
+ * call tan() for each update.
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "sqlizer.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define  FILT_X86    1             // build the SSE2 and AVX2 kernels
+#endif
+
+
+/***************************************************************************
+ *  - Function prototypes and external references
+ ***************************************************************************/
+void   init_filt();
+float  filt_warp(int f);
+void   filt_group(struct FILTGROUP *pg);
+void   flush_denormals();
+static void group_scalar(struct FILTGROUP *pg);
+#ifdef FILT_X86
+static void group_sse2(struct FILTGROUP *pg);
+static void group_avx2(struct FILTGROUP *pg);
+static inline void transpose8(__m256 *r);
+#endif
+extern struct SYNTH synth;
+extern struct RSET rset;
+
+
+/***************************************************************************
+ *  - Variable allocation for this file
+ ***************************************************************************/
+static float zeros[MX_BLOCK];   // input of the lanes past the last voice
+static float *fltwarp;          // tan(pi f / srate) for each cutoff f in Hz
+static int     nfltwarp;        // entries in fltwarp[], MX_CUTOFF + 1
+
+// Kernels in order of the OSCK_ values in sqlizer.h
+static void (*kernels[])(struct FILTGROUP *) = {
+    group_scalar,
+#ifdef FILT_X86
+    group_sse2,
+    group_avx2,
+#endif
+};
+#define NKERNELS   (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+
+/***************************************************************
+ * init_filt(): - Build the table of cutoff tangents.  This is
+ * the same sum set_flttype() did with tan() so the parameters
+ * do not change.  The table stops at MX_CUTOFF, just below half
+ * the sample rate, since the tangent is not usable past it.  The
+ * sample rate must be set.
+ *
+ * Input:
+ * Output:
+ * Effects:      fltwarp[]
+ ***************************************************************/
+void init_filt()
+{
+    int      f;
+
+    nfltwarp = MX_CUTOFF + 1;
+    fltwarp = malloc(nfltwarp * sizeof(float));
+    if (fltwarp == (float *) NULL) {
+        fprintf(stderr, "Unable to allocate filter tables\n");
+        exit(1);
+    }
+    for (f = 0; f < nfltwarp; f++)
+        fltwarp[f] = tan(M_PI * f / (float) SRATE);
+}
+
+
+/***************************************************************
+ * filt_warp(): - Look up the tangent for a cutoff frequency.  A
+ * cutoff past the end of the table is taken as the highest one.
+ *
+ * Input:        cutoff frequency in Hz
+ * Output:       tan(pi f / srate)
+ * Effects:
+ ***************************************************************/
+float filt_warp(
+    int f)             // cutoff frequency in Hz
+{
+    if (f < 0)
+        f = 0;
+    else if (f >= nfltwarp)
+        f = nfltwarp - 1;
+    return (fltwarp[f]);
+}
+
+
+/***************************************************************
+ * filt_group(): - Filter a group of voices for one block.
+ *
+ * Input:        the group
+ * Output:       each buf[] has the filtered signal
+ * Effects:      filter state in the group
+ ***************************************************************/
+void filt_group(
+    struct FILTGROUP *pg)  // voices to filter
+{
+    int      kernel;       // index into kernels[]
+
+    // The same kernel as osc_wave(), checked the same way
+    kernel = __atomic_load_n(&rset.osckernel, __ATOMIC_RELAXED);
+    if ((kernel < 0) || (kernel >= NKERNELS))
+        kernel = OSCK_SCALAR;
+    (kernels[kernel])(pg);
+}
+
+
+/***************************************************************
+ * flush_denormals(): - Have the CPU treat denormal numbers as
+ * zero in this thread.  Call this at the start of each thread
+ * that renders voices.
+ *
+ * Input:
+ * Output:
+ * Effects:      floating point control of this thread
+ ***************************************************************/
+void flush_denormals()
+{
+#ifdef FILT_X86
+    // Flush to zero (FTZ) and denormals are zero (DAZ)
+    _mm_setcsr(_mm_getcsr() | 0x8040);
+#endif
+}
+
+
+/***************************************************************
+ * group_scalar(): - The plain C kernel.  One voice at a time
+ * with the test on filter type done once for the voice.
+ *
+ * Input:        the group
+ * Output:       each buf[] has the filtered signal
+ * Effects:      filter state in the group
+ ***************************************************************/
+static void group_scalar(
+    struct FILTGROUP *pg)  // voices to filter
+{
+    float    b10, b11, b12, a11, a12; // filter #1 parameters
+    float    b20, b21, b22, a21, a22; // filter #2 parameters
+    float    z11, z12, z21, z22; // filter state
+    float    x, x2, y1, y2;  // input and output of each filter
+    float    left;         // steps left in a ramp
+    float   *buf;          // signal of one voice
+    int      nramp;        // samples of the voice in a ramp
+    int      l, s;
+
+    for (l = 0; l < pg->nvoice; l++) {
+        // Work on local copies of the filter so they can stay in registers
+        buf = pg->buf[l];
+        z11 = pg->z11[l]; z12 = pg->z12[l];
+        z21 = pg->z21[l]; z22 = pg->z22[l];
+
+        // Samples in a ramp work out the parameters and test the filter
+        // type each time.  This is the slow way but ramps are short.
+        nramp = (pg->ramp[l] < pg->nlive[l]) ? pg->ramp[l] : pg->nlive[l];
+        for (s = 0; s < nramp; s++) {
+            left = (float) (pg->ramp[l] - s);
+            b10 = pg->b10[l] - (pg->db10[l] * left); b11 = pg->b11[l] - (pg->db11[l] * left);
+            b12 = pg->b12[l] - (pg->db12[l] * left); a11 = pg->a11[l] - (pg->da11[l] * left);
+            a12 = pg->a12[l] - (pg->da12[l] * left);
+            b20 = pg->b20[l] - (pg->db20[l] * left); b21 = pg->b21[l] - (pg->db21[l] * left);
+            b22 = pg->b22[l] - (pg->db22[l] * left); a21 = pg->a21[l] - (pg->da21[l] * left);
+            a22 = pg->a22[l] - (pg->da22[l] * left);
+            x = buf[s];
+            y1 = (b10 * x) + z11;
+            z11 = (b11 * x) - (a11 * y1) + z12;
+            z12 = (b12 * x) - (a12 * y1);
+            y2 = 0.0f;
+            if (pg->stage2[l]) {
+                x2 = (pg->stop[l]) ? x : y1;
+                y2 = (b20 * x2) + z21;
+                z21 = (b21 * x2) - (a21 * y2) + z22;
+                z22 = (b22 * x2) - (a22 * y2);
+            }
+            if (pg->stop[l])
+                buf[s] = (y1 + y2) * 0.5f;
+            else
+                buf[s] = (pg->only1[l]) ? y1 : y2;
+        }
+
+        b10 = pg->b10[l]; b11 = pg->b11[l]; b12 = pg->b12[l];
+        a11 = pg->a11[l]; a12 = pg->a12[l];
+        b20 = pg->b20[l]; b21 = pg->b21[l]; b22 = pg->b22[l];
+        a21 = pg->a21[l]; a22 = pg->a22[l];
+
+        if (!pg->stage2[l]) {
+            // 6 dB low or high pass is just filter #1
+            for (s = nramp; s < pg->nlive[l]; s++) {
+                x = buf[s];
+                y1 = (b10 * x) + z11;
+                z11 = (b11 * x) - (a11 * y1) + z12;
+                z12 = (b12 * x) - (a12 * y1);
+                buf[s] = y1;
+            }
+        }
+        else if (pg->stop[l]) {
+            // Band reject runs both filters on the input and averages them
+            for (s = nramp; s < pg->nlive[l]; s++) {
+                x = buf[s];
+                y1 = (b10 * x) + z11;
+                z11 = (b11 * x) - (a11 * y1) + z12;
+                z12 = (b12 * x) - (a12 * y1);
+                y2 = (b20 * x) + z21;
+                z21 = (b21 * x) - (a21 * y2) + z22;
+                z22 = (b22 * x) - (a22 * y2);
+                buf[s] = (y1 + y2) * 0.5f;
+            }
+        }
+        else {
+            // Filter #2 takes the output of filter #1.  The output is filter
+            // #2 except for 6 dB band pass which uses just filter #1.
+            for (s = nramp; s < pg->nlive[l]; s++) {
+                x = buf[s];
+                y1 = (b10 * x) + z11;
+                z11 = (b11 * x) - (a11 * y1) + z12;
+                z12 = (b12 * x) - (a12 * y1);
+                y2 = (b20 * y1) + z21;
+                z21 = (b21 * y1) - (a21 * y2) + z22;
+                z22 = (b22 * y1) - (a22 * y2);
+                buf[s] = (pg->only1[l]) ? y1 : y2;
+            }
+        }
+
+        pg->z11[l] = z11; pg->z12[l] = z12;
+        pg->z21[l] = z21; pg->z22[l] = z22;
+    }
+}
+
+
+#ifdef FILT_X86
+/***************************************************************
+ * group_sse2(): - The SSE2 kernel, four voices at a time.  The
+ * samples of the four voices are interleaved into one buffer
+ * so each step reads and writes one register.  A lane past its
+ * voice's last sample, or past the last voice, filters zeros,
+ * its output is zero, and its state is left alone.
+ *
+ * Input:        the group
+ * Output:       each buf[] has the filtered signal
+ * Effects:      filter state in the group
+ ***************************************************************/
+__attribute__ ((target("sse2")))
+static void group_sse2(
+    struct FILTGROUP *pg)  // voices to filter
+{
+    float    xi[MX_BLOCK * 4] __attribute__ ((aligned(16))); // interleaved signal
+    float   *row;          // signal of one voice
+    __m128   b10, b11, b12, a11, a12, z11, z12;
+    __m128   b20, b21, b22, a21, a22, z21, z22;
+    __m128   st2, stop, only1, live, live2;
+    __m128   x, x2, y1, y2, t1, t2;
+    __m128   left, inramp; // steps left in a ramp, and lanes in one
+    __m128   half = _mm_set1_ps(0.5f);
+    __m128i  nlive, ramp, d;
+    int      nramp;        // samples to the end of the longest ramp
+    int      h, l, s;
+
+// Lanes of a where m is set, else lanes of b
+#define  SEL(m, a, b)  _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+// Parameter p less the steps dp left in the lanes still in a ramp
+#define  RAMPED(p, dp) _mm_sub_ps(_mm_loadu_ps(&pg->p[h]), \
+                           _mm_and_ps(_mm_mul_ps(_mm_loadu_ps(&pg->dp[h]), left), inramp))
+
+    for (h = 0; h < pg->nvoice; h += 4) {
+        nramp = 0;
+        for (l = 0; l < 4; l++) {
+            row = (h + l < pg->nvoice) ? pg->buf[h + l] : zeros;
+            for (s = 0; s < pg->nsamp; s++)
+                xi[(s * 4) + l] = row[s];
+            if ((pg->ramp[h + l] > nramp) && (pg->nlive[h + l] > nramp))
+                nramp = (pg->ramp[h + l] < pg->nlive[h + l]) ? pg->ramp[h + l] : pg->nlive[h + l];
+        }
+
+        b10 = _mm_loadu_ps(&pg->b10[h]); b11 = _mm_loadu_ps(&pg->b11[h]);
+        b12 = _mm_loadu_ps(&pg->b12[h]); a11 = _mm_loadu_ps(&pg->a11[h]);
+        a12 = _mm_loadu_ps(&pg->a12[h]);
+        z11 = _mm_loadu_ps(&pg->z11[h]); z12 = _mm_loadu_ps(&pg->z12[h]);
+        b20 = _mm_loadu_ps(&pg->b20[h]); b21 = _mm_loadu_ps(&pg->b21[h]);
+        b22 = _mm_loadu_ps(&pg->b22[h]); a21 = _mm_loadu_ps(&pg->a21[h]);
+        a22 = _mm_loadu_ps(&pg->a22[h]);
+        z21 = _mm_loadu_ps(&pg->z21[h]); z22 = _mm_loadu_ps(&pg->z22[h]);
+        st2 = _mm_loadu_ps((float *) &pg->stage2[h]);
+        stop = _mm_loadu_ps((float *) &pg->stop[h]);
+        only1 = _mm_loadu_ps((float *) &pg->only1[h]);
+        nlive = _mm_loadu_si128((__m128i *) &pg->nlive[h]);
+        ramp = _mm_loadu_si128((__m128i *) &pg->ramp[h]);
+
+        for (s = 0; s < pg->nsamp; s++) {
+            // Up to and including the sample after the longest ramp ends
+            // the parameters are worked out again.  After that they stay.
+            if (s <= nramp) {
+                d = _mm_sub_epi32(ramp, _mm_set1_epi32(s));
+                inramp = _mm_castsi128_ps(_mm_cmpgt_epi32(d, _mm_setzero_si128()));
+                left = _mm_cvtepi32_ps(d);
+                b10 = RAMPED(b10, db10); b11 = RAMPED(b11, db11); b12 = RAMPED(b12, db12);
+                a11 = RAMPED(a11, da11); a12 = RAMPED(a12, da12);
+                b20 = RAMPED(b20, db20); b21 = RAMPED(b21, db21); b22 = RAMPED(b22, db22);
+                a21 = RAMPED(a21, da21); a22 = RAMPED(a22, da22);
+            }
+            x = _mm_load_ps(&xi[s * 4]);
+            live = _mm_castsi128_ps(_mm_cmpgt_epi32(nlive, _mm_set1_epi32(s)));
+            live2 = _mm_and_ps(live, st2);
+
+            y1 = _mm_add_ps(_mm_mul_ps(b10, x), z11);
+            t1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b11, x), _mm_mul_ps(a11, y1)), z12);
+            t2 = _mm_sub_ps(_mm_mul_ps(b12, x), _mm_mul_ps(a12, y1));
+            z11 = SEL(live, t1, z11);
+            z12 = SEL(live, t2, z12);
+
+            x2 = SEL(stop, x, y1);
+            y2 = _mm_add_ps(_mm_mul_ps(b20, x2), z21);
+            t1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b21, x2), _mm_mul_ps(a21, y2)), z22);
+            t2 = _mm_sub_ps(_mm_mul_ps(b22, x2), _mm_mul_ps(a22, y2));
+            z21 = SEL(live2, t1, z21);
+            z22 = SEL(live2, t2, z22);
+
+            t1 = SEL(only1, y1, y2);
+            t1 = SEL(stop, _mm_mul_ps(_mm_add_ps(y1, y2), half), t1);
+            _mm_store_ps(&xi[s * 4], _mm_and_ps(live, t1));
+        }
+
+        _mm_storeu_ps(&pg->z11[h], z11); _mm_storeu_ps(&pg->z12[h], z12);
+        _mm_storeu_ps(&pg->z21[h], z21); _mm_storeu_ps(&pg->z22[h], z22);
+        for (l = 0; (l < 4) && (h + l < pg->nvoice); l++) {
+            row = pg->buf[h + l];
+            for (s = 0; s < pg->nsamp; s++)
+                row[s] = xi[(s * 4) + l];
+        }
+    }
+#undef SEL
+#undef RAMPED
+}
+
+
+/***************************************************************
+ * group_avx2(): - The AVX2 kernel, all eight voices at once.
+ * This is the SSE2 kernel with wider registers, and it moves
+ * the samples in and out of the interleaved buffer eight by
+ * eight with transpose8().  It is compiled for AVX2 but not
+ * FMA so no multiply and add is fused, which would change
+ * rounding.
+ *
+ * Input:        the group
+ * Output:       each buf[] has the filtered signal
+ * Effects:      filter state in the group
+ ***************************************************************/
+__attribute__ ((target("avx2")))
+static void group_avx2(
+    struct FILTGROUP *pg)  // voices to filter
+{
+    float    xi[MX_BLOCK * 8] __attribute__ ((aligned(32))); // interleaved signal
+    float   *rows[8];      // signal of each lane
+    __m256   r[8];         // eight samples of eight lanes
+    __m256   b10, b11, b12, a11, a12, z11, z12;
+    __m256   b20, b21, b22, a21, a22, z21, z22;
+    __m256   st2, stop, only1, live, live2;
+    __m256   x, x2, y1, y2, t1, t2;
+    __m256   left, inramp; // steps left in a ramp, and lanes in one
+    __m256   half = _mm256_set1_ps(0.5f);
+    __m256i  nlive, ramp, d;
+    int      nramp;        // samples to the end of the longest ramp
+    int      l, s;
+
+// Parameter p less the steps dp left in the lanes still in a ramp
+#define  RAMPED(p, dp) _mm256_sub_ps(_mm256_loadu_ps(pg->p), \
+                           _mm256_and_ps(_mm256_mul_ps(_mm256_loadu_ps(pg->dp), left), inramp))
+
+    // Interleave eight samples of each voice at a time
+    nramp = 0;
+    for (l = 0; l < 8; l++) {
+        rows[l] = (l < pg->nvoice) ? pg->buf[l] : zeros;
+        if ((pg->ramp[l] > nramp) && (pg->nlive[l] > nramp))
+            nramp = (pg->ramp[l] < pg->nlive[l]) ? pg->ramp[l] : pg->nlive[l];
+    }
+    for (s = 0; s + 8 <= pg->nsamp; s += 8) {
+        for (l = 0; l < 8; l++)
+            r[l] = _mm256_loadu_ps(&rows[l][s]);
+        transpose8(r);
+        for (l = 0; l < 8; l++)
+            _mm256_store_ps(&xi[(s + l) * 8], r[l]);
+    }
+    for ( ; s < pg->nsamp; s++) {
+        for (l = 0; l < 8; l++)
+            xi[(s * 8) + l] = rows[l][s];
+    }
+
+    b10 = _mm256_loadu_ps(pg->b10); b11 = _mm256_loadu_ps(pg->b11);
+    b12 = _mm256_loadu_ps(pg->b12); a11 = _mm256_loadu_ps(pg->a11);
+    a12 = _mm256_loadu_ps(pg->a12);
+    z11 = _mm256_loadu_ps(pg->z11); z12 = _mm256_loadu_ps(pg->z12);
+    b20 = _mm256_loadu_ps(pg->b20); b21 = _mm256_loadu_ps(pg->b21);
+    b22 = _mm256_loadu_ps(pg->b22); a21 = _mm256_loadu_ps(pg->a21);
+    a22 = _mm256_loadu_ps(pg->a22);
+    z21 = _mm256_loadu_ps(pg->z21); z22 = _mm256_loadu_ps(pg->z22);
+    st2 = _mm256_loadu_ps((float *) pg->stage2);
+    stop = _mm256_loadu_ps((float *) pg->stop);
+    only1 = _mm256_loadu_ps((float *) pg->only1);
+    nlive = _mm256_loadu_si256((__m256i *) pg->nlive);
+    ramp = _mm256_loadu_si256((__m256i *) pg->ramp);
+
+    for (s = 0; s < pg->nsamp; s++) {
+        if (s <= nramp) {
+            d = _mm256_sub_epi32(ramp, _mm256_set1_epi32(s));
+            inramp = _mm256_castsi256_ps(_mm256_cmpgt_epi32(d, _mm256_setzero_si256()));
+            left = _mm256_cvtepi32_ps(d);
+            b10 = RAMPED(b10, db10); b11 = RAMPED(b11, db11); b12 = RAMPED(b12, db12);
+            a11 = RAMPED(a11, da11); a12 = RAMPED(a12, da12);
+            b20 = RAMPED(b20, db20); b21 = RAMPED(b21, db21); b22 = RAMPED(b22, db22);
+            a21 = RAMPED(a21, da21); a22 = RAMPED(a22, da22);
+        }
+        x = _mm256_load_ps(&xi[s * 8]);
+        live = _mm256_castsi256_ps(_mm256_cmpgt_epi32(nlive, _mm256_set1_epi32(s)));
+        live2 = _mm256_and_ps(live, st2);
+
+        y1 = _mm256_add_ps(_mm256_mul_ps(b10, x), z11);
+        t1 = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(b11, x), _mm256_mul_ps(a11, y1)), z12);
+        t2 = _mm256_sub_ps(_mm256_mul_ps(b12, x), _mm256_mul_ps(a12, y1));
+        z11 = _mm256_blendv_ps(z11, t1, live);
+        z12 = _mm256_blendv_ps(z12, t2, live);
+
+        x2 = _mm256_blendv_ps(y1, x, stop);
+        y2 = _mm256_add_ps(_mm256_mul_ps(b20, x2), z21);
+        t1 = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(b21, x2), _mm256_mul_ps(a21, y2)), z22);
+        t2 = _mm256_sub_ps(_mm256_mul_ps(b22, x2), _mm256_mul_ps(a22, y2));
+        z21 = _mm256_blendv_ps(z21, t1, live2);
+        z22 = _mm256_blendv_ps(z22, t2, live2);
+
+        t1 = _mm256_blendv_ps(y2, y1, only1);
+        t1 = _mm256_blendv_ps(t1, _mm256_mul_ps(_mm256_add_ps(y1, y2), half), stop);
+        _mm256_store_ps(&xi[s * 8], _mm256_and_ps(live, t1));
+    }
+
+    _mm256_storeu_ps(pg->z11, z11); _mm256_storeu_ps(pg->z12, z12);
+    _mm256_storeu_ps(pg->z21, z21); _mm256_storeu_ps(pg->z22, z22);
+    for (s = 0; s + 8 <= pg->nsamp; s += 8) {
+        for (l = 0; l < 8; l++)
+            r[l] = _mm256_load_ps(&xi[(s + l) * 8]);
+        transpose8(r);
+        for (l = 0; l < pg->nvoice; l++)
+            _mm256_storeu_ps(&rows[l][s], r[l]);
+    }
+    for ( ; s < pg->nsamp; s++) {
+        for (l = 0; l < pg->nvoice; l++)
+            rows[l][s] = xi[(s * 8) + l];
+    }
+#undef RAMPED
+}
+
+
+/***************************************************************
+ * transpose8(): - Transpose eight registers of eight floats,
+ * so eight samples of eight voices become eight samples each
+ * holding the eight voices, or back again.
+ *
+ * Input:        the eight registers
+ * Output:       r[i] lane j has what r[j] lane i had
+ * Effects:
+ ***************************************************************/
+__attribute__ ((target("avx2")))
+static inline void transpose8(
+    __m256 *r)         // eight registers, transposed in place
+{
+    __m256   t[8];     // pairs of rows interleaved
+    __m256   u[8];     // fours of rows interleaved
+
+    t[0] = _mm256_unpacklo_ps(r[0], r[1]);
+    t[1] = _mm256_unpackhi_ps(r[0], r[1]);
+    t[2] = _mm256_unpacklo_ps(r[2], r[3]);
+    t[3] = _mm256_unpackhi_ps(r[2], r[3]);
+    t[4] = _mm256_unpacklo_ps(r[4], r[5]);
+    t[5] = _mm256_unpackhi_ps(r[4], r[5]);
+    t[6] = _mm256_unpacklo_ps(r[6], r[7]);
+    t[7] = _mm256_unpackhi_ps(r[6], r[7]);
+    u[0] = _mm256_shuffle_ps(t[0], t[2], 0x44);
+    u[1] = _mm256_shuffle_ps(t[0], t[2], 0xee);
+    u[2] = _mm256_shuffle_ps(t[1], t[3], 0x44);
+    u[3] = _mm256_shuffle_ps(t[1], t[3], 0xee);
+    u[4] = _mm256_shuffle_ps(t[4], t[6], 0x44);
+    u[5] = _mm256_shuffle_ps(t[4], t[6], 0xee);
+    u[6] = _mm256_shuffle_ps(t[5], t[7], 0x44);
+    u[7] = _mm256_shuffle_ps(t[5], t[7], 0xee);
+    r[0] = _mm256_permute2f128_ps(u[0], u[4], 0x20);
+    r[1] = _mm256_permute2f128_ps(u[1], u[5], 0x20);
+    r[2] = _mm256_permute2f128_ps(u[2], u[6], 0x20);
+    r[3] = _mm256_permute2f128_ps(u[3], u[7], 0x20);
+    r[4] = _mm256_permute2f128_ps(u[0], u[4], 0x31);
+    r[5] = _mm256_permute2f128_ps(u[1], u[5], 0x31);
+    r[6] = _mm256_permute2f128_ps(u[2], u[6], 0x31);
+    r[7] = _mm256_permute2f128_ps(u[3], u[7], 0x31);
+}
+#endif
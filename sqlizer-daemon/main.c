@@ -1,7 +1,7 @@
 /***************************************************************
  * main.c --    The main() routine for the SQL music synthesizer project.
- *              It handles initialization, TCP connections from
- *              UI programs, and timing.
+ *              It handles initialization and TCP connections from
+ *              UI programs.  Synthesis runs on the render thread.
  *
  * Copyright:   Copyright (C) 2023 by Atomlab, LLC
  *
@@ -18,10 +18,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/syslog.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include <string.h>
 #include <unistd.h>
@@ -35,115 +37,250 @@
  *  - Limits and defines
  ***************************************************************************/
 #define  DB_PORT    8889
+#define  STREAM_PORT 8890        // subscribe to the rendered audio
+#define  MX_EVENTS  (MX_UI + 2)  // UI conns, the listen socket, and streams
 
 
 /***************************************************************************
  *  - Function prototypes
  ***************************************************************************/
 static void     accept_ui_session(int srvfd);
-static void     handle_ui_output(UI * pui);
-static void     handle_ui_request(UI * pui);
+static int      handle_ui_output(UI * pui);
+static int      handle_ui_request(UI * pui);
+static void     close_ui_session(UI * pui);
 static int      listen_on_port(int port);
-extern void     init_synth();
-extern void     do_synth();        // process oscillators, voices, and filters
+static int      listen_on_path(char *path);
+static void     usage(char *prog);
+extern void     init_synth(int nvoices, int srate);
+extern void     init_output(int format, int channels);
+extern int      out_format(char *name);
+extern void     init_render(int cpu, int prio, int nworkers);
+extern void     load_wavetables(char *path);
+extern void     sync_voices();
+extern void     commit_voices();
+extern void     commit_settings();
+extern void     init_events();
+extern void     init_alloc();
+extern void     init_patches();
+extern int      init_patchcols();
+extern int      ev_timeout();
+extern void     run_events();
+extern int      init_streams(int tcpfd, int unixfd);
+extern void     str_service();
 
 
 /***************************************************************************
  *  - System-wide global variable allocation
  ***************************************************************************/
-struct VOICE voices[VOICE_COUNT];
+struct VOICE *voices;          // voices as seen by SQL
+struct VOICE *rvoices;         // render thread's copy of the voices
+struct SYNTH synth;            // render engine settings
+struct RSET rset;              // the settings as the render thread sees them
 UI     *ConnHead;              // head of linked list of UI conns
 int     nui = 0;               // number of open UI connections
+static int epfd;               // epoll instance for the UI conns
+static char streamtag;         // epoll data of the audio stream epoll set
+extern struct WAVETBL *wtables; // tables in the wavetable bank
 extern RTA_TBLDEF UITables[];  // table of UI connections
 extern int nuitables;          // size of above table
 
 
 /***************************************************************
  * How this program works:
+ *  - Read the command line options
  *  - Allocate and initialize system variables (as DB tables)
+ *  - Start the render thread
  *  - Open socket to listen for DB config commands
- *  - select() loop
+ *  - epoll() loop
  **************************************************************/
-int main()
+int main(int argc, char *argv[])
 {
-    fd_set   rfds;             /* read bit masks for select statement */
-    fd_set   wfds;             /* write bit masks for select statement */
-    int      mxfd;             /* Maximum FD for the select statement */
-    struct timeval outputperiod; /* how often to process voices */
+    struct epoll_event ev;     /* an event to watch for */
+    struct epoll_event events[MX_EVENTS]; /* events from epoll_wait() */
+    int      nev;              /* number of events */
     int      newui_fd = -1;    /* FD to TCP socket accept UI conns */
+    int      newconn;          /* set if a UI is waiting to connect */
     int      i;                /* generic loop counter */
     UI      *pui;              /* pointer to a UI struct */
-    UI      *nextpui;          /* points to next UI in list */
+    int      opt;              /* command line option letter */
+    int      outformat = OUTFMT_S16_BE; /* audio output sample format */
+    int      outchannels = 1;  /* audio output mono or stereo */
+    int      rendercpu = -1;   /* CPU for the render thread */
+    int      renderprio = 0;   /* SCHED_FIFO priority of render thread */
+    int      nvoices = DEF_VOICES; /* number of voices */
+    int      srate = DEF_SRATE; /* sample rate in Hz */
+    int      nworkers = 0;     /* render worker threads */
+    char    *wtfile = NULL;    /* wavetable bank file */
+    char    *strpath = NULL;   /* Unix socket for audio streams */
+    int      strfd;            /* epoll set of the audio streams */
+
+    // Command line options
+    while ((opt = getopt(argc, argv, "c:f:j:n:p:r:s:u:w:")) != -1) {
+        switch (opt) {
+        case 'c':
+            outchannels = atoi(optarg);
+            if ((outchannels != 1) && (outchannels != 2))
+                usage(argv[0]);
+            break;
+        case 'f':
+            outformat = out_format(optarg);
+            if (outformat < 0)
+                usage(argv[0]);
+            break;
+        case 'j':
+            nworkers = atoi(optarg);
+            if ((nworkers < 0) || (nworkers > MX_WORKERS))
+                usage(argv[0]);
+            break;
+        case 'n':
+            nvoices = atoi(optarg);
+            if ((nvoices < 1) || (nvoices > MX_VOICES))
+                usage(argv[0]);
+            break;
+        case 'p':
+            rendercpu = atoi(optarg);
+            if (rendercpu < 0)
+                usage(argv[0]);
+            break;
+        case 'r':
+            renderprio = atoi(optarg);
+            if ((renderprio < 1) || (renderprio > 99))
+                usage(argv[0]);
+            break;
+        case 's':
+            srate = atoi(optarg);
+            if ((srate < MN_SRATE) || (srate > MX_SRATE))
+                usage(argv[0]);
+            break;
+        case 'u':
+            strpath = optarg;
+            break;
+        case 'w':
+            wtfile = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
 
     // Init
     ConnHead = (UI *) NULL;
+    init_synth(nvoices, srate);
+    init_events();
+    init_alloc();
+    init_patches();
+    load_wavetables(wtfile);
     for (i = 0; i < nuitables; i++) {
+        // The voices and wavetables tables are allocated at startup and
+        // the patches columns are copied from the voices columns
+        if (strcmp(UITables[i].name, "voices") == 0) {
+            UITables[i].address = voices;
+            UITables[i].nrows = synth.nvoices;
+        }
+        else if (strcmp(UITables[i].name, "wavetables") == 0) {
+            UITables[i].address = wtables;
+            UITables[i].nrows = synth.nwtables;
+        }
+        else if (strcmp(UITables[i].name, "patches") == 0) {
+            UITables[i].ncol = init_patchcols();
+        }
         rta_add_table(&UITables[i]);
     }
-    init_synth();
+    init_output(outformat, outchannels);
+    init_render(rendercpu, renderprio, nworkers);
+
+
+    // Listen for UI connections.  The listen socket is the one
+    // entry in the epoll set without a UI struct.
+    epfd = epoll_create1(0);
+    if (epfd < 0) {
+        fprintf(stderr, "Unable to create epoll instance\n");
+        exit(1);
+    }
+    newui_fd = listen_on_port(DB_PORT);
+    ev.events = EPOLLIN;
+    ev.data.ptr = (UI *) NULL;
+    (void) epoll_ctl(epfd, EPOLL_CTL_ADD, newui_fd, &ev);
+
+    // Listen for audio stream subscribers.  Their sockets are in an
+    // epoll set of their own that we watch as one fd.
+    strfd = init_streams(listen_on_port(STREAM_PORT),
+        (strpath) ? listen_on_path(strpath) : -1);
+    ev.events = EPOLLIN;
+    ev.data.ptr = &streamtag;
+    (void) epoll_ctl(epfd, EPOLL_CTL_ADD, strfd, &ev);
 
 
     // main loop
     while (1) {
-        /* Build the fd_set for the select call.  This includes the listen port 
-         * for new UI connections and any existing UI connections.  We also
-         * look for the ability to write to the clients if data is queued.  */
-        FD_ZERO(&rfds);
-        FD_ZERO(&wfds);
-        mxfd = 0;
-
-        // open UI/DB/manager listener if needed
-        if (newui_fd < 0) {
-            newui_fd = listen_on_port(DB_PORT);
+        /* Wait for activity on the listen socket or a UI connection.  The
+         * render thread keeps its own time.  We only need to wake up to
+         * send the next scheduled event.  */
+        nev = epoll_wait(epfd, events, MX_EVENTS, ev_timeout());
+        run_events();
+        if (nev < 0) {
+            if (errno != EINTR)
+                syslog(LOG_ERR, "epoll_wait() error %d", errno);
+            continue;
         }
-        FD_SET(newui_fd, &rfds);
-        mxfd = (newui_fd > mxfd) ? newui_fd : mxfd;
 
-        // for each UI conn .... 
-        pui = ConnHead;
-        while (pui) {
-            if (pui->rspfree < MXRSP) { /* Data to send? */
-                FD_SET(pui->fd, &wfds);
-                mxfd = (pui->fd > mxfd) ? pui->fd : mxfd;
-            } else {
-                FD_SET(pui->fd, &rfds);
-                mxfd = (pui->fd > mxfd) ? pui->fd : mxfd;
+        newconn = 0;
+        for (i = 0; i < nev; i++) {
+            pui = (UI *) events[i].data.ptr;
+            if (pui == (UI *) NULL) {
+                newconn = 1;
+                continue;
+            }
+            if (events[i].data.ptr == &streamtag) {
+                str_service();
+                continue;
             }
-            pui = pui->nextconn;
-        }
-
-        // generate output no less often than 1 ms
-        outputperiod.tv_sec = 0;
-//outputperiod.tv_usec = 10000;
-        outputperiod.tv_usec = 1000;
-
-        // Wait for timeout or file descriptor activity
-        (void) select(mxfd + 1, &rfds, &wfds, (fd_set *) 0, &outputperiod);
 
-        // ..after select().  Activity. Search open fd's to find what to do.
-        // Handle new UI/DB/manager connection requests
-        if ((newui_fd >= 0) && (FD_ISSET(newui_fd, &rfds))) {
-            accept_ui_session(newui_fd);
-        }
+            /* UI conns are edge-triggered.  Note what the event says is
+             * ready and keep going until the socket says EAGAIN.  */
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                pui->readable = 1;
+            if (events[i].events & EPOLLOUT) {
+                if (handle_ui_output(pui) < 0)
+                    continue;       /* pui was freed */
+            }
 
-        // process request from or data to one of the UI programs
-        pui = ConnHead;
-        while (pui) {
-            /* Get next UI now since pui struct may be freed in handle_ui.. */
-            nextpui = pui->nextconn;
-            if (FD_ISSET(pui->fd, &rfds)) {
-                handle_ui_request(pui);
-            } else if (FD_ISSET(pui->fd, &wfds)) {
-                handle_ui_output(pui);
+            /* Do not take new commands until the last reply is sent */
+            while (pui->readable && (pui->rspfree == MXRSP)) {
+                if (handle_ui_request(pui) < 0)
+                    break;          /* pui was freed */
             }
-            pui = nextpui;
         }
 
-        // Process the synthesizer oscillators, voices and filters
-        do_synth();
+        /* Accept new connections last.  Accepting may close the oldest
+         * conn, which could be in the events we just processed.  */
+        if (newconn)
+            accept_ui_session(newui_fd);
     }
 }
 
+/***************************************************************
+ * usage(): - Print the command line options and exit.
+ *
+ * Input:        name of this program
+ * Output:       none
+ * Effects:      exits the program
+ ***************************************************************/
+void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-c channels] [-f format] [-j workers] [-n voices] [-p cpu] [-r prio] [-s rate] [-u path] [-w bank]\n", prog);
+    fprintf(stderr, "  -c channels  1 for mono (default) or 2 for interleaved stereo\n");
+    fprintf(stderr, "  -f format    S16_BE (default), S16_LE, S24_3LE, S32_LE, or FLOAT_LE\n");
+    fprintf(stderr, "  -j workers   number of render worker threads, 0 to %d (default 0)\n", MX_WORKERS);
+    fprintf(stderr, "  -n voices    number of voices, 1 to %d (default %d)\n", MX_VOICES, DEF_VOICES);
+    fprintf(stderr, "  -p cpu       pin the render thread to this CPU\n");
+    fprintf(stderr, "  -r prio      run the render thread SCHED_FIFO at this priority (1-99)\n");
+    fprintf(stderr, "  -s rate      sample rate in Hz, %d to %d (default %d)\n", MN_SRATE, MX_SRATE, DEF_SRATE);
+    fprintf(stderr, "  -u path      also send the audio to subscribers on this Unix socket\n");
+    fprintf(stderr, "  -w bank      map this wavetable bank file\n");
+    exit(1);
+}
+
 /***************************************************************
  * accept_ui_session(): - Accept a new UI/DB/manager session.
  * This routine is called when a user interface program such
@@ -165,6 +302,7 @@ void accept_ui_session(int srvfd)
     int      flags;            /* helps set non-blocking IO */
     UI      *pnew;             /* pointer to the new UI struct */
     UI      *pui;              /* pointer to a UI struct */
+    struct epoll_event ev;     /* events to watch for on new conn */
 
     /* Accept the connection */
     adrlen = sizeof(struct sockaddr_in);
@@ -181,12 +319,7 @@ void accept_ui_session(int srvfd)
 
         /* oldest conn is one at head of linked list.  Close it and promote
            next oldest to the top of the linked list.  */
-        close(ConnHead->fd);
-        pui = ConnHead->nextconn;
-        free(ConnHead);
-        nui--;
-        ConnHead = pui;
-        ConnHead->prevconn = (UI *) NULL;
+        close_ui_session(ConnHead);
     }
 
     pnew = malloc(sizeof(UI));
@@ -225,6 +358,16 @@ void accept_ui_session(int srvfd)
     pnew->ctm = (int) time((time_t *) 0);
     pnew->nbytin = 0;
     pnew->nbytout = 0;
+    pnew->readable = 0;
+
+    /* Watch for input and for room to write.  Edge-triggered so we are
+       told once per change and never have to rebuild an fd list. */
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = pnew;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, pnew->fd, &ev) < 0) {
+        syslog(LOG_ERR, "Unable to add UI conn to epoll");
+        close_ui_session(pnew);
+    }
 }
 
 /***************************************************************
@@ -258,12 +401,14 @@ int compute_cdur(char *tbl, char *col, char *sql, void *pr, int rowid)
  * or writing means a lot of the operation of the program
  * starts from this execution path.  The input is an index into
  * the ui table for the manager with data ready.
+ *  The socket is edge-triggered so the caller calls us until
+ * the read says EAGAIN, which clears pui->readable.
  *
  * Input:        pointer to UI struct with data to read
- * Output:       none
+ * Output:       -1 if the connection was closed, else 0
  * Effects:      many, many side effects via table callbacks
  ***************************************************************/
-void handle_ui_request(UI * pui)
+int handle_ui_request(UI * pui)
 {
     int      ret;              /* a return value */
     int      dbstat;           /* a return value */
@@ -274,25 +419,26 @@ void handle_ui_request(UI * pui)
        the SQL command and to execute it. */
     ret = read(pui->fd, &(pui->cmd[pui->cmdindx]), (MXCMD - pui->cmdindx));
 
+    /* nothing more to read until the next edge */
+    if ((ret < 0) && ((errno == EAGAIN) || (errno == EINTR))) {
+        if (errno == EAGAIN)
+            pui->readable = 0;
+        return (0);
+    }
+
     /* shutdown manager conn on error or on zero bytes read */
     if (ret <= 0) {
         /* log this since a normal close is with an 'X' command from the client
            program? */
-        close(pui->fd);
-        /* Free the UI struct */
-        if (pui->prevconn)
-            (pui->prevconn)->nextconn = pui->nextconn;
-        else
-            ConnHead = pui->nextconn;
-        if (pui->nextconn)
-            (pui->nextconn)->prevconn = pui->prevconn;
-        free(pui);
-        nui--;
-        return;
+        close_ui_session(pui);
+        return (-1);
     }
     pui->cmdindx += ret;
     pui->nbytin += ret;
 
+    /* Let SQL reads see the voices as they are now playing */
+    sync_voices();
+
     /* The commands are in the buffer. Call the DB to parse and execute them */
     t = pui->cmdindx;       /* packet in length */
     do {
@@ -303,10 +449,14 @@ void handle_ui_request(UI * pui)
         t -= pui->cmdindx;      /* t = # bytes consumed */
         /* move any trailing SQL cmd text up in the buffer */
         (void) memmove(pui->cmd, &(pui->cmd[t]), t);
+        /* send this command's voice changes and settings to the render
+           thread */
+        commit_voices();
+        commit_settings();
     } while (dbstat == RTA_SUCCESS);
     /* the command is done (including side effects).  Send any reply back to
        the UI.  You may want to check for RTA_CLOSE here. */
-    handle_ui_output(pui);
+    return (handle_ui_output(pui));
 }
 
 /***************************************************************
@@ -315,31 +465,25 @@ void handle_ui_request(UI * pui)
  * slow clients which can not accept the output in one big gulp.
  *
  * Input:        pointer to UI structure ready for write
- * Output:       none
+ * Output:       -1 if the connection was closed, else 0
  * Effects:      none
  ***************************************************************/
-void handle_ui_output(UI * pui)
+int handle_ui_output(UI * pui)
 {
     int      ret;              /* write() return value */
 
     if (pui->rspfree < MXRSP) {
         ret = write(pui->fd, pui->rsp, (MXRSP - pui->rspfree));
-        if (ret < 0) {
+        if ((ret < 0) && ((errno == EAGAIN) || (errno == EINTR))) {
+            /* socket is full.  epoll tells us when it drains */
+            return (0);
+        } else if (ret < 0) {
             /* log a failure to talk to a DB/UI connection */
             fprintf(stderr,
                 "error #%d on ui write to port #%d on IP=%d\n",
                 errno, pui->o_port, pui->o_ip);
-            close(pui->fd);
-            /* Free the UI struct */
-            if (pui->prevconn)
-                (pui->prevconn)->nextconn = pui->nextconn;
-            else
-                ConnHead = pui->nextconn;
-            if (pui->nextconn)
-                (pui->nextconn)->prevconn = pui->prevconn;
-            free(pui);
-            nui--;
-            return;
+            close_ui_session(pui);
+            return (-1);
         } else if (ret == (MXRSP - pui->rspfree)) {
             pui->rspfree = MXRSP;
             pui->nbytout += ret;
@@ -351,6 +495,30 @@ void handle_ui_output(UI * pui)
             pui->nbytout += ret; /* # bytes sent on conn */
         }
     }
+    return (0);
+}
+
+/***************************************************************
+ * close_ui_session() - Close a UI connection and free its UI
+ * struct.  Closing the socket also removes it from the epoll
+ * set.
+ *
+ * Input:        pointer to UI structure to close
+ * Output:       none
+ * Effects:      manager connection table (ui)
+ ***************************************************************/
+void close_ui_session(UI * pui)
+{
+    close(pui->fd);
+    /* Free the UI struct */
+    if (pui->prevconn)
+        (pui->prevconn)->nextconn = pui->nextconn;
+    else
+        ConnHead = pui->nextconn;
+    if (pui->nextconn)
+        (pui->nextconn)->prevconn = pui->prevconn;
+    free(pui);
+    nui--;
 }
 
 /***************************************************************
@@ -394,4 +562,45 @@ int listen_on_port(int port)
     return (srvfd);
 }
 
+/***************************************************************
+ * listen_on_path(char *path): -  Open a Unix socket to listen
+ * for incoming connections at the path given.  A socket left at
+ * the path by an earlier run is removed first.
+ *
+ * Input:        The path of the socket
+ * Output:       The file descriptor of the socket
+ * Effects:      none
+ ***************************************************************/
+int listen_on_path(char *path)
+{
+    int      srvfd;            /* FD for our listen server socket */
+    struct sockaddr_un srvskt;
+    struct stat sb;            /* what is at the path now */
+    int      flags;
 
+    (void) memset((void *) &srvskt, 0, sizeof(srvskt));
+    srvskt.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(srvskt.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long\n", path);
+        exit(1);
+    }
+    strcpy(srvskt.sun_path, path);
+    if ((srvfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        fprintf(stderr, "Unable to get socket for %s\n", path);
+        exit(1);
+    }
+    flags = fcntl(srvfd, F_GETFL, 0);
+    flags |= O_NONBLOCK;
+    (void) fcntl(srvfd, F_SETFL, flags);
+    if ((stat(path, &sb) == 0) && S_ISSOCK(sb.st_mode))
+        (void) unlink(path);
+    if (bind(srvfd, (struct sockaddr *) &srvskt, sizeof(srvskt)) < 0) {
+        fprintf(stderr, "Unable to bind to %s\n", path);
+        exit(1);
+    }
+    if (listen(srvfd, 1) < 0) {
+        fprintf(stderr, "Unable to listen on %s\n", path);
+        exit(1);
+    }
+    return (srvfd);
+}
@@ -0,0 +1,209 @@
+/***************************************************************
+ * mkwavetbl.c -- Build a wavetable bank file for sqlizer-daemon.
+ *              Build with "make mkwavetbl".
+ *
+ * Copyright:   Copyright (C) 2023 by Atomlab, LLC
+ *
+ * License:     This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the Version 2 of the GNU General
+ *              Public License as published by the Free Software Foundation.
+ *              GPL2.txt in the docs directory is a copy of this license.
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *              GNU General Public License for more details.
+ *
+ **************************************************************/
+
+/***************************************************************
+ * Overview:
+ *    This writes a bank of the classic waveforms in the format
+ * described with struct WTHEADER in sqlizer.h.  Each level is
+ * built by adding sine harmonics, and holds only the harmonics
+ * below half its length, so a level never aliases when it is
+ * played at no more than one sample per phase step.  All of
+ * the levels of a table are scaled by the same amount so the
+ * loudness does not jump from one level to the next.
+ *    Use it as a sample of the format.  Any program that writes
+ * the same layout can make a bank.
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "sqlizer.h"
+
+
+/***************************************************************************
+ *  - Limits and defines
+ ***************************************************************************/
+#define  DEF_WTLEN  2048           // default samples in level zero
+#define  WAVE_SINE  0              // fundamental only
+#define  WAVE_SAW   1              // all harmonics at 1/n
+#define  WAVE_SQUARE 2             // odd harmonics at 1/n
+#define  WAVE_TRI   3              // odd harmonics at 1/n^2, alternating
+
+
+/***************************************************************************
+ *  - Function prototypes and external references
+ ***************************************************************************/
+static void make_level(int wave, float *out, int len);
+static void usage(char *prog);
+
+
+/***************************************************************************
+ *  - Variable allocation for this file
+ ***************************************************************************/
+// Tables in the bank, in order of their index
+static const struct {
+    int   wave;
+    char *name;
+} waves[] = {
+    { WAVE_SINE,   "sine" },
+    { WAVE_SAW,    "saw" },
+    { WAVE_SQUARE, "square" },
+    { WAVE_TRI,    "triangle" },
+};
+#define NWAVES   (int)(sizeof(waves) / sizeof(waves[0]))
+
+
+int main(int argc, char *argv[])
+{
+    struct WTHEADER hdr;       // bank file header
+    char     name[WT_NAME_LEN]; // table name padded with NULs
+    float   *lvl[MX_WTMIPS];   // each level of one table
+    float    peak;             // largest value in level zero
+    FILE    *fp;
+    int      length = DEF_WTLEN; // samples in level zero
+    int      nmips;            // number of levels
+    int      opt;
+    int      t, k, s;
+
+    while ((opt = getopt(argc, argv, "l:")) != -1) {
+        switch (opt) {
+        case 'l':
+            length = atoi(optarg);
+            if ((length < MN_WTLEN) || (length > MX_WTLEN) ||
+                ((length & (length - 1)) != 0))
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usage(argv[0]);
+
+    // Levels down to four samples, which hold just the fundamental
+    for (nmips = 1; (length >> nmips) >= 4; nmips++)
+        ;
+    if (nmips > MX_WTMIPS)
+        nmips = MX_WTMIPS;
+
+    fp = fopen(argv[optind], "w");
+    if (fp == (FILE *) NULL) {
+        fprintf(stderr, "Unable to create %s\n", argv[optind]);
+        exit(1);
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = WT_MAGIC;
+    hdr.version = WT_VERSION;
+    hdr.ntables = NWAVES;
+    hdr.length = length;
+    hdr.nmips = nmips;
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    for (t = 0; t < NWAVES; t++) {
+        memset(name, 0, sizeof(name));
+        strncpy(name, waves[t].name, WT_NAME_LEN - 1);
+        fwrite(name, sizeof(name), 1, fp);
+    }
+
+    for (t = 0; t < NWAVES; t++) {
+        for (k = 0; k < nmips; k++) {
+            lvl[k] = malloc((length >> k) * sizeof(float));
+            if (lvl[k] == (float *) NULL) {
+                fprintf(stderr, "Unable to allocate a table\n");
+                exit(1);
+            }
+            make_level(waves[t].wave, lvl[k], length >> k);
+        }
+        peak = 0.0;
+        for (s = 0; s < length; s++)
+            peak = (fabsf(lvl[0][s]) > peak) ? fabsf(lvl[0][s]) : peak;
+        for (k = 0; k < nmips; k++) {
+            for (s = 0; s < (length >> k); s++)
+                lvl[k][s] /= peak;
+            fwrite(lvl[k], sizeof(float), length >> k, fp);
+            free(lvl[k]);
+        }
+    }
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Unable to write %s\n", argv[optind]);
+        exit(1);
+    }
+    return 0;
+}
+
+
+/***************************************************************
+ * make_level(): - Add up the harmonics of a waveform that fit
+ * in a level.  A level of len samples can hold harmonics below
+ * len / 2.
+ *
+ * Input:        waveform, output buffer, samples in the level
+ * Output:       out[] has one cycle of the waveform
+ * Effects:
+ ***************************************************************/
+static void make_level(
+    int    wave,       // which waveform
+    float *out,        // one cycle of the waveform
+    int    len)        // samples in the level
+{
+    double   sum;              // value of one sample
+    double   amp;              // amplitude of one harmonic
+    double   c2;               // two times cos of the sample angle
+    double   sn, sn1, sn2;     // sin of h, h-1, and h-2 times the angle
+    int      h, s;
+
+    for (s = 0; s < len; s++) {
+        // sin(h * x) by the recurrence 2 cos(x) sin((h-1) x) - sin((h-2) x)
+        c2 = 2.0 * cos(2.0 * M_PI * s / len);
+        sn1 = 0.0;
+        sn2 = 0.0;
+        sum = 0.0;
+        for (h = 1; h < len / 2; h++) {
+            sn = (h == 1) ? sin(2.0 * M_PI * s / len) : (c2 * sn1) - sn2;
+            sn2 = sn1;
+            sn1 = sn;
+            if (wave == WAVE_SINE)
+                amp = (h == 1) ? 1.0 : 0.0;
+            else if (wave == WAVE_SAW)
+                amp = 1.0 / h;
+            else if (wave == WAVE_SQUARE)
+                amp = (h % 2) ? 1.0 / h : 0.0;
+            else
+                amp = (h % 2) ? ((h % 4 == 1) ? 1.0 : -1.0) / ((double) h * h) : 0.0;
+            sum += amp * sn;
+        }
+        out[s] = (float) sum;
+    }
+}
+
+
+/***************************************************************
+ * usage(): - Print the command line options and exit.
+ *
+ * Input:        name of this program
+ * Output:       none
+ * Effects:      exits the program
+ ***************************************************************/
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-l length] bankfile\n", prog);
+    fprintf(stderr, "  -l length    samples per cycle, a power of two from %d to %d (default %d)\n",
+        MN_WTLEN, MX_WTLEN, DEF_WTLEN);
+    exit(1);
+}
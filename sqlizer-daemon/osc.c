@@ -0,0 +1,770 @@
+/***************************************************************
+ * osc.c --     Oscillator waveform kernels.  These convert a
+ *              block of oscillator phases into waveform values.
+ *
+ * Copyright:   Copyright (C) 2023 by Atomlab, LLC
+ *
+ * License:     This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the Version 2 of the GNU General
+ *              Public License as published by the Free Software Foundation.
+ *              GPL2.txt in the docs directory is a copy of this license.
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *              GNU General Public License for more details.
+ *
+ **************************************************************/
+
+/***************************************************************
+ * Overview:
+ *    The phase of an oscillator depends on its phase one sample
+ * earlier, so it is accumulated one sample at a time in voices.c.
+ * Turning phase into a waveform value does not depend on other
+ * samples, and that is where the table look-ups and branches
+ * are.  The kernels here do that part for a whole block, several
+ * samples per instruction.
+ *    There is a plain C kernel, an SSE2 kernel that does four
+ * samples at a time, and an AVX2 kernel that does eight.  The
+ * best one the CPU supports is picked at startup.  All three
+ * give exactly the same output as the reference renderer in
+ * voices.c.  Every step they take is either exact or is the
+ * same single float operation the reference does.
+ *    The band-limited square and triangle are the naive waves
+ * with a correction added near each corner.  A jump in value
+ * gets a BLEP, the difference between a band-limited step and
+ * the naive one.  A change in slope gets a BLAMP, the integral
+ * of the BLEP.  Both come from a windowed sinc, are tabulated at
+ * startup, and are spread over BLEP_W samples on each side of
+ * the corner.  The size of the correction depends on the phase
+ * step of each sample, so the caller gives those too.  These
+ * are done one sample at a time by osc_bl(), which the
+ * reference renderer also calls.
+ *    There are three ways to compute a sine, set by
+ * synth.sinemode.  The original quarter-wave table is folded
+ * with branches and read without interpolation, which puts
+ * harmonics at about -60 dB.  The full-cycle table has a power
+ * of two entries so the phase wraps with a mask, and it is
+ * interpolated.  The polynomial needs no table at all.  Neither
+ * of the last two has a branch, so the SIMD kernels do them
+ * the same way the C code does.  The reference renderer calls
+ * osc_sine() for each sample.
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "sqlizer.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define  OSC_X86     1             // build the SSE2 and AVX2 kernels
+#endif
+
+
+/***************************************************************************
+ *  - Limits and defines
+ ***************************************************************************/
+#define  NOISESCALE  (1.0f / (float)(1 << 27)) // noise bits to 0-1, exact
+#define  BLEP_W      2             // BLEP half width in samples
+#define  BLEP_OS     64            // BLEP table entries per sample
+#define  NBLEP       (2 * BLEP_W * BLEP_OS + 1) // entries in the BLEP tables
+#define  BLEP_SUB    16            // integration steps per table entry
+#define  TWOPI       6.28318530717958647692f // phase to radians
+#define  SIN_C3      (-1.0f / 6.0f)         // Taylor series of sin()
+#define  SIN_C5      (1.0f / 120.0f)        // to the 11th power is good to
+#define  SIN_C7      (-1.0f / 5040.0f)      // 6e-8 out to pi/2
+#define  SIN_C9      (1.0f / 362880.0f)
+#define  SIN_C11     (-1.0f / 39916800.0f)
+
+
+/***************************************************************************
+ *  - Function prototypes and external references
+ ***************************************************************************/
+void   init_osc();
+int    osc_supported(int kernel);
+void   osc_wave(int type, float *out, float *dt, uint32_t *noise, int nsamp);
+float  osc_bl(int type, float phout, float dt);
+float  osc_sine(float phout);
+static inline float sine_quarter(float phout);
+static inline float sine_table(float phout);
+static inline float sine_poly(float phout);
+static void init_blep();
+static inline float blep_lookup(float *tbl, float phout, float corner, float dt);
+static void wave_scalar(int type, float *out, uint32_t *noise, int nsamp);
+#ifdef OSC_X86
+static void wave_sse2(int type, float *out, uint32_t *noise, int nsamp);
+static void wave_avx2(int type, float *out, uint32_t *noise, int nsamp);
+#endif
+extern struct SYNTH synth;
+extern struct RSET rset;
+
+
+/***************************************************************************
+ *  - Variable allocation for this file
+ ***************************************************************************/
+float    sinetbl[NSINES];      // Sine look-up table. First quadrant only
+static float sinefull[NSINEFULL + 1]; // full cycle, last entry repeats the first
+static float bleptbl[NBLEP];   // band-limited step minus the naive step
+static float blamptbl[NBLEP];  // band-limited ramp minus the naive ramp
+
+// Kernels in order of the OSCK_ values in sqlizer.h
+static void (*kernels[])(int, float *, uint32_t *, int) = {
+    wave_scalar,
+#ifdef OSC_X86
+    wave_sse2,
+    wave_avx2,
+#endif
+};
+#define NKERNELS   (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+
+/***************************************************************
+ * init_osc(): - Build the sine and BLEP tables and pick the
+ * fastest kernel this CPU can run.  The interpolated sine table
+ * is the default sine.
+ *
+ * Input:
+ * Output:
+ * Effects:      sine and BLEP tables, synth.osckernel, synth.sinemode
+ ***************************************************************/
+void init_osc()
+{
+    float  angle;              // angle for sine table init
+    int    i;
+
+    // init the sine look-up table (0 to pi/2 radians, 0-90 degrees)
+    for (i = 0; i < NSINES; i++) {
+        angle = 3.1415926 * (float)i / (2.0 * (float)NSINES);
+        sinetbl[i] = sinf(angle);
+    }
+    for (i = 0; i <= NSINEFULL; i++)
+        sinefull[i] = (float) sin(2.0 * M_PI * (double) (i % NSINEFULL) / NSINEFULL);
+    synth.sinemode = SINE_TABLE;
+    init_blep();
+
+    synth.osckernel = OSCK_SCALAR;
+    for (i = OSCK_SCALAR; i < NKERNELS; i++) {
+        if (osc_supported(i))
+            synth.osckernel = i;
+    }
+}
+
+
+/***************************************************************
+ * osc_supported(): - Return one if this CPU can run the given
+ * kernel.
+ *
+ * Input:        one of the OSCK_ values
+ * Output:       1 if the kernel can be used, else 0
+ * Effects:
+ ***************************************************************/
+int osc_supported(
+    int kernel)        // kernel to check
+{
+    if ((kernel < 0) || (kernel >= NKERNELS))
+        return 0;
+#ifdef OSC_X86
+    __builtin_cpu_init();
+    if (kernel == OSCK_SSE2)
+        return (__builtin_cpu_supports("sse2") != 0);
+    if (kernel == OSCK_AVX2)
+        return (__builtin_cpu_supports("avx2") != 0);
+#endif
+    return 1;
+}
+
+
+/***************************************************************
+ * init_blep(): - Build the BLEP and BLAMP tables.  The band-
+ * limited step is the running integral of a Blackman windowed
+ * sinc that is BLEP_W samples wide on each side.  The BLEP is
+ * that minus a unit step at zero, and the BLAMP is the running
+ * integral of the BLEP.  Both are zero at the ends of the table.
+ *
+ * Input:
+ * Output:
+ * Effects:      BLEP and BLAMP tables
+ ***************************************************************/
+static void init_blep()
+{
+    double   step[NBLEP];      // band-limited step
+    double   x;                // time in samples from the corner
+    double   k;                // windowed sinc at x
+    double   sum;              // running integral of the sinc
+    double   ramp;             // running integral of the BLEP
+    double   dx;               // integration step in samples
+    int      i, j;
+
+    dx = 1.0 / (BLEP_OS * BLEP_SUB);
+    sum = 0.0;
+    step[0] = 0.0;
+    for (i = 1; i < NBLEP; i++) {
+        // midpoint rule over the BLEP_SUB steps in this entry
+        for (j = 0; j < BLEP_SUB; j++) {
+            x = -BLEP_W + ((i - 1) * BLEP_SUB + j + 0.5) * dx;
+            k = (x == 0.0) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+            k *= 0.42 + 0.5 * cos(M_PI * x / BLEP_W) + 0.08 * cos(2.0 * M_PI * x / BLEP_W);
+            sum += k * dx;
+        }
+        step[i] = sum;
+    }
+
+    // Scale so the step goes all the way to one, then subtract the
+    // naive step.  The naive step is one at the corner itself.
+    ramp = 0.0;
+    for (i = 0; i < NBLEP; i++) {
+        step[i] = step[i] / sum - ((i >= BLEP_W * BLEP_OS) ? 1.0 : 0.0);
+        bleptbl[i] = (float) step[i];
+        if (i > 0)
+            ramp += (step[i - 1] + step[i]) / (2.0 * BLEP_OS);
+        blamptbl[i] = (float) ramp;
+    }
+    bleptbl[NBLEP - 1] = 0.0;
+    blamptbl[NBLEP - 1] = 0.0;
+}
+
+
+/***************************************************************
+ * osc_wave(): - Convert a buffer of oscillator phases into
+ * waveform values.  The phases already include the phase offset
+ * and are from 0 up to but not including 1.  The test on
+ * waveform type is done once for the whole buffer.
+ *
+ * Input:        waveform type, phases, phase step of each
+ *               sample, noise, number of samples
+ * Output:       out[] has the waveform value of each phase
+ * Effects:
+ ***************************************************************/
+void osc_wave(
+    int       type,        // Sine, square, triangle, noise
+    float    *out,         // phase in, waveform value out
+    float    *dt,          // phase step of each sample
+    uint32_t *noise,       // white noise for each sample
+    int       nsamp)       // number of samples to convert
+{
+    int      kernel;       // index into kernels[]
+    int      s;
+
+    if ((type == OTYPE_BLSQUARE) || (type == OTYPE_BLTRIANGLE)) {
+        for (s = 0; s < nsamp; s++)
+            out[s] = osc_bl(type, out[s], dt[s]);
+        return;
+    }
+    // commit_settings() only lets in a kernel this CPU can run, but
+    // an index past the table would jump through a wild pointer
+    kernel = __atomic_load_n(&rset.osckernel, __ATOMIC_RELAXED);
+    if ((kernel < 0) || (kernel >= NKERNELS))
+        kernel = OSCK_SCALAR;
+    (kernels[kernel])(type, out, noise, nsamp);
+}
+
+
+/***************************************************************
+ * osc_bl(): - Compute one sample of a band-limited square or
+ * triangle.  The square jumps up at phase zero and down at one
+ * half, so it gets a BLEP of height two at each.  The triangle
+ * slope changes by 8 * dt per sample at one quarter and three
+ * quarters, so it gets a BLAMP of that size at each.
+ *
+ * Input:        waveform type, phase after offset, phase step
+ * Output:       waveform value
+ * Effects:
+ ***************************************************************/
+float osc_bl(
+    int       type,        // band-limited square or triangle
+    float     phout,       // phase, 0 to 1
+    float     dt)          // phase step for this sample
+{
+    float    y;            // waveform value
+
+    if (type == OTYPE_BLSQUARE) {
+        y = (phout < 0.5f) ? 1.0f : -1.0f;
+        if (dt > 0.0f) {
+            y += 2.0f * blep_lookup(bleptbl, phout, 0.0f, dt);
+            y -= 2.0f * blep_lookup(bleptbl, phout, 0.5f, dt);
+        }
+    }
+    else {
+        if (phout < 0.25f)
+            y = phout * 4.0f;
+        else if (phout < 0.75f)
+            y = 2.0f - (phout * 4.0f);
+        else
+            y = (phout * 4.0f) - 4.0f;
+        if (dt > 0.0f) {
+            y -= 8.0f * dt * blep_lookup(blamptbl, phout, 0.25f, dt);
+            y += 8.0f * dt * blep_lookup(blamptbl, phout, 0.75f, dt);
+        }
+    }
+    return y;
+}
+
+
+/***************************************************************
+ * osc_sine(): - Compute one sample of a sine wave the way
+ * rset.sinemode says to.
+ *
+ * Input:        phase after offset, 0 to 1
+ * Output:       waveform value
+ * Effects:
+ ***************************************************************/
+float osc_sine(
+    float     phout)       // phase, 0 to 1
+{
+    int      sinemode;     // the mode for this sample
+
+    sinemode = __atomic_load_n(&rset.sinemode, __ATOMIC_RELAXED);
+    if (sinemode == SINE_TABLE)
+        return sine_table(phout);
+    if (sinemode == SINE_POLY)
+        return sine_poly(phout);
+    return sine_quarter(phout);
+}
+
+
+/***************************************************************
+ * sine_quarter(): - Sine from the quarter-wave table.  Each
+ * quadrant is folded onto the first and the table index is
+ * truncated.
+ *
+ * Input:        phase, 0 to 1
+ * Output:       waveform value
+ * Effects:
+ ***************************************************************/
+static inline float sine_quarter(
+    float     phout)       // phase, 0 to 1
+{
+    float    sineidx;      // Index into the sine table as a float
+    float    y;
+
+    if (phout < 0.25)
+        sineidx = phout * 4.0;     // table is just the first quadrant
+    else if (phout < 0.5)
+        sineidx = 2.0 - (phout * 4.0);  // goes 1 down to 0
+    else if (phout < 0.75)
+        sineidx = (phout - 0.5) * 4.0;
+    else
+        sineidx = 2.0 - ((phout - 0.5) * 4.0);  // goes 1 down to 0
+    y = sinetbl[(int)((float)(NSINES -1) * sineidx)];
+    if (phout > 0.5)
+        y = -y;   // negative in second half of cycle
+    return y;
+}
+
+
+/***************************************************************
+ * sine_table(): - Sine from the full-cycle table with linear
+ * interpolation.  A phase of exactly one wraps to entry zero.
+ * The SIMD kernels do these same steps in the same order.
+ *
+ * Input:        phase, 0 to 1
+ * Output:       waveform value
+ * Effects:
+ ***************************************************************/
+static inline float sine_table(
+    float     phout)       // phase, 0 to 1
+{
+    float    pos;          // phase in table entries
+    float    frac;         // fraction of an entry past i
+    int      i;
+
+    pos = phout * (float) NSINEFULL;
+    i = (int) pos;
+    frac = pos - (float) i;
+    i &= NSINEFULL - 1;
+    return sinefull[i] + (frac * (sinefull[i + 1] - sinefull[i]));
+}
+
+
+/***************************************************************
+ * sine_poly(): - Sine from a polynomial.  The phase is moved
+ * to -0.5 to 0.5, folded to 0 to 0.25 where the polynomial is
+ * accurate, and the sign is put back at the end.  All of the
+ * steps are branch-free.
+ *
+ * Input:        phase, 0 to 1
+ * Output:       waveform value
+ * Effects:
+ ***************************************************************/
+static inline float sine_poly(
+    float     phout)       // phase, 0 to 1
+{
+    float    x;            // phase minus one half
+    float    t;            // absolute value of x
+    float    u;            // t folded to 0 to 0.25
+    float    z, z2;        // u in radians, and squared
+    float    y;
+
+    x = phout - 0.5f;
+    t = fabsf(x);
+    u = 0.5f - t;
+    u = (t < u) ? t : u;
+    z = u * TWOPI;
+    z2 = z * z;
+    y = SIN_C11;
+    y = (y * z2) + SIN_C9;
+    y = (y * z2) + SIN_C7;
+    y = (y * z2) + SIN_C5;
+    y = (y * z2) + SIN_C3;
+    y = (y * z2) + 1.0f;
+    y = y * z;
+    // sin(2 pi phout) is -sin(2 pi x)
+    return (x > 0.0f) ? -y : y;
+}
+
+
+/***************************************************************
+ * blep_lookup(): - Look up the BLEP or BLAMP correction for a
+ * corner at the given phase.  The distance from the corner is
+ * converted from phase to samples using the phase step, and the
+ * table is linearly interpolated.
+ *
+ * Input:        table, phase, phase of the corner, phase step
+ * Output:       correction, zero if not within BLEP_W samples
+ * Effects:
+ ***************************************************************/
+static inline float blep_lookup(
+    float    *tbl,         // bleptbl or blamptbl
+    float     phout,       // phase, 0 to 1
+    float     corner,      // phase of the corner
+    float     dt)          // phase step for this sample
+{
+    float    d;            // phase distance to corner, -0.5 to 0.5
+    float    x;            // table position
+    int      i;
+
+    d = phout - corner;
+    if (d >= 0.5f)
+        d -= 1.0f;
+    else if (d < -0.5f)
+        d += 1.0f;
+
+    // Most samples are not near a corner.  Check that before dividing.
+    if (fabsf(d) >= BLEP_W * dt)
+        return 0.0f;
+    x = d / dt;
+    if ((x <= -BLEP_W) || (x >= BLEP_W))
+        return 0.0f;
+    x = (x + BLEP_W) * BLEP_OS;
+    i = (int) x;
+    if (i >= NBLEP - 1)
+        return tbl[NBLEP - 1];
+    return tbl[i] + ((x - (float) i) * (tbl[i + 1] - tbl[i]));
+}
+
+
+/***************************************************************
+ * wave_scalar(): - The plain C kernel.  This is also used for
+ * the samples left over at the end of a block by the SIMD
+ * kernels.
+ *
+ * Input:        as for osc_wave()
+ * Output:       out[] has the waveform value of each phase
+ * Effects:
+ ***************************************************************/
+static void wave_scalar(
+    int       type,        // Sine, square, triangle, noise
+    float    *out,         // phase in, waveform value out
+    uint32_t *noise,       // white noise for each sample
+    int       nsamp)       // number of samples to convert
+{
+    float    phout;        // phase of one sample
+    int      sinemode;     // the mode for the whole buffer
+    int      s;
+
+    if (type == OTYPE_NOISE) {
+        // whitenoise is an unsigned 32 bit integer.  We need to map its value
+        // into a float between -1.0 and 1.0.  First to 0-1 then sign using MSB
+        for (s = 0; s < nsamp; s++) {
+            out[s] = ((float) (noise[s] & 0x7ffffff) / (float)(1 << 27));
+            out[s] = (noise[s] & 0x8000000) ? -out[s] : out[s];
+        }
+        return;
+    }
+    if ((type != OTYPE_SQUARE) && (type != OTYPE_SINE) && (type != OTYPE_TRIANGLE)) {
+        // wavetables are done by wt_wave() in wavetbl.c
+        for (s = 0; s < nsamp; s++)
+            out[s] = 0.0;
+        return;
+    }
+
+    if (type == OTYPE_SQUARE) {
+        for (s = 0; s < nsamp; s++)
+            out[s] = (out[s] < 0.5) ? 1.0 : -1.0;
+    }
+    else if (type == OTYPE_SINE) {
+        // one loop per mode so each can be vectorized on its own
+        sinemode = __atomic_load_n(&rset.sinemode, __ATOMIC_RELAXED);
+        if (sinemode == SINE_TABLE) {
+            for (s = 0; s < nsamp; s++)
+                out[s] = sine_table(out[s]);
+        }
+        else if (sinemode == SINE_POLY) {
+            for (s = 0; s < nsamp; s++)
+                out[s] = sine_poly(out[s]);
+        }
+        else {
+            for (s = 0; s < nsamp; s++)
+                out[s] = sine_quarter(out[s]);
+        }
+    }
+    else {
+        for (s = 0; s < nsamp; s++) {
+            phout = out[s];
+            if (phout < 0.25)
+                out[s] = phout * 4.0;
+            else if (phout < 0.75)
+                out[s] = 2.0 - (phout * 4.0);
+            else
+                out[s] = (phout * 4.0) + -4.0;
+        }
+    }
+}
+
+
+#ifdef OSC_X86
+/***************************************************************
+ * wave_sse2(): - The SSE2 kernel, four samples at a time.
+ * The quadrant folds are exact in float so they match the
+ * double arithmetic of the reference renderer.  SSE2 has no
+ * gather so the sine table is read one lane at a time.
+ *
+ * Input:        as for osc_wave()
+ * Output:       out[] has the waveform value of each phase
+ * Effects:
+ ***************************************************************/
+__attribute__ ((target("sse2")))
+static void wave_sse2(
+    int       type,        // Sine, square, triangle, noise
+    float    *out,         // phase in, waveform value out
+    uint32_t *noise,       // white noise for each sample
+    int       nsamp)       // number of samples to convert
+{
+    __m128   one   = _mm_set1_ps(1.0f);
+    __m128   half  = _mm_set1_ps(0.5f);
+    __m128   qtr   = _mm_set1_ps(0.25f);
+    __m128   tqtr  = _mm_set1_ps(0.75f);
+    __m128   two   = _mm_set1_ps(2.0f);
+    __m128   four  = _mm_set1_ps(4.0f);
+    __m128   tmax  = _mm_set1_ps((float)(NSINES - 1));
+    __m128   tlen  = _mm_set1_ps((float) NSINEFULL);
+    __m128   twopi = _mm_set1_ps(TWOPI);
+    __m128   zero  = _mm_setzero_ps();
+    __m128   sign  = _mm_set1_ps(-0.0f);
+    __m128i  imask = _mm_set1_epi32(NSINEFULL - 1);
+    __m128i  nmask = _mm_set1_epi32(0x7ffffff);
+    __m128i  nsign = _mm_set1_epi32(0x8000000);
+    __m128   p, x4, y, m, lo, hi;
+    __m128   fr, z, z2;
+    __m128i  n, idx;
+    int32_t  ix[4] __attribute__ ((aligned(16)));
+    float    v[4] __attribute__ ((aligned(16)));
+    float    w[4] __attribute__ ((aligned(16)));
+    int      sinemode;
+    int      s;
+
+    if ((type != OTYPE_SQUARE) && (type != OTYPE_SINE) &&
+        (type != OTYPE_TRIANGLE) && (type != OTYPE_NOISE)) {
+        wave_scalar(type, out, noise, nsamp);
+        return;
+    }
+    sinemode = __atomic_load_n(&rset.sinemode, __ATOMIC_RELAXED);
+
+    for (s = 0; s + 4 <= nsamp; s += 4) {
+        if (type == OTYPE_NOISE) {
+            n = _mm_loadu_si128((__m128i *) &noise[s]);
+            y = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(n, nmask)), _mm_set1_ps(NOISESCALE));
+            // move the sign bit (bit 27) up to the float sign bit
+            y = _mm_xor_ps(y, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(n, nsign), 4)));
+            _mm_storeu_ps(&out[s], y);
+            continue;
+        }
+
+        p = _mm_loadu_ps(&out[s]);
+        x4 = _mm_mul_ps(p, four);
+
+        if (type == OTYPE_SQUARE) {
+            m = _mm_cmplt_ps(p, half);
+            y = _mm_or_ps(_mm_and_ps(m, one), _mm_andnot_ps(m, _mm_xor_ps(one, sign)));
+        }
+        else if (type == OTYPE_TRIANGLE) {
+            lo = _mm_sub_ps(two, x4);
+            hi = _mm_sub_ps(x4, four);
+            m = _mm_cmplt_ps(p, tqtr);
+            y = _mm_or_ps(_mm_and_ps(m, lo), _mm_andnot_ps(m, hi));
+            m = _mm_cmplt_ps(p, qtr);
+            y = _mm_or_ps(_mm_and_ps(m, x4), _mm_andnot_ps(m, y));
+        }
+        else if (sinemode == SINE_TABLE) {
+            // sine_table() four at a time
+            lo = _mm_mul_ps(p, tlen);
+            idx = _mm_cvttps_epi32(lo);
+            fr = _mm_sub_ps(lo, _mm_cvtepi32_ps(idx));
+            idx = _mm_and_si128(idx, imask);
+            _mm_store_si128((__m128i *) ix, idx);
+            v[0] = sinefull[ix[0]];
+            v[1] = sinefull[ix[1]];
+            v[2] = sinefull[ix[2]];
+            v[3] = sinefull[ix[3]];
+            w[0] = sinefull[ix[0] + 1];
+            w[1] = sinefull[ix[1] + 1];
+            w[2] = sinefull[ix[2] + 1];
+            w[3] = sinefull[ix[3] + 1];
+            lo = _mm_load_ps(v);
+            y = _mm_add_ps(lo, _mm_mul_ps(fr, _mm_sub_ps(_mm_load_ps(w), lo)));
+        }
+        else if (sinemode == SINE_POLY) {
+            // sine_poly() four at a time
+            lo = _mm_sub_ps(p, half);
+            hi = _mm_andnot_ps(sign, lo);
+            hi = _mm_min_ps(hi, _mm_sub_ps(half, hi));
+            z = _mm_mul_ps(hi, twopi);
+            z2 = _mm_mul_ps(z, z);
+            y = _mm_set1_ps(SIN_C11);
+            y = _mm_add_ps(_mm_mul_ps(y, z2), _mm_set1_ps(SIN_C9));
+            y = _mm_add_ps(_mm_mul_ps(y, z2), _mm_set1_ps(SIN_C7));
+            y = _mm_add_ps(_mm_mul_ps(y, z2), _mm_set1_ps(SIN_C5));
+            y = _mm_add_ps(_mm_mul_ps(y, z2), _mm_set1_ps(SIN_C3));
+            y = _mm_add_ps(_mm_mul_ps(y, z2), one);
+            y = _mm_mul_ps(y, z);
+            m = _mm_cmpgt_ps(lo, zero);
+            y = _mm_xor_ps(y, _mm_and_ps(m, sign));
+        }
+        else {
+            // Fold each quadrant onto the first.  Start with the
+            // last quadrant and overwrite lanes for earlier ones.
+            lo = _mm_mul_ps(_mm_sub_ps(p, half), four);
+            y = _mm_sub_ps(two, lo);
+            m = _mm_cmplt_ps(p, tqtr);
+            y = _mm_or_ps(_mm_and_ps(m, lo), _mm_andnot_ps(m, y));
+            hi = _mm_sub_ps(two, x4);
+            m = _mm_cmplt_ps(p, half);
+            y = _mm_or_ps(_mm_and_ps(m, hi), _mm_andnot_ps(m, y));
+            m = _mm_cmplt_ps(p, qtr);
+            y = _mm_or_ps(_mm_and_ps(m, x4), _mm_andnot_ps(m, y));
+
+            idx = _mm_cvttps_epi32(_mm_mul_ps(tmax, y));
+            _mm_store_si128((__m128i *) ix, idx);
+            v[0] = sinetbl[ix[0]];
+            v[1] = sinetbl[ix[1]];
+            v[2] = sinetbl[ix[2]];
+            v[3] = sinetbl[ix[3]];
+            y = _mm_load_ps(v);
+            // negative in second half of cycle
+            m = _mm_cmpgt_ps(p, half);
+            y = _mm_xor_ps(y, _mm_and_ps(m, sign));
+        }
+        _mm_storeu_ps(&out[s], y);
+    }
+    if (s < nsamp)
+        wave_scalar(type, &out[s], &noise[s], nsamp - s);
+}
+
+
+/***************************************************************
+ * wave_avx2(): - The AVX2 kernel, eight samples at a time.
+ * This is the SSE2 kernel with wider registers and a gather
+ * for the sine table.  It is compiled for AVX2 but not FMA so
+ * no multiply and add is fused, which would change rounding.
+ *
+ * Input:        as for osc_wave()
+ * Output:       out[] has the waveform value of each phase
+ * Effects:
+ ***************************************************************/
+__attribute__ ((target("avx2")))
+static void wave_avx2(
+    int       type,        // Sine, square, triangle, noise
+    float    *out,         // phase in, waveform value out
+    uint32_t *noise,       // white noise for each sample
+    int       nsamp)       // number of samples to convert
+{
+    __m256   one   = _mm256_set1_ps(1.0f);
+    __m256   half  = _mm256_set1_ps(0.5f);
+    __m256   qtr   = _mm256_set1_ps(0.25f);
+    __m256   tqtr  = _mm256_set1_ps(0.75f);
+    __m256   two   = _mm256_set1_ps(2.0f);
+    __m256   four  = _mm256_set1_ps(4.0f);
+    __m256   tmax  = _mm256_set1_ps((float)(NSINES - 1));
+    __m256   tlen  = _mm256_set1_ps((float) NSINEFULL);
+    __m256   twopi = _mm256_set1_ps(TWOPI);
+    __m256   zero  = _mm256_setzero_ps();
+    __m256   sign  = _mm256_set1_ps(-0.0f);
+    __m256i  imask = _mm256_set1_epi32(NSINEFULL - 1);
+    __m256i  nmask = _mm256_set1_epi32(0x7ffffff);
+    __m256i  nsign = _mm256_set1_epi32(0x8000000);
+    __m256   p, x4, y, m, lo, hi;
+    __m256   fr, z, z2;
+    __m256i  n, idx;
+    int      sinemode;
+    int      s;
+
+    if ((type != OTYPE_SQUARE) && (type != OTYPE_SINE) &&
+        (type != OTYPE_TRIANGLE) && (type != OTYPE_NOISE)) {
+        wave_scalar(type, out, noise, nsamp);
+        return;
+    }
+    sinemode = __atomic_load_n(&rset.sinemode, __ATOMIC_RELAXED);
+
+    for (s = 0; s + 8 <= nsamp; s += 8) {
+        if (type == OTYPE_NOISE) {
+            n = _mm256_loadu_si256((__m256i *) &noise[s]);
+            y = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(n, nmask)), _mm256_set1_ps(NOISESCALE));
+            y = _mm256_xor_ps(y, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(n, nsign), 4)));
+            _mm256_storeu_ps(&out[s], y);
+            continue;
+        }
+
+        p = _mm256_loadu_ps(&out[s]);
+        x4 = _mm256_mul_ps(p, four);
+
+        if (type == OTYPE_SQUARE) {
+            m = _mm256_cmp_ps(p, half, _CMP_LT_OQ);
+            y = _mm256_blendv_ps(_mm256_xor_ps(one, sign), one, m);
+        }
+        else if (type == OTYPE_TRIANGLE) {
+            y = _mm256_sub_ps(x4, four);
+            y = _mm256_blendv_ps(y, _mm256_sub_ps(two, x4), _mm256_cmp_ps(p, tqtr, _CMP_LT_OQ));
+            y = _mm256_blendv_ps(y, x4, _mm256_cmp_ps(p, qtr, _CMP_LT_OQ));
+        }
+        else if (sinemode == SINE_TABLE) {
+            lo = _mm256_mul_ps(p, tlen);
+            idx = _mm256_cvttps_epi32(lo);
+            fr = _mm256_sub_ps(lo, _mm256_cvtepi32_ps(idx));
+            idx = _mm256_and_si256(idx, imask);
+            lo = _mm256_i32gather_ps(sinefull, idx, 4);
+            hi = _mm256_i32gather_ps(&sinefull[1], idx, 4);
+            y = _mm256_add_ps(lo, _mm256_mul_ps(fr, _mm256_sub_ps(hi, lo)));
+        }
+        else if (sinemode == SINE_POLY) {
+            lo = _mm256_sub_ps(p, half);
+            hi = _mm256_andnot_ps(sign, lo);
+            hi = _mm256_min_ps(hi, _mm256_sub_ps(half, hi));
+            z = _mm256_mul_ps(hi, twopi);
+            z2 = _mm256_mul_ps(z, z);
+            y = _mm256_set1_ps(SIN_C11);
+            y = _mm256_add_ps(_mm256_mul_ps(y, z2), _mm256_set1_ps(SIN_C9));
+            y = _mm256_add_ps(_mm256_mul_ps(y, z2), _mm256_set1_ps(SIN_C7));
+            y = _mm256_add_ps(_mm256_mul_ps(y, z2), _mm256_set1_ps(SIN_C5));
+            y = _mm256_add_ps(_mm256_mul_ps(y, z2), _mm256_set1_ps(SIN_C3));
+            y = _mm256_add_ps(_mm256_mul_ps(y, z2), one);
+            y = _mm256_mul_ps(y, z);
+            y = _mm256_xor_ps(y, _mm256_and_ps(_mm256_cmp_ps(lo, zero, _CMP_GT_OQ), sign));
+        }
+        else {
+            lo = _mm256_mul_ps(_mm256_sub_ps(p, half), four);
+            y = _mm256_sub_ps(two, lo);
+            y = _mm256_blendv_ps(y, lo, _mm256_cmp_ps(p, tqtr, _CMP_LT_OQ));
+            y = _mm256_blendv_ps(y, _mm256_sub_ps(two, x4), _mm256_cmp_ps(p, half, _CMP_LT_OQ));
+            y = _mm256_blendv_ps(y, x4, _mm256_cmp_ps(p, qtr, _CMP_LT_OQ));
+
+            idx = _mm256_cvttps_epi32(_mm256_mul_ps(tmax, y));
+            y = _mm256_i32gather_ps(sinetbl, idx, 4);
+            m = _mm256_cmp_ps(p, half, _CMP_GT_OQ);
+            y = _mm256_xor_ps(y, _mm256_and_ps(m, sign));
+        }
+        _mm256_storeu_ps(&out[s], y);
+    }
+    if (s < nsamp)
+        wave_scalar(type, &out[s], &noise[s], nsamp - s);
+}
+#endif
@@ -0,0 +1,418 @@
+/***************************************************************
+ * output.c --  Buffered audio output for the synthesizer.  Rendered
+ *              samples are converted to the output format and
+ *              collected in a ring buffer.  The buffer is written
+ *              to standard out in large writes.  Each block, and
+ *              each bus, is also passed to the audio stream
+ *              subscribers.
+ *
+ * Copyright:   Copyright (C) 2023 by Atomlab, LLC
+ *
+ * License:     This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the Version 2 of the GNU General
+ *              Public License as published by the Free Software Foundation.
+ *              GPL2.txt in the docs directory is a copy of this license.
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *              GNU General Public License for more details.
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include "sqlizer.h"
+
+
+/***************************************************************************
+ *  - Limits and defines
+ ***************************************************************************/
+#define  OUTBUFSZ    (1 << 18)     // bytes in output ring buffer.  Power of 2
+#define  FULLVOLUME  ((1 << 15) -1)
+#define  FULLVOL24   ((1 << 23) -1)
+#define  FULLVOL32   2147483647.0  // (1 << 31) -1 as a double
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define  HOST_BE     1             // this host stores integers big endian
+#else
+#define  HOST_BE     0
+#endif
+
+
+/***************************************************************************
+ *  - Function prototypes and external references
+ ***************************************************************************/
+void   init_output(int format, int channels);
+int    out_format(char *name);
+void   out_write(float *left, float *right, int nsamp);
+void   out_flush();
+int    out_pending();
+int    out_framesize();
+void   out_bus(int bus, float *left, float *right, int nsamp);
+static int out_frames(float *left, float *right, int nsamp);
+static int out_convert(int nval, char *block);
+extern int  str_wanted(int ring);
+extern void str_write(int ring, char *block, int nbytes);
+extern void str_wake(int nsamp);
+extern struct SYNTH synth;
+extern struct RSET rset;
+
+
+/***************************************************************************
+ *  - Variable allocation for this file
+ ***************************************************************************/
+static char     outbuf[OUTBUFSZ]; // ring buffer of bytes to output
+static uint32_t outhead;          // bytes ever added to outbuf
+static uint32_t outtail;          // bytes ever written from outbuf
+static int      framesize;        // bytes per sample time, all channels
+static float    frames[MX_BLOCK * 2]; // clipped and interleaved samples
+static char     block[MX_BLOCK * 2 * 4] __attribute__ ((aligned(16))); // block in output format
+
+// Output formats.  The names are the ones used by aplay's -f option.
+// The order must match the OUTFMT_ values in sqlizer.h.
+static struct {
+    char    *name;             // format name
+    int      bytes;            // bytes per sample
+} formats[] = {
+    { "S16_BE", 2 },
+    { "S16_LE", 2 },
+    { "S24_3LE", 3 },
+    { "S32_LE", 4 },
+    { "FLOAT_LE", 4 },
+};
+#define NFORMATS   (int)(sizeof(formats) / sizeof(formats[0]))
+
+
+/***************************************************************
+ * init_output(): - Set up the audio output.  Writes to standard
+ * out must not block so a slow reader can never stop the render
+ * thread.  Samples wait in the ring buffer until they can be sent.
+ *    The O_NONBLOCK flag belongs to the open file, which is shared
+ * with the shell and with the other programs on the pipe or tty.
+ * Setting it on our standard out would make their reads and
+ * writes fail with EAGAIN.  Instead a pipe or tty is opened again
+ * through /proc, which gives an open file of our own, and that is
+ * made non-blocking and put on standard out.  Writes to a regular
+ * file never block.  Anything else is left as it is and a slow
+ * reader can stall the render thread.
+ *
+ * Input:        output format and number of channels
+ * Output:
+ * Effects:      output ring buffer and standard out
+ ***************************************************************/
+void init_output(
+    int format,        // one of the OUTFMT_ values
+    int channels)      // one for mono, two for stereo
+{
+    struct stat st;            // type of standard out
+    char     path[32];         // standard out in /proc
+    int      fd;               // our own open file for standard out
+
+    outhead = 0;
+    outtail = 0;
+    synth.outformat = format;
+    synth.outchannels = channels;
+    framesize = formats[format].bytes * channels;
+    synth.flushsize = DEF_FLUSH;
+    synth.outdrops = 0;
+
+    if ((fstat(OUT_FD, &st) < 0) || !(S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode)))
+        return;
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", OUT_FD);
+    fd = open(path, O_WRONLY | O_NONBLOCK);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to reopen standard out, audio output may block\n");
+        return;
+    }
+    (void) dup2(fd, OUT_FD);
+    close(fd);
+}
+
+
+/***************************************************************
+ * out_format(): - Look up an output format by name.
+ *
+ * Input:        format name as given to aplay, eg "S16_LE"
+ * Output:       the OUTFMT_ value or -1 if not known
+ * Effects:
+ ***************************************************************/
+int out_format(
+    char *name)        // format name
+{
+    int      i;
+
+    for (i = 0; i < NFORMATS; i++) {
+        if (strcasecmp(name, formats[i].name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+
+/***************************************************************
+ * out_write(): - Convert a block of rendered samples to the
+ * output format and add them to the output ring buffer.  The
+ * buffer is flushed once it holds rset.flushsize samples.
+ * If the reader has fallen so far behind that the buffer is
+ * full then the new samples are dropped and counted.
+ *  Mono output is the left channel.  Stereo output interleaves
+ * the left and right channels.
+ *  The stream subscribers get the block whether or not there is
+ * room for it here.  Any bus output for the block must already
+ * have been given to out_bus().
+ *
+ * Input:        left and right samples, and how many
+ * Output:
+ * Effects:      output ring buffer
+ ***************************************************************/
+void out_write(
+    float *left,       // left channel samples
+    float *right,      // right channel samples
+    int    nsamp)      // number of samples in the block
+{
+    int      nbytes;           // bytes in converted block
+    int      pos;              // offset of outhead in outbuf
+    int      first;            // bytes that fit before end of outbuf
+
+    nbytes = out_frames(left, right, nsamp);
+    if (str_wanted(0))
+        str_write(0, block, nbytes);
+    str_wake(nsamp);
+
+    // Drop the block if there is no room for it
+    if ((OUTBUFSZ - (outhead - outtail)) < (uint32_t) nbytes) {
+        synth.outdrops += nsamp;
+        synth.overruns++;
+        return;
+    }
+
+    // Copy into the ring buffer, wrapping at the end if needed
+    pos = outhead & (OUTBUFSZ - 1);
+    first = OUTBUFSZ - pos;
+    if (first >= nbytes) {
+        memcpy(&outbuf[pos], block, nbytes);
+    } else {
+        memcpy(&outbuf[pos], block, first);
+        memcpy(outbuf, &block[first], nbytes - first);
+    }
+    outhead += nbytes;
+
+    if (out_pending() >= __atomic_load_n(&rset.flushsize, __ATOMIC_RELAXED))
+        out_flush();
+}
+
+
+/***************************************************************
+ * out_bus(): - Convert the output of one bus to the output
+ * format and pass it to the stream subscribers of that bus.
+ * Nothing is done if no one wants the bus.
+ *
+ * Input:        bus index, left and right samples, and how many
+ * Output:
+ * Effects:      stream ring of the bus
+ ***************************************************************/
+void out_bus(
+    int    bus,        // index of the bus
+    float *left,       // left channel samples
+    float *right,      // right channel samples
+    int    nsamp)      // number of samples in the block
+{
+    int      nbytes;           // bytes in converted block
+
+    if (!str_wanted(bus + 1))
+        return;
+    nbytes = out_frames(left, right, nsamp);
+    str_write(bus + 1, block, nbytes);
+}
+
+
+/***************************************************************
+ * out_frames(): - Clip and interleave a block of samples into
+ * frames[] and convert it to the output format in block[].
+ *
+ * Input:        left and right samples, and how many
+ * Output:       number of bytes in block[]
+ * Effects:      frames[] and block[]
+ ***************************************************************/
+static int out_frames(
+    float *left,       // left channel samples
+    float *right,      // right channel samples
+    int    nsamp)      // number of samples in the block
+{
+    float    sample;           // one clipped sample
+    int      s;
+
+    // Clip and interleave.  Each pass over the block is kept simple
+    // so the compiler can vectorize it.
+    if (synth.outchannels == 1) {
+        for (s = 0; s < nsamp; s++) {
+            sample = left[s];
+            sample = (sample > 1.0f) ? 1.0f : sample;
+            sample = (sample < -1.0f) ? -1.0f : sample;
+            frames[s] = sample;
+        }
+    } else {
+        for (s = 0; s < nsamp; s++) {
+            sample = left[s];
+            sample = (sample > 1.0f) ? 1.0f : sample;
+            sample = (sample < -1.0f) ? -1.0f : sample;
+            frames[2 * s] = sample;
+            sample = right[s];
+            sample = (sample > 1.0f) ? 1.0f : sample;
+            sample = (sample < -1.0f) ? -1.0f : sample;
+            frames[(2 * s) + 1] = sample;
+        }
+    }
+    return (out_convert(nsamp * synth.outchannels, block));
+}
+
+
+/***************************************************************
+ * out_flush(): - Write as much of the output ring buffer as
+ * standard out will take.  The buffered bytes may wrap around
+ * the end of the ring so we use writev() to send both parts in
+ * one system call.  A partial write leaves the remainder in the
+ * buffer for the next flush.
+ *
+ * Input:
+ * Output:
+ * Effects:      output ring buffer
+ ***************************************************************/
+void out_flush()
+{
+    struct iovec iov[2];       // the one or two parts of the buffer
+    int      niov;             // number of parts
+    uint32_t nbytes;           // bytes in the buffer
+    int      pos;              // offset of outtail in outbuf
+    ssize_t  ret;              // writev() return value
+
+    nbytes = outhead - outtail;
+    while (nbytes > 0) {
+        pos = outtail & (OUTBUFSZ - 1);
+        iov[0].iov_base = &outbuf[pos];
+        if ((pos + nbytes) <= OUTBUFSZ) {
+            iov[0].iov_len = nbytes;
+            niov = 1;
+        } else {
+            iov[0].iov_len = OUTBUFSZ - pos;
+            iov[1].iov_base = outbuf;
+            iov[1].iov_len = nbytes - iov[0].iov_len;
+            niov = 2;
+        }
+
+        ret = writev(OUT_FD, iov, niov);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                return;    // try again when the output is writable
+            // Hard error.  Log it and discard what we have.
+            fprintf(stderr, "error #%d on audio output\n", errno);
+            synth.outdrops += out_pending();
+            outtail = outhead;
+            return;
+        }
+        outtail += ret;
+        nbytes -= ret;
+    }
+}
+
+
+/***************************************************************
+ * out_pending(): - Return the number of samples waiting in the
+ * output ring buffer.
+ *
+ * Input:
+ * Output:       number of buffered samples
+ * Effects:
+ ***************************************************************/
+int out_pending()
+{
+    return ((outhead - outtail) / framesize);
+}
+
+
+/***************************************************************
+ * out_framesize(): - Return the number of bytes in one sample
+ * time of output, all channels.
+ *
+ * Input:
+ * Output:       bytes per frame
+ * Effects:
+ ***************************************************************/
+int out_framesize()
+{
+    return (framesize);
+}
+
+
+/***************************************************************
+ * out_convert(): - Convert the clipped samples in frames[] to
+ * the output format.  The test on format is made once for the
+ * block and each conversion is a single pass the compiler can
+ * vectorize.
+ *
+ * Input:        number of values in frames[], output buffer
+ * Output:       number of bytes in the output buffer
+ * Effects:
+ ***************************************************************/
+static int out_convert(
+    int   nval,        // number of samples, all channels
+    char *out)         // converted samples
+{
+    int16_t  *p16;             // output as 16 bit samples
+    int32_t  *p32;             // output as 32 bit samples
+    uint32_t *pu32;            // output as 32 bit words
+    int32_t   val;             // one 24 bit sample
+    int       i;
+
+    switch (synth.outformat) {
+    case OUTFMT_S16_BE:
+    case OUTFMT_S16_LE:
+        p16 = (int16_t *) out;
+        for (i = 0; i < nval; i++)
+            p16[i] = (int16_t) (int) (frames[i] * (float)FULLVOLUME);
+        if (HOST_BE != (synth.outformat == OUTFMT_S16_BE)) {
+            for (i = 0; i < nval; i++)
+                p16[i] = (int16_t) __builtin_bswap16((uint16_t) p16[i]);
+        }
+        return (2 * nval);
+
+    case OUTFMT_S24_3LE:
+        // Three bytes per sample does not vectorize well, but is rare
+        for (i = 0; i < nval; i++) {
+            val = (int32_t) (frames[i] * (float)FULLVOL24);
+            out[3 * i] = val & 0x0000ff;
+            out[(3 * i) + 1] = (val >> 8) & 0x0000ff;
+            out[(3 * i) + 2] = (val >> 16) & 0x0000ff;
+        }
+        return (3 * nval);
+
+    case OUTFMT_S32_LE:
+        // A float does not hold (1 << 31) -1 exactly so scale as double
+        p32 = (int32_t *) out;
+        for (i = 0; i < nval; i++)
+            p32[i] = (int32_t) ((double)frames[i] * FULLVOL32);
+        if (HOST_BE) {
+            for (i = 0; i < nval; i++)
+                p32[i] = (int32_t) __builtin_bswap32((uint32_t) p32[i]);
+        }
+        return (4 * nval);
+
+    case OUTFMT_FLOAT_LE:
+    default:
+        memcpy(out, frames, 4 * nval);
+        if (HOST_BE) {
+            pu32 = (uint32_t *) out;
+            for (i = 0; i < nval; i++)
+                pu32[i] = __builtin_bswap32(pu32[i]);
+        }
+        return (4 * nval);
+    }
+}
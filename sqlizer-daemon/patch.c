@@ -0,0 +1,187 @@
+/***************************************************************
+ * patch.c --   Voice patches.  Complete voice sounds kept ready
+ *              to copy into a voice.
+ *
+ * Copyright:   Copyright (C) 2023 by Atomlab, LLC
+ *
+ * License:     This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the Version 2 of the GNU General
+ *              Public License as published by the Free Software Foundation.
+ *              GPL2.txt in the docs directory is a copy of this license.
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *              GNU General Public License for more details.
+ *
+ **************************************************************/
+
+/***************************************************************
+ * Overview:
+ *    Setting up a note takes an UPDATE of some 45 columns of a
+ * voice, and each one is parsed and run through its write
+ * callback.  A patch holds all of those columns instead.  The
+ * patches table has the same sound columns as the voices table
+ * with the same write callbacks, so the phase steps, glide, and
+ * filter coefficients of a patch are worked out once, when the
+ * patch is written.  Setting patch in a voice then just copies
+ * the patch fields into the voice.
+ *    The patch fields are the words of struct VOICE that make up
+ * the sound.  The identity and state of the voice, its phases,
+ * and the fields only the render thread uses are left alone.
+ * Words the same UPDATE wrote to the voice are left alone too, so
+ * "patch=3, o1freq=220.0" plays patch 3 at 220 Hz.  The voice
+ * write callbacks note each word they write and the patch is
+ * copied when the command is sent, so this holds whatever the
+ * order of the columns and even if o1freq was already 220.  A
+ * glide in the patch is aimed again from the voice's own
+ * frequency.
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "sqlizer.h"
+
+
+/***************************************************************************
+ *  - Limits and defines
+ ***************************************************************************/
+// A field of struct VOICE that is part of a patch.  The render
+// thread changes the PFDYN fields as the voice plays so they are
+// always sent.
+#define  PF(f)      { offsetof(struct VOICE, f), 0 }
+#define  PFDYN(f)   { offsetof(struct VOICE, f), 1 }
+
+
+/***************************************************************************
+ *  - Function prototypes and external references
+ ***************************************************************************/
+void   init_patches();
+int    patch_field(int offset);
+void   apply_patch(int v, int p, uint32_t *written);
+extern void mark_voice(int v);
+extern void force_field(int v, int offset);
+extern void mark_derived(int v, unsigned fields);
+extern struct VOICE *voices;
+extern struct SYNTH synth;
+
+
+/***************************************************************************
+ *  - Variable allocation for this file
+ ***************************************************************************/
+struct PATCH patches[MX_PATCHES]; // the patches table
+
+static const struct {
+    int      offset;           // byte offset of the word in struct VOICE
+    int      force;            // set if the render thread changes it
+} patchfields[] = {
+    PF(phasereset),
+    PF(o1type), PF(o1freq), PFDYN(o1phasestep), PF(o1symmetry),
+    PF(o1phaseoffset), PF(o1gain), PF(o1wtable),
+    PF(vibtype), PF(vibfreq), PF(vibphasestep), PF(vibsymmetry),
+    PF(vibphaseoffset), PF(vibdepth), PF(vibo1phase),
+    PF(glidefreq), PFDYN(glidems), PFDYN(glidestep), PFDYN(glidecount),
+    PF(o2type), PF(o2freq), PF(o2phasestep), PF(o2symmetry),
+    PF(o2phaseoffset), PF(o2gain), PF(o2wtable), PF(mixmode),
+    PF(tremtype), PF(tremfreq), PF(tremphasestep), PF(tremdepth),
+    PF(tremsymmetry), PF(tremphaseoffset),
+    PF(step0time), PF(step1time), PF(step2time), PF(step3time),
+    PF(step4time), PF(step5time), PF(step6time), PF(step7time),
+    PF(step0gain), PF(step1gain), PF(step2gain), PF(step3gain),
+    PF(step4gain), PF(step5gain), PF(step6gain), PF(step7gain),
+    PF(envcurve),
+    PF(flttype), PF(fltq), PF(fltrolloff),
+    PF(fltf1), PF(flt1b0), PF(flt1b1), PF(flt1b2), PF(flt1a1), PF(flt1a2),
+    PF(fltf2), PF(flt2b0), PF(flt2b1), PF(flt2b2), PF(flt2a1), PF(flt2a2),
+    PF(outputclipping), PF(outputgain), PF(outputchannel), PF(bus),
+};
+#define NPATCHFIELDS   (int)(sizeof(patchfields) / sizeof(patchfields[0]))
+
+
+/***************************************************************
+ * init_patches(): - Number the patches and give each one the
+ * sound of a voice as it is at startup.  This is called after
+ * init_synth().
+ *
+ * Input:
+ * Output:
+ * Effects:      patches table
+ ***************************************************************/
+void init_patches()
+{
+    int      i;
+
+    for (i = 0; i < MX_PATCHES; i++) {
+        patches[i].idx = i;
+        patches[i].name[0] = (char) 0;
+        patches[i].voice = voices[0];
+    }
+}
+
+
+/***************************************************************
+ * patch_field(): - Whether a field of struct VOICE is part of
+ * a patch.  The patches table has a column for each voices
+ * column that is.
+ *
+ * Input:        byte offset of the field in struct VOICE
+ * Output:       1 if the field is in a patch, else 0
+ * Effects:
+ ***************************************************************/
+int patch_field(
+    int offset)        // byte offset of the field
+{
+    int      f;
+
+    for (f = 0; f < NPATCHFIELDS; f++) {
+        if (patchfields[f].offset == offset)
+            return 1;
+    }
+    return 0;
+}
+
+
+/***************************************************************
+ * apply_patch(): - Copy a patch into a voice.  A word the
+ * command wrote is kept.  The voice is marked so the changes go
+ * to the render thread with the rest of the command.  This is
+ * called when the command that set patch is sent.
+ *
+ * Input:        voice index, patch index, bitmap of the words of
+ *               struct VOICE the command wrote
+ * Output:
+ * Effects:      voices[] and the list of changed voices
+ ***************************************************************/
+void apply_patch(
+    int v,             // index of the voice
+    int p,             // index of the patch
+    uint32_t *written) // words the command wrote, one bit each
+{
+    struct VOICE *pvoc;        // the voice
+    char    *pdst;             // voice to copy into
+    char    *psrc;             // patch to copy from
+    int      off;              // byte offset of the word
+    int      word;             // word index of the field
+    int      f;
+
+    pvoc = &voices[v];
+    pdst = (char *) pvoc;
+    psrc = (char *) &patches[p].voice;
+    for (f = 0; f < NPATCHFIELDS; f++) {
+        off = patchfields[f].offset;
+        word = off / sizeof(uint32_t);
+        if (written[word / 32] & (1u << (word % 32)))
+            continue;
+        memcpy(pdst + off, psrc + off, sizeof(uint32_t));
+        if (patchfields[f].force)
+            force_field(v, off);
+    }
+
+    // The patch's glide was worked out from its own o1freq.  Aim it
+    // from the voice's in case the command changed it.
+    if (pvoc->glidecount != 0)
+        mark_derived(v, DRV_GLIDE);
+    mark_voice(v);
+}
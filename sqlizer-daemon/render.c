@@ -0,0 +1,969 @@
+/***************************************************************
+ * render.c --  The real-time render thread and the queues that
+ *              connect it to the SQL thread.
+ *
+ * Copyright:   Copyright (C) 2023 by Atomlab, LLC
+ *
+ * License:     This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the Version 2 of the GNU General
+ *              Public License as published by the Free Software Foundation.
+ *              GPL2.txt in the docs directory is a copy of this license.
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *              GNU General Public License for more details.
+ *
+ **************************************************************/
+
+/***************************************************************
+ * Overview:
+ *    Synthesis runs on its own thread so that SQL commands, no
+ * matter how large, can never delay the audio.  The two threads
+ * share no voice data.  The SQL thread owns voices[], the table
+ * that librta reads and writes.  The render thread owns rvoices[],
+ * its private copy of the voices.
+ *    Changes go from the SQL thread to the render thread through
+ * a lock-free single-producer single-consumer ring.  The write
+ * callbacks in tables.c mark which voices a command changed.
+ * After each command the changed 32 bit words of those voices
+ * are put into the ring and the ring head is advanced.  The
+ * render thread drains the ring at the start of each block, so
+ * all of the changes from one SQL command take effect together.
+ * The ring holds every word of every voice, so the SQL thread can
+ * always wait for room for a whole command before it starts to
+ * put the command in.  The render thread never sees part of one,
+ * no matter how many voices an UPDATE touches.
+ *    A batch of changes can also be due at a given sample.  It
+ * starts with an entry that gives the sample rather than a change
+ * and ends with an entry that marks the end.  The render thread
+ * moves a batch that is not yet due out of the ring into a queue
+ * of its own, so changes sent after it still take effect at the
+ * next block.  When the sample comes up the block is split there
+ * so the changes start on the sample they are due.  A change sent
+ * after a batch replaces a change to the same word in the batch,
+ * so the last word sent is the one that stays, as SQL expects.
+ *    A few fields, such as vstate and the phase accumulators,
+ * are changed by the render thread as the voice plays.  The
+ * render thread publishes these after each block under a
+ * sequence lock and the SQL thread copies them into voices[]
+ * before each command.  Only voices that played or were changed
+ * are published, and the SQL thread copies only the voices
+ * published since it last looked, so idle voices cost nothing.
+ * Writes to these columns are always sent, even if the value
+ * looks unchanged to the SQL thread.
+ *    The block renderer keeps the fields it uses every block in
+ * a structure of arrays, the hot state, rather than in rvoices[].
+ * Changes to those fields are applied to the hot state and the
+ * status is read from it.  SQL still sees the same voices table.
+ **************************************************************/
+
+#define _GNU_SOURCE             /* for pthread_setaffinity_np */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include "sqlizer.h"
+
+
+/***************************************************************************
+ *  - Limits and defines
+ ***************************************************************************/
+#define  MN_CHANGEQ  (1 << 16)    // fewest entries in change ring.  Power of 2
+#define  NVWORDS     (sizeof(struct VOICE) / sizeof(uint32_t))
+#define  NFORCEW     ((NVWORDS + 31) / 32) // words in force bitmap
+#define  QWAITNS     100000       // wait for ring space in nanoseconds
+#define  TIMEDVOICE  0xFFFF       // voice of the entry that starts a timed batch
+#define  TIMEDEND    0xFFFE       // voice of the entry that ends a timed batch
+#define  TIMEDSKIP   0xFFFD       // voice of a timed change replaced by a later one
+
+
+/***************************************************************************
+ *  - Function prototypes and external references
+ ***************************************************************************/
+void   init_render(int cpu, int prio, int nworkers);
+void   mark_voice(int v);
+void   force_field(int v, int offset);
+void   mark_written(int v, int offset);
+void   mark_patch(int v, int p);
+void   mark_derived(int v, unsigned fields);
+void   commit_voices();
+void   commit_voices_at(llong time);
+void   commit_settings();
+void   sync_voices();
+int    apply_changes(llong now, int nsamp);
+void   mark_status(int v);
+void   publish_status();
+static void *render_main(void *arg);
+static void set_period(int tfd, int nsamp);
+static void queue_voices();
+static void queue_change(int v, int offset, uint32_t value);
+static void wait_room(uint32_t n);
+static void apply_change(int v, int offset, uint32_t value);
+static void drop_pending(int v, int offset);
+static void stat_voice(int v);
+static void set_rsetting(int *prset, int value, int lo, int hi);
+extern void do_synth();
+extern void init_workers(int nworkers);
+extern void *voice_worker(void *arg);
+extern void flush_denormals();
+extern int  osc_supported(int kernel);
+extern void out_flush();
+extern int  out_pending();
+extern void voice_newstate(struct VOICE *pvoc, int oldstate);
+extern void hot_load(int v);
+extern void hot_save(int v);
+extern uint32_t *hot_word(int v, int offset);
+extern void update_active(int v);
+extern int  filt_retarget(int v, int offset, uint32_t value);
+extern void derive_voice(int v, struct VOICE *pvoc, unsigned fields);
+extern void apply_patch(int v, int p, uint32_t *written);
+extern struct VOICE *voices;
+extern struct VOICE *rvoices;
+extern struct SYNTH synth;
+extern struct RSET rset;
+
+
+/***************************************************************************
+ *  - Variable allocation for this file
+ ***************************************************************************/
+// One change to a voice.  The value is copied as raw bits so it can
+// be an int or a float.
+struct VCHANGE
+{
+    uint16_t voice;            // index of the voice to change
+    uint16_t offset;           // byte offset of the word in struct VOICE
+    uint32_t value;            // new value of the word
+};
+static struct VCHANGE *changeq; // SQL to render ring
+static uint32_t nchangeq;      // entries in changeq[], a power of 2
+static uint32_t qhead;         // entries published by the SQL thread
+static uint32_t qtail;         // entries applied by the render thread
+static uint32_t qwr;           // entries written, not yet published
+
+// Timed batches taken from the ring that are not yet due, render
+// thread only.  It is the same size as the ring so a batch always fits.
+static struct VCHANGE *pendq;  // timed batches in the order sent
+static uint32_t pendhead;      // entries added to pendq[]
+static uint32_t pendtail;      // entries applied or dropped from pendq[]
+static int     *npend;         // changes to each voice in pendq[]
+
+// SQL thread's record of what the render thread has
+static struct VOICE *shadow;        // voices as last sent or synced
+static int     *dirty;               // list of voices changed by a command
+static int      ndirty;              // number of voices in dirty[]
+static char    *isdirty;             // set if voice is in dirty[]
+static uint32_t (*force)[NFORCEW];   // words to send even if same
+static uint32_t (*written)[NFORCEW]; // words the command wrote
+static int     *patchreq;            // patch the command set, or -1
+static unsigned *derive;             // DRV_ fields to work out before sending
+
+// Fields the render thread changes as a voice plays
+static const int dynfields[] = {
+    offsetof(struct VOICE, vstate),
+    offsetof(struct VOICE, ontime),
+    offsetof(struct VOICE, adsridx),
+    offsetof(struct VOICE, o1phasestep),
+    offsetof(struct VOICE, o1phase),
+    offsetof(struct VOICE, o2phase),
+    offsetof(struct VOICE, vibphase),
+    offsetof(struct VOICE, tremphase),
+    offsetof(struct VOICE, glidems),
+    offsetof(struct VOICE, glidecount),
+    offsetof(struct VOICE, voiceout),
+    offsetof(struct VOICE, envgain),
+};
+#define NDYNFIELDS   (int)(sizeof(dynfields) / sizeof(dynfields[0]))
+
+// Render to SQL status, protected by a sequence lock
+static uint32_t statseq;       // odd while the render thread writes
+static uint32_t statqtail;     // qtail when the status was written
+static uint32_t statack;       // statseq of the last status SQL took
+static uint32_t (*status)[NDYNFIELDS]; // dynamic fields
+static int     *statlist;      // voices published since SQL last took them
+static int      nstat;         // number of voices in statlist[]
+static char    *isstat;        // set if voice is in statlist[]
+static uint32_t (*snap)[NDYNFIELDS];   // SQL thread's copy of status
+static int     *snaplist;      // voices in snap[], in the same order
+
+// Voices to publish after this block, render thread only
+static int     *publist;       // voices that played or were changed
+static int      npub;          // number of voices in publist[]
+static char    *ispub;         // set if voice is in publist[]
+
+
+/***************************************************************
+ * init_render(): - Give the render thread its copy of the voices
+ * and start it and its workers.  If a CPU is given the render
+ * thread is pinned to it.  If a priority is given the render
+ * thread and the workers run SCHED_FIFO at that priority and
+ * memory is locked so page faults can not stall them.  Failure
+ * to get either is reported but is not fatal.
+ *
+ * Input:        CPU to pin to or -1, SCHED_FIFO priority or 0,
+ *               number of worker threads
+ * Output:
+ * Effects:      starts the render thread and workers
+ ***************************************************************/
+void init_render(
+    int cpu,           // CPU for the render thread, -1 for any
+    int prio,          // SCHED_FIFO priority, 0 for normal scheduling
+    int nworkers)      // number of render worker threads
+{
+    pthread_t  tid;            // render thread ID
+    cpu_set_t  cpus;           // CPU to run on
+    struct sched_param sp;     // real-time priority
+    int        ret;
+    int        v;
+    int        i;
+
+    // Room for a change to every word of every voice in a timed batch
+    nchangeq = MN_CHANGEQ;
+    while (nchangeq < (synth.nvoices * NVWORDS) + 2)
+        nchangeq <<= 1;
+    changeq = calloc(nchangeq, sizeof(struct VCHANGE));
+    pendq = calloc(nchangeq, sizeof(struct VCHANGE));
+    npend = calloc(synth.nvoices, sizeof(int));
+    shadow = calloc(synth.nvoices, sizeof(struct VOICE));
+    dirty = calloc(synth.nvoices, sizeof(int));
+    isdirty = calloc(synth.nvoices, sizeof(char));
+    force = calloc(synth.nvoices, sizeof(force[0]));
+    written = calloc(synth.nvoices, sizeof(written[0]));
+    patchreq = malloc(synth.nvoices * sizeof(int));
+    derive = calloc(synth.nvoices, sizeof(unsigned));
+    status = calloc(synth.nvoices, sizeof(status[0]));
+    statlist = calloc(synth.nvoices, sizeof(int));
+    isstat = calloc(synth.nvoices, sizeof(char));
+    snap = calloc(synth.nvoices, sizeof(snap[0]));
+    snaplist = calloc(synth.nvoices, sizeof(int));
+    publist = calloc(synth.nvoices, sizeof(int));
+    ispub = calloc(synth.nvoices, sizeof(char));
+    if (!changeq || !pendq || !npend || !shadow || !dirty || !isdirty || !force || !derive ||
+        !written || !patchreq || !status || !statlist || !isstat || !snap ||
+        !snaplist || !publist || !ispub) {
+        fprintf(stderr, "Unable to allocate render queues\n");
+        exit(1);
+    }
+
+    memcpy(rvoices, voices, synth.nvoices * sizeof(struct VOICE));
+    for (v = 0; v < synth.nvoices; v++) {
+        hot_load(v);
+        update_active(v);
+    }
+    memcpy(shadow, voices, synth.nvoices * sizeof(struct VOICE));
+    ndirty = 0;
+    for (v = 0; v < synth.nvoices; v++)
+        patchreq[v] = -1;
+
+    // SQL already has what it sent.  The status starts the same.
+    for (v = 0; v < synth.nvoices; v++)
+        stat_voice(v);
+    npub = 0;
+    memset(ispub, 0, synth.nvoices);
+
+    // The render thread starts with the settings made at startup
+    commit_settings();
+
+    if (prio > 0) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+            fprintf(stderr, "Unable to lock memory for render thread\n");
+    }
+
+    // The workers wait for the render thread to give them a block
+    init_workers(nworkers);
+    for (i = 0; i < nworkers; i++) {
+        ret = pthread_create(&tid, (pthread_attr_t *) NULL, voice_worker, NULL);
+        if (ret != 0) {
+            fprintf(stderr, "Unable to start render worker\n");
+            exit(1);
+        }
+        if (prio > 0) {
+            sp.sched_priority = prio;
+            if (pthread_setschedparam(tid, SCHED_FIFO, &sp) != 0)
+                fprintf(stderr, "Unable to set SCHED_FIFO priority %d\n", prio);
+        }
+    }
+
+    ret = pthread_create(&tid, (pthread_attr_t *) NULL, render_main, NULL);
+    if (ret != 0) {
+        fprintf(stderr, "Unable to start render thread\n");
+        exit(1);
+    }
+
+    if (cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if (pthread_setaffinity_np(tid, sizeof(cpus), &cpus) != 0)
+            fprintf(stderr, "Unable to pin render thread to CPU %d\n", cpu);
+    }
+    if (prio > 0) {
+        sp.sched_priority = prio;
+        if (pthread_setschedparam(tid, SCHED_FIFO, &sp) != 0)
+            fprintf(stderr, "Unable to set SCHED_FIFO priority %d\n", prio);
+    }
+}
+
+
+/***************************************************************
+ * render_main(): - The body of the render thread.  A timerfd
+ * wakes us once per block period.  Render the samples that are
+ * due, send what we can of the output, and wait for the next
+ * tick.  The timer is reset if the block size changes.
+ *
+ * Input:        unused
+ * Output:       never returns
+ * Effects:      all synth work
+ ***************************************************************/
+static void *render_main(
+    void *arg)         // unused
+{
+    int      tfd;              // timer FD, one tick per block
+    int      period;           // block size the timer is set for
+    int      blocksize;        // block size in rset
+    uint64_t ticks;            // number of expirations since last read
+
+    tfd = timerfd_create(CLOCK_MONOTONIC, 0);
+    if (tfd < 0) {
+        fprintf(stderr, "Unable to create render timer\n");
+        exit(1);
+    }
+    period = __atomic_load_n(&rset.blocksize, __ATOMIC_RELAXED);
+    set_period(tfd, period);
+    flush_denormals();
+
+    while (1) {
+        // Sleep until the next block is due.  A late wakeup just means
+        // more samples are due, which do_synth() takes care of.
+        if (read(tfd, &ticks, sizeof(ticks)) < 0)
+            continue;
+
+        do_synth();
+
+        // Retry a flush that found the output full
+        if (out_pending() >= __atomic_load_n(&rset.flushsize, __ATOMIC_RELAXED))
+            out_flush();
+
+        blocksize = __atomic_load_n(&rset.blocksize, __ATOMIC_RELAXED);
+        if (blocksize != period) {
+            period = blocksize;
+            set_period(tfd, period);
+        }
+    }
+    return NULL;
+}
+
+
+/***************************************************************
+ * set_period(): - Set the render timer to tick once every
+ * nsamp sample periods.
+ *
+ * Input:        timer FD, number of samples per tick
+ * Output:
+ * Effects:      render timer
+ ***************************************************************/
+static void set_period(
+    int tfd,           // timer FD
+    int nsamp)         // samples per tick
+{
+    struct itimerspec its;     // timer period
+    int64_t  ns;               // period in nanoseconds
+
+    // A zero period would stop the timer for good
+    if (nsamp < 1)
+        nsamp = 1;
+    else if (nsamp > MX_BLOCK)
+        nsamp = MX_BLOCK;
+    ns = (int64_t) ((double) nsamp * 1000000000.0 / SRATE);
+    its.it_interval.tv_sec = ns / 1000000000;
+    its.it_interval.tv_nsec = ns % 1000000000;
+    its.it_value = its.it_interval;
+    if (timerfd_settime(tfd, 0, &its, (struct itimerspec *) NULL) < 0)
+        fprintf(stderr, "Unable to set render timer\n");
+}
+
+
+/***************************************************************
+ * mark_voice(): - Note that an SQL command wrote to a voice.
+ * The changes are sent to the render thread by commit_voices().
+ * This is called from the voice write callbacks.
+ *
+ * Input:        index of the voice
+ * Output:
+ * Effects:      list of changed voices
+ ***************************************************************/
+void mark_voice(
+    int v)             // index of changed voice
+{
+    if ((v < 0) || (v >= synth.nvoices) || isdirty[v])
+        return;
+    isdirty[v] = 1;
+    dirty[ndirty++] = v;
+}
+
+
+/***************************************************************
+ * force_field(): - Send a field to the render thread even if
+ * its value looks unchanged.  This is needed for fields that
+ * the render thread also changes since the SQL thread's copy
+ * may be out of date.
+ *
+ * Input:        index of the voice, offset of field in struct VOICE
+ * Output:
+ * Effects:      force bitmap for the voice
+ ***************************************************************/
+void force_field(
+    int v,             // index of changed voice
+    int offset)        // byte offset of field to send
+{
+    int      word;             // word index of field
+
+    if ((v < 0) || (v >= synth.nvoices))
+        return;
+    word = offset / sizeof(uint32_t);
+    force[v][word / 32] |= (1u << (word % 32));
+    mark_voice(v);
+}
+
+
+/***************************************************************
+ * mark_written(): - Note that a command wrote a field of a voice.
+ * A patch set by the same command leaves the field alone, even
+ * if the value written is the one the voice already had.  This
+ * is called from the voice write callbacks.
+ *
+ * Input:        index of the voice, offset of field in struct VOICE
+ * Output:
+ * Effects:      written bitmap for the voice
+ ***************************************************************/
+void mark_written(
+    int v,             // index of changed voice
+    int offset)        // byte offset of field written
+{
+    int      word;             // word index of field
+
+    if ((v < 0) || (v >= synth.nvoices))
+        return;
+    word = offset / sizeof(uint32_t);
+    written[v][word / 32] |= (1u << (word % 32));
+    mark_voice(v);
+}
+
+
+/***************************************************************
+ * mark_patch(): - Note that a command set the patch of a voice.
+ * The patch is copied in when the command is sent, once every
+ * column the command wrote is known, so the order of the columns
+ * in an UPDATE does not matter.
+ *
+ * Input:        index of the voice, index of the patch
+ * Output:
+ * Effects:      patch to apply and list of changed voices
+ ***************************************************************/
+void mark_patch(
+    int v,             // index of changed voice
+    int p)             // index of the patch
+{
+    if ((v < 0) || (v >= synth.nvoices))
+        return;
+    patchreq[v] = p;
+    mark_voice(v);
+}
+
+
+/***************************************************************
+ * mark_derived(): - Note that fields worked out from a column,
+ * such as a phase step or the filter coefficients, need to be
+ * worked out again.  The work is done once per voice when the
+ * command is sent, so an UPDATE of several columns that feed the
+ * same field only pays for it once.
+ *
+ * Input:        index of the voice, DRV_ fields to work out
+ * Output:
+ * Effects:      derived fields mask and list of changed voices
+ ***************************************************************/
+void mark_derived(
+    int v,             // index of changed voice
+    unsigned fields)   // DRV_ fields to work out
+{
+    if ((v < 0) || (v >= synth.nvoices))
+        return;
+    derive[v] |= fields;
+    mark_voice(v);
+}
+
+
+/***************************************************************
+ * commit_voices(): - Send every word that changed in the marked
+ * voices to the render thread, then publish the new ring head.
+ * The render thread sees all of the changes from one command
+ * at once, even an UPDATE of every voice.  Derived fields are
+ * worked out first.  This is called by the SQL thread after each
+ * command.
+ *
+ * Input:
+ * Output:
+ * Effects:      change ring, shadow copy of voices
+ ***************************************************************/
+void commit_voices()
+{
+    // A voice sends at most all of its words
+    wait_room(ndirty * NVWORDS);
+    queue_voices();
+    __atomic_store_n(&qhead, qwr, __ATOMIC_RELEASE);
+}
+
+
+/***************************************************************
+ * commit_voices_at(): - Send the changes in the marked voices
+ * as a batch that takes effect at the given sample.  The batch
+ * starts with an entry holding the low 32 bits of the time and
+ * ends with an end entry.  This is how the scheduled events are
+ * sent.
+ *
+ * Input:        sample at which the changes take effect
+ * Output:
+ * Effects:      change ring, shadow copy of voices
+ ***************************************************************/
+void commit_voices_at(
+    llong time)        // sample the batch is due at
+{
+    if (ndirty == 0)
+        return;
+    wait_room((ndirty * NVWORDS) + 2);
+    queue_change(TIMEDVOICE, 0, (uint32_t) time);
+    queue_voices();
+    queue_change(TIMEDEND, 0, 0);
+    __atomic_store_n(&qhead, qwr, __ATOMIC_RELEASE);
+}
+
+
+/***************************************************************
+ * commit_settings(): - Copy the synth settings the render thread
+ * uses into rset.  librta writes a new value into the synth row
+ * before the write callback sees it, so a bad value is in the
+ * row until the callback limits it or librta puts the old one
+ * back.  This runs once the command is done.  A value that is
+ * still out of range leaves the render thread's copy as it was.
+ *
+ * Input:
+ * Output:
+ * Effects:      rset
+ ***************************************************************/
+void commit_settings()
+{
+    set_rsetting(&rset.blocksize, synth.blocksize, 1, MX_BLOCK);
+    set_rsetting(&rset.rendermode, synth.rendermode, RENDER_BLOCK, RENDER_REF);
+    set_rsetting(&rset.flushsize, synth.flushsize, 1, MX_FLUSH);
+    set_rsetting(&rset.maxcatchup, synth.maxcatchup, 1,
+        MX_CATCHUPMS * synth.srate / 1000);
+    if (osc_supported(synth.osckernel))
+        __atomic_store_n(&rset.osckernel, synth.osckernel, __ATOMIC_RELAXED);
+    set_rsetting(&rset.sinemode, synth.sinemode, SINE_QUARTER, SINE_POLY);
+    set_rsetting(&rset.wtinterp, synth.wtinterp, WTINTERP_NONE, WTINTERP_CUBIC);
+    set_rsetting(&rset.fltsmooth, synth.fltsmooth, 0, MX_FLTSMOOTH);
+}
+
+
+/***************************************************************
+ * set_rsetting(): - Store one setting in rset if it is in range.
+ *
+ * Input:        setting in rset, new value, lowest and highest
+ *               value allowed
+ * Output:
+ * Effects:      rset
+ ***************************************************************/
+static void set_rsetting(
+    int *prset,        // the setting in rset
+    int  value,        // value from synth
+    int  lo,           // lowest value allowed
+    int  hi)           // highest value allowed
+{
+    if ((value >= lo) && (value <= hi))
+        __atomic_store_n(prset, value, __ATOMIC_RELAXED);
+}
+
+
+/***************************************************************
+ * queue_voices(): - Put every word that changed in the marked
+ * voices into the ring, copying in a patch the command set and
+ * working out the derived fields first.  Nothing is published.
+ * The caller has made sure there is room.
+ *
+ * Input:
+ * Output:
+ * Effects:      change ring, shadow copy of voices
+ ***************************************************************/
+static void queue_voices()
+{
+    uint32_t *pnew;            // words of the voice in voices[]
+    uint32_t *pold;            // words of the voice in shadow[]
+    int      i, v, w;
+
+    for (i = 0; i < ndirty; i++) {
+        v = dirty[i];
+        // Skip a patch whose command librta undid
+        if ((patchreq[v] >= 0) && (voices[v].patch == patchreq[v]))
+            apply_patch(v, patchreq[v], written[v]);
+        patchreq[v] = -1;
+        memset(written[v], 0, sizeof(written[v]));
+        if (derive[v]) {
+            derive_voice(v, &voices[v], derive[v]);
+            derive[v] = 0;
+        }
+        pnew = (uint32_t *) &voices[v];
+        pold = (uint32_t *) &shadow[v];
+        for (w = 0; w < (int) NVWORDS; w++) {
+            if ((pnew[w] != pold[w]) || (force[v][w / 32] & (1u << (w % 32)))) {
+                queue_change(v, w * sizeof(uint32_t), pnew[w]);
+                pold[w] = pnew[w];
+            }
+        }
+        memset(force[v], 0, sizeof(force[v]));
+        isdirty[v] = 0;
+    }
+    ndirty = 0;
+}
+
+
+/***************************************************************
+ * wait_room(): - Wait until the ring has room for n more
+ * entries.  Nothing is published while we wait so the render
+ * thread can not start on part of a command.  The ring holds a
+ * change to every word of every voice, so once the render thread
+ * has drained it there is always room.  Only the SQL thread ever
+ * waits.
+ *
+ * Input:        number of entries needed
+ * Output:
+ * Effects:
+ ***************************************************************/
+static void wait_room(
+    uint32_t n)        // entries to make room for
+{
+    struct timespec wait;      // time to wait for space in ring
+
+    while ((nchangeq - (qwr - __atomic_load_n(&qtail, __ATOMIC_ACQUIRE))) < n) {
+        wait.tv_sec = 0;
+        wait.tv_nsec = QWAITNS;
+        (void) nanosleep(&wait, (struct timespec *) NULL);
+    }
+}
+
+
+/***************************************************************
+ * queue_change(): - Add one change to the ring.  The caller has
+ * made sure there is room for it with wait_room().
+ *
+ * Input:        voice index, offset of word, new value of word
+ * Output:
+ * Effects:      change ring
+ ***************************************************************/
+static void queue_change(
+    int      v,        // index of changed voice
+    int      offset,   // byte offset of changed word
+    uint32_t value)    // new value of the word
+{
+    struct VCHANGE *pchg;      // ring entry to fill in
+
+    pchg = &changeq[qwr & (nchangeq - 1)];
+    pchg->voice = v;
+    pchg->offset = offset;
+    pchg->value = value;
+    qwr++;
+}
+
+
+/***************************************************************
+ * apply_changes(): - Apply all published changes to the render
+ * thread's copy of the voices.  A timed batch that is not yet
+ * due is moved to the pending queue and the changes after it are
+ * applied.  A timed batch that is due is applied, and counted as
+ * late if its sample has passed.  The samples up to the next
+ * pending batch are all that may be rendered before we are called
+ * again.  This is called by the render thread before each block
+ * and at each timed batch within a block.
+ *
+ * Input:        sample about to be rendered, samples wanted
+ * Output:       samples to render before calling again
+ * Effects:      render copy of the voices, pending queue
+ ***************************************************************/
+int apply_changes(
+    llong now,         // next sample to render
+    int   nsamp)       // samples left in the block
+{
+    uint32_t head;             // published end of the ring
+    uint32_t tail;             // next entry to apply
+    uint32_t end;              // end entry of a timed batch
+    uint32_t mask;             // ring index mask
+    struct VCHANGE *pchg;      // ring entry to apply
+    int32_t  wait;             // samples until a timed batch is due
+
+    mask = nchangeq - 1;
+    head = __atomic_load_n(&qhead, __ATOMIC_ACQUIRE);
+    tail = qtail;
+    while (tail != head) {
+        pchg = &changeq[tail & mask];
+        if (pchg->voice != TIMEDVOICE) {
+            drop_pending(pchg->voice, pchg->offset);
+            apply_change(pchg->voice, pchg->offset, pchg->value);
+            tail++;
+            continue;
+        }
+
+        // A batch is published whole so its end entry is in the ring
+        for (end = tail + 1; changeq[end & mask].voice != TIMEDEND; end++)
+            ;
+        wait = (int32_t) (pchg->value - (uint32_t) now);
+        if ((wait <= 0) && (pendhead == pendtail)) {
+            if (wait < 0)
+                synth.evlate++;
+            for (tail++; tail != end; tail++) {
+                pchg = &changeq[tail & mask];
+                apply_change(pchg->voice, pchg->offset, pchg->value);
+            }
+            tail++;
+            continue;
+        }
+
+        // Hold it in the pending queue.  If that is full of batches
+        // sent before this one, leave it here until they are done.
+        if ((nchangeq - (pendhead - pendtail)) < (end + 1 - tail))
+            break;
+        for ( ; tail != end + 1; tail++) {
+            pendq[pendhead & mask] = changeq[tail & mask];
+            if (changeq[tail & mask].voice < synth.nvoices)
+                npend[changeq[tail & mask].voice]++;
+            pendhead++;
+        }
+    }
+    __atomic_store_n(&qtail, tail, __ATOMIC_RELEASE);
+
+    // Apply the pending batches that are due, in the order sent
+    while (pendtail != pendhead) {
+        pchg = &pendq[pendtail & mask];
+        wait = (int32_t) (pchg->value - (uint32_t) now);
+        if (wait > 0) {
+            if (wait < nsamp)
+                nsamp = wait;
+            break;
+        }
+        if (wait < 0)
+            synth.evlate++;
+        for (pendtail++; pendq[pendtail & mask].voice != TIMEDEND; pendtail++) {
+            pchg = &pendq[pendtail & mask];
+            if (pchg->voice == TIMEDSKIP)
+                continue;
+            npend[pchg->voice]--;
+            apply_change(pchg->voice, pchg->offset, pchg->value);
+        }
+        pendtail++;
+    }
+    return (nsamp);
+}
+
+
+/***************************************************************
+ * apply_change(): - Apply one change to the render thread's
+ * copy of a voice.  A change to vstate also does what that state
+ * change implies, such as resetting the ADSR.  A change to a
+ * filter parameter starts a ramp to it, and a change to the ADSR
+ * steps has the step worked out again.  Fields with a copy in the
+ * hot state are written there.
+ *
+ * Input:        voice index, offset of word, new value of word
+ * Output:
+ * Effects:      render copy of the voice
+ ***************************************************************/
+static void apply_change(
+    int      v,        // index of the voice to change
+    int      offset,   // byte offset of the word
+    uint32_t value)    // new value of the word
+{
+    struct VOICE *pvoc;        // voice to change
+    int      oldstate;         // vstate before the change
+
+    pvoc = &rvoices[v];
+    mark_status(v);
+    if (offset == offsetof(struct VOICE, vstate)) {
+        // State changes are rare.  Do them on struct VOICE.
+        hot_save(v);
+        oldstate = pvoc->vstate;
+        pvoc->vstate = (int) value;
+        voice_newstate(pvoc, oldstate);
+        hot_load(v);
+        update_active(v);
+    } else if (!filt_retarget(v, offset, value)) {
+        // Filter parameters ramp in.  Anything else is just written.
+        *hot_word(v, offset) = value;
+        // A change to the envelope works out the ADSR step again
+        if ((offset == offsetof(struct VOICE, ontime)) ||
+            (offset == offsetof(struct VOICE, adsridx)) ||
+            ((offset >= offsetof(struct VOICE, step0time)) &&
+             (offset <= offsetof(struct VOICE, envcurve))))
+            *hot_word(v, offsetof(struct VOICE, envleft)) = (uint32_t) ENV_ENTER;
+    }
+}
+
+
+/***************************************************************
+ * drop_pending(): - Drop the changes to a word that wait in the
+ * pending queue.  A change sent after them is newer so their
+ * values must never be applied.
+ *
+ * Input:        voice index, offset of the word
+ * Output:
+ * Effects:      pending queue
+ ***************************************************************/
+static void drop_pending(
+    int v,             // index of the changed voice
+    int offset)        // byte offset of the changed word
+{
+    struct VCHANGE *pchg;      // pending entry
+    uint32_t i;
+
+    if (npend[v] == 0)
+        return;
+    for (i = pendtail; i != pendhead; i++) {
+        pchg = &pendq[i & (nchangeq - 1)];
+        if ((pchg->voice == v) && (pchg->offset == offset)) {
+            pchg->voice = TIMEDSKIP;
+            npend[v]--;
+        }
+    }
+}
+
+
+/***************************************************************
+ * mark_status(): - Note that a voice must be published after
+ * this block.  This is called by the render thread for each
+ * voice that plays, that is changed from SQL, or that stops.
+ *
+ * Input:        index of the voice
+ * Output:
+ * Effects:      list of voices to publish
+ ***************************************************************/
+void mark_status(
+    int v)             // index of voice to publish
+{
+    if (ispub[v])
+        return;
+    ispub[v] = 1;
+    publist[npub++] = v;
+}
+
+
+/***************************************************************
+ * publish_status(): - Make the fields that change as a voice
+ * plays visible to the SQL thread.  Only the voices marked by
+ * mark_status() are published.  They are added to the list the
+ * SQL thread copies from, which is started over once the SQL
+ * thread has taken the last status we wrote.  This is called by
+ * the render thread after each block.
+ *
+ * Input:
+ * Output:
+ * Effects:      render status
+ ***************************************************************/
+void publish_status()
+{
+    uint32_t seq;              // sequence number at start
+    int      i;
+
+    seq = statseq;
+    __atomic_store_n(&statseq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (__atomic_load_n(&statack, __ATOMIC_ACQUIRE) == seq) {
+        for (i = 0; i < nstat; i++)
+            isstat[statlist[i]] = 0;
+        nstat = 0;
+    }
+    for (i = 0; i < npub; i++) {
+        stat_voice(publist[i]);
+        ispub[publist[i]] = 0;
+    }
+    npub = 0;
+    statqtail = qtail;
+    __atomic_store_n(&statseq, seq + 2, __ATOMIC_RELEASE);
+}
+
+
+/***************************************************************
+ * stat_voice(): - Copy the dynamic fields of one voice into the
+ * status and add it to the list the SQL thread copies from.
+ *
+ * Input:        index of the voice
+ * Output:
+ * Effects:      render status
+ ***************************************************************/
+static void stat_voice(
+    int v)             // index of voice to publish
+{
+    int      f;
+
+    for (f = 0; f < NDYNFIELDS; f++)
+        status[v][f] = *hot_word(v, dynfields[f]);
+    if (isstat[v])
+        return;
+    isstat[v] = 1;
+    statlist[nstat++] = v;
+}
+
+
+/***************************************************************
+ * sync_voices(): - Copy the latest render status into voices[]
+ * so SQL reads see the voices as they play.  Only the voices
+ * published since we last took the status are copied.  If the
+ * render thread has not yet taken everything we sent from the
+ * ring, the status is older than voices[] and we leave voices[]
+ * alone.  A timed batch waiting to be due does not hold this up.
+ * This is called by the SQL thread before each command.
+ *
+ * Input:
+ * Output:
+ * Effects:      dynamic fields of voices[] and shadow[]
+ ***************************************************************/
+void sync_voices()
+{
+    uint32_t snapqtail;        // qtail when status was written
+    uint32_t seq1, seq2;       // sequence numbers before and after copy
+    int      nsnap;            // number of voices in snap[]
+    int      i, v, f;
+
+    do {
+        seq1 = __atomic_load_n(&statseq, __ATOMIC_ACQUIRE);
+        // The list may be changing under us.  Keep to the table.
+        nsnap = nstat;
+        if ((nsnap < 0) || (nsnap > synth.nvoices))
+            nsnap = 0;
+        for (i = 0; i < nsnap; i++) {
+            v = statlist[i];
+            if ((v < 0) || (v >= synth.nvoices))
+                v = 0;
+            snaplist[i] = v;
+            memcpy(snap[i], status[v], sizeof(status[0]));
+        }
+        snapqtail = statqtail;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq2 = __atomic_load_n(&statseq, __ATOMIC_RELAXED);
+    } while ((seq1 & 1) || (seq1 != seq2));
+
+    if (snapqtail != qwr)
+        return;
+
+    for (i = 0; i < nsnap; i++) {
+        v = snaplist[i];
+        for (f = 0; f < NDYNFIELDS; f++) {
+            memcpy((char *) &voices[v] + dynfields[f], &snap[i][f], sizeof(uint32_t));
+            memcpy((char *) &shadow[v] + dynfields[f], &snap[i][f], sizeof(uint32_t));
+        }
+    }
+
+    // The render thread may start the list over
+    __atomic_store_n(&statack, seq1, __ATOMIC_RELEASE);
+}
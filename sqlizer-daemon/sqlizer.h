@@ -16,10 +16,15 @@
 #include "librta.h"
 
 
-// Sample rate.
-#define SRATE 44100.0
+// Sample rate.  This is set at startup and kept in the synth table.
+#define DEF_SRATE 44100
+#define MN_SRATE  8000
+#define MX_SRATE  192000
+#define SRATE     ((double) synth.srate)
+// Highest frequency allowed at this rate, just below srate / 2
+#define NYQFREQ   (0.49 * SRATE)
 // Max audio frequency
-#define MX_FREQ 9000.0
+#define MX_FREQ   ((NYQFREQ < 9000.0) ? NYQFREQ : 9000.0)
 
 
 
@@ -38,7 +43,9 @@
 #define OTYPE_SQUARE       2
 #define OTYPE_TRIANGLE     3
 #define OTYPE_NOISE        4
-#define OTYPE_WAVETBL      5       // not yet implemented
+#define OTYPE_WAVETBL      5       // wavetable from the bank, o1 and o2 only
+#define OTYPE_BLSQUARE     6       // band-limited square
+#define OTYPE_BLTRIANGLE   7       // band-limited triangle
 #define MIXMODE_NONE       0       // no mixing
 #define MIXMODE_SUM        1       // sum osc1 and osc2
 #define MIXMODE_AM         2       // amplitude modulate osc1 by osc2
@@ -50,33 +57,56 @@
 #define FILT_HIGH          2       // voice filter is high pass
 #define FILT_BAND          3       // voice filter is band pass
 #define FILT_STOP          4       // voice filter is notch
+#define NFLTPARAM          10      // parameters of the two filters, b0 b1 b2 a1 a2 of each
+#define MX_FLTFREQ         20000   // highest filter cutoff in Hz
+#define MX_CUTOFF          ((NYQFREQ < MX_FLTFREQ) ? (int) NYQFREQ : MX_FLTFREQ) // at this rate
 #define MXADSRSTEP         7       // 8 ADSR steps in range of 0 to 7
+#define ENV_LINEAR         0       // ADSR step is a straight line
+#define ENV_EXP            1       // ADSR step is an exponential curve
+#define ENV_ENTER          (-1)    // envleft when the ADSR step must be worked out
 #define OUTLEFT            1       // output to left channel (monophonic)
 #define OUTRIGHT           2       // output to right channel
 #define OUTBOTH            3       // send voice output to both channels
-#define VOICE_COUNT        20
+#define MX_BUSES           8       // Output buses a voice can be sent to
+#define DEF_VOICES         20      // Default number of voices
+#define MX_VOICES          4096    // Most voices that can be set at startup
 #define SUSTAINVALUE       60000   // sustain if step time is one minute
+// Fields worked out from the columns of a voice.  The write callbacks
+// set these and the work is done once when the command is sent.
+#define DRV_O1STEP         0x01    // o1phasestep from o1freq
+#define DRV_O2STEP         0x02    // o2phasestep from o2freq
+#define DRV_VIBSTEP        0x04    // vibphasestep from vibfreq
+#define DRV_TREMSTEP       0x08    // tremphasestep from tremfreq
+#define DRV_VIBDEPTH       0x10    // vibo1phase from vibdepth
+#define DRV_GLIDE          0x20    // glidecount and glidestep from glidems
+#define DRV_FLT1           0x40    // coefficients of filter #1
+#define DRV_FLT2           0x80    // coefficients of filter #2
 
 struct VOICE
 {
-    int      idx;              // Index of this voice.  0 to VOICE_COUNT-1
+    int      idx;              // Index of this voice.  0 to nvoices-1
     char     noteid[NOTEID_LEN]; // Unique ID assigned by the UI program
     char     chordid[CHORDID_LEN]; // Unique ID assigned by the UI program
     int      vstate;           // free, inuse, on, sustain, forced release
     int      ontime;           // number of sample ticks the note has played (not milliseconds)
+    int      phasereset;       // ==1 to start the oscillator phases at zero on each new note
+    int      patch;            // Patch last copied into the voice, or -1
     int      o1type;           // Sine, square, triangle, noise, wave table
     float    o1freq;           // Oscillator #1 frequency in range of 0.001 to 20000
     float    o1phasestep;      // Oscillator #1 phase step each sample
-    float    o1phaseacc;       // Phase of output in range 0 to 1
+    float    o1phaseacc;       // Phase of output in range 0 to 1, from o1phase when read
+    unsigned o1phase;          // Phase of output in fixed point, 2^32 is one cycle
     float    o1symmetry;       // Symmetry (0 to 1) for sine, square, triangle
     float    o1phaseoffset;    // Added to accumulator before computing waveform value
     float    o1gain;           // Output gain of oscillator #1
     float    o1out;            // Output value of oscillator #1
+    int      o1wtable;         // Wavetable index if o1type is wavetable
     // Vibrato and glide only affect oscillator #1
     int      vibtype;          // Vibrato waveform type (sine, square, ....)
     float    vibfreq;          // Vibrato frequency in range of 0.001 to 20000 Hz
     float    vibphasestep;     // Vibrato phase step each sample
     float    vibphaseacc;      // Vibrato phase in cycle as number in range 0 to 1
+    unsigned vibphase;         // Vibrato phase in fixed point, 2^32 is one cycle
     float    vibsymmetry;      // Symmetry (0 to 1) for sine, square, triangle
     float    vibphaseoffset;   // Added to vib phase accumulator before computing waveform value
     float    vibdepth;         // A frequency to be added, at maximum, to o1 freq
@@ -89,17 +119,20 @@ struct VOICE
     int      o2type;           // Sine, square, triangle, noise, wave table
     float    o2freq;           // Oscillator #2 frequency in range of 0.001 to 20000
     float    o2phasestep;      // Oscillator #2 phase step each sample
-    float    o2phaseacc;       // Phase of output in range 0 to 1
+    float    o2phaseacc;       // Phase of output in range 0 to 1, from o2phase when read
+    unsigned o2phase;          // Phase of output in fixed point, 2^32 is one cycle
     float    o2symmetry;       // Symmetry (0 to 1) for sine, square, triangle
     float    o2phaseoffset;    // Added to accumulator before computing waveform value
     float    o2gain;           // Output gain of oscillator #2
     float    o2out;            // Output of oscillator #2
+    int      o2wtable;         // Wavetable index if o2type is wavetable
     int      mixmode;          // Mix o1 and o2 with sum, AM, FM, ring, hardsync, or none
     // Tremolo, filters, and amplitude ADSR affect the o1/o2 mixed signal
     int      tremtype;         // Tremolo waveform type (sine, square, ....)
     float    tremfreq;         // Tremolo frequency in range of 0.001 to 20000 Hz
     float    tremphasestep;    // Tremolo phase step each sample
     float    tremphaseacc;     // Tremolo phase in cycle as number in range 0 to 1
+    unsigned tremphase;        // Tremolo phase in fixed point, 2^32 is one cycle
     float    tremdepth;        // A gain (0-1) to be applied to o1/o2 mix based on tremolo
     float    tremsymmetry;     // Symmetry (0 to 1) for sine, square, triangle
     float    tremphaseoffset;  // Added to tremolo phase acc before computing waveform value
@@ -136,6 +169,14 @@ struct VOICE
     float    step5gain;        // gain (0 to 1) at end of step. 0 to end
     float    step6gain;        // gain (0 to 1) at end of step. 0 to end
     float    step7gain;        // gain (0 to 1) at end of step. 0 to end
+    int      envcurve;         // ADSR steps are linear(0) or exponential(1)
+    // The render thread works out each ADSR step as it starts.  After
+    // that the gain takes one multiply and add per sample.  Only the
+    // render thread uses these.
+    float    envgain;          // ADSR gain of the next sample
+    float    envmul;           // gain multiplier per sample, 1.0 if linear
+    float    envadd;           // gain added per sample
+    int      envleft;          // samples to the last of the step, or ENV_ENTER
     // The user can specify the type of filter, the rolloff, the Q, and
     // the cutoff frequencies.  Invisible to the user are the parameters
     // for the two second order digital filters.
@@ -148,32 +189,417 @@ struct VOICE
     float    flt1b2;           // filter parameter
     float    flt1a1;           // filter parameter
     float    flt1a2;           // filter parameter
-    float    flt1in1;          // input delayed by one
-    float    flt1in2;          // input delayed by two
-    float    flt1out0;         // filter output with no delay
-    float    flt1out1;         // output delayed by one
-    float    flt1out2;         // output delayed by two
+    float    flt1z1;           // first state of the transposed direct form II
+    float    flt1z2;           // second state of the transposed direct form II
     int      fltf2;            // f2 frequency
     float    flt2b0;           // filter parameter
     float    flt2b1;           // filter parameter
     float    flt2b2;           // filter parameter
     float    flt2a1;           // filter parameter
     float    flt2a2;           // filter parameter
-    float    flt2in1;          // input delayed by one
-    float    flt2in2;          // input delayed by two
-    float    flt2out0;         // filter output with no delay
-    float    flt2out1;         // output delayed by one
-    float    flt2out2;         // output delayed by two
+    float    flt2z1;           // first state of the transposed direct form II
+    float    flt2z2;           // second state of the transposed direct form II
+    // A change to the filter parameters ramps in over synth.fltsmooth
+    // ms so a sweep does not click.  The parameters in use are the ones
+    // above less fltramp times the step.  Only the render thread uses these.
+    float    fltstep[NFLTPARAM]; // step of flt1b0 to flt1a2 then flt2b0 to flt2a2
+    int      fltramp;          // samples left in the ramp, -1 for a new note
 
     // outputs and output control
     int      outputclipping;   // 0 for off, 1 for on
     float    outputgain;       // final gain applied after ADSR and filter
     int      outputchannel;    // 1,2,3 for left, right, or both
+    int      bus;              // Output bus the voice is mixed into, 0 to MX_BUSES-1
     int      sync;             // ==1 for one sample as output crosses zero.
     float    voiceout;         // intermediate value of voice output
 };
 
 
+/***************************************************************
+ * the synth table.  This single row table holds the settings
+ * for the render engine as a whole.
+ **************************************************************/
+#define MX_BLOCK           256     // Maximum samples in one render block
+#define DEF_BLOCK          64      // Default samples in one render block
+#define RENDER_BLOCK       0       // Render each voice one block at a time
+#define RENDER_REF         1       // Reference renderer, one sample at a time
+#define OUT_FD             1       // Audio output goes to standard out
+#define MX_FLUSH           16384   // Maximum samples buffered before a write
+#define DEF_FLUSH          512     // Default samples buffered before a write
+#define MX_CATCHUPMS       1000    // Most ms to render late in one pass
+#define DEF_CATCHUPMS      100     // Default catch-up limit in ms
+#define OUTFMT_S16_BE      0       // signed 16 bit, big endian
+#define OUTFMT_S16_LE      1       // signed 16 bit, little endian
+#define OUTFMT_S24_3LE     2       // signed 24 bit in three bytes, little endian
+#define OUTFMT_S32_LE      3       // signed 32 bit, little endian
+#define OUTFMT_FLOAT_LE    4       // 32 bit float, little endian
+#define OSCK_SCALAR        0       // plain C oscillator kernels
+#define OSCK_SSE2          1       // SSE2, four samples at a time
+#define OSCK_AVX2          2       // AVX2, eight samples at a time
+#define NSINES             1000    // Entries in the quarter-wave sine table
+#define NSINEFULL          4096    // Entries in the full-cycle sine table, a power of two
+#define PHASE_ONE          4294967296.0f // one cycle of a fixed-point phase
+#define PHASE_HALF         0x80000000u   // half a cycle of a fixed-point phase
+// A phase or phase step in cycles to fixed point.  Whole cycles
+// fall off the top so the result is always the fraction.
+#define PHASE_FIX(x)       ((unsigned) (long long) ((x) * PHASE_ONE))
+// A fixed-point phase to a float from 0 up to but not including 1
+#define PHASE_FLOAT(p)     ((float) ((p) >> 8) * (1.0f / 16777216.0f))
+#define SINE_QUARTER       0       // quarter-wave table, no interpolation
+#define SINE_TABLE         1       // full-cycle table, linear interpolation
+#define SINE_POLY          2       // polynomial, no table
+#define MX_WORKERS         64      // Most render worker threads
+#define WTINTERP_NONE      0       // wavetable sample nearest below the phase
+#define WTINTERP_LINEAR    1       // linear between two wavetable samples
+#define WTINTERP_CUBIC     2       // cubic Hermite over four wavetable samples
+#define DEF_FLTSMOOTH      10      // Default filter parameter ramp in ms
+#define MX_FLTSMOOTH       1000    // Longest filter parameter ramp in ms
+#define DEF_EVLEAD         10      // Default ms an event is sent before it is due
+#define MX_EVLEAD          1000    // Most ms an event is sent before it is due
+
+struct SYNTH
+{
+    int      blocksize;        // Number of samples in a render block (1 to MX_BLOCK)
+    int      rendermode;       // block(0) or per-sample reference(1)
+    int      flushsize;        // Number of output samples to buffer before a write
+    int      outdrops;         // Number of samples dropped since output was full
+    int      outformat;        // Output sample format, set at startup
+    int      outchannels;      // Mono(1) or stereo(2), set at startup
+    int      maxcatchup;       // Most late samples to render in one pass
+    llong    samples;          // Samples rendered since startup
+    int      underruns;        // Times the renderer fell more than maxcatchup behind
+    llong    lostsamples;      // Samples skipped by underruns
+    int      overruns;         // Blocks dropped since the output buffer was full
+    int      osckernel;        // Oscillator kernel, scalar(0), SSE2(1), or AVX2(2)
+    int      sinemode;         // Sine from quarter(0) or full(1) table or polynomial(2)
+    int      nvoices;          // Number of voices, set at startup
+    int      srate;            // Sample rate in Hz, set at startup
+    int      nworkers;         // Render worker threads, set at startup
+    int      wtinterp;         // Wavetable interpolation, none(0), linear(1), or cubic(2)
+    int      nwtables;         // Number of wavetables in the bank, set at startup
+    int      fltsmooth;        // Time in ms for new filter parameters to ramp in
+    int      evlead;           // Time in ms an event is sent before it is due
+    int      evlate;           // Number of event batches applied after their sample
+};
+
+// The settings the render thread reads, copied from synth by
+// commit_settings() once a command is done.  librta writes a new
+// value into the synth row before the write callback checks it, so
+// the render thread never reads the row itself.
+struct RSET
+{
+    int      blocksize;        // samples in a render block
+    int      rendermode;       // block(0) or per-sample reference(1)
+    int      flushsize;        // output samples to buffer before a write
+    int      maxcatchup;       // most late samples to render in one pass
+    int      osckernel;        // oscillator and filter kernel
+    int      sinemode;         // how sine is made
+    int      wtinterp;         // wavetable interpolation
+    int      fltsmooth;        // filter parameter ramp in ms
+};
+
+
+/***************************************************************
+ * the patches table.  Each row is a complete voice sound, its
+ * oscillators, ADSR, filter, and output, with the phase steps and
+ * filter coefficients already worked out.  Setting patch in a
+ * voice copies the patch into the voice.
+ **************************************************************/
+#define MX_PATCHES         128     // Rows in the patches table
+#define PATCH_NAME_LEN     20      // UI name for a patch
+
+struct PATCH
+{
+    int      idx;              // Row number, set at startup
+    char     name[PATCH_NAME_LEN]; // Name assigned by the UI program
+    struct VOICE voice;        // The sound.  Only the patch fields are used
+};
+
+
+/***************************************************************
+ * the allocator table.  This single row table hands out voices.
+ * Writing a noteid claims a voice for it, stealing a playing
+ * voice by the policy if none is free.  The UI then addresses the
+ * voice by its noteid, or by the index left in voice.
+ **************************************************************/
+#define STEAL_OLDEST       0       // steal the voice claimed longest ago
+#define STEAL_QUIETEST     1       // steal the voice with the lowest ADSR gain
+#define STEAL_NONE         2       // fail if no voice is free
+
+struct ALLOC
+{
+    char     noteid[NOTEID_LEN]; // Note to claim a voice for
+    char     chordid[CHORDID_LEN]; // Chord the note is part of
+    int      policy;           // Which voice to steal, oldest(0), quietest(1), none(2)
+    int      retrigger;        // ==1 to reuse a playing voice with the same noteid
+    int      voice;            // Voice claimed by the last write, or -1
+    int      steals;           // Number of playing voices stolen
+    int      fails;            // Number of claims that found no voice
+};
+
+
+/***************************************************************
+ * the events table.  Each row is a change to one column of a
+ * voice, or of every voice in a chord, that takes effect at a
+ * given sample.  A UI program fills in a free row and sets its
+ * state to queued.  The row is freed once the change is sent
+ * to the render thread.  The events are kept in a heap by time
+ * so the next one due is always at the top.
+ **************************************************************/
+#define MX_VEVENTS         1024    // Rows in the events table
+#define EV_COLUMN_LEN      20      // Longest voices column name
+#define EV_VALUE_LEN       32      // Longest value as text
+#define EV_FREE            0       // row is not in use
+#define EV_QUEUED          1       // row waits for its sample
+
+struct VEVENT
+{
+    int      idx;              // Row number, set at startup
+    int      state;            // free(0) or queued(1)
+    llong    time;             // Sample at which the change takes effect
+    int      voice;            // Voice to change, or -1 for the voices in chordid
+    char     chordid[CHORDID_LEN]; // Chord to change if voice is -1
+    char     column[EV_COLUMN_LEN]; // Name of the voices column to set
+    char     value[EV_VALUE_LEN]; // New value of the column as text
+};
+
+
+/***************************************************************
+ * the buses table.  Each voice is mixed into one of the output
+ * buses, and each bus is added to the main output with its own
+ * gain and pan.  The render thread reads gainl and gainr, which
+ * are worked out when gain or pan is written.
+ **************************************************************/
+#define MX_BUSGAIN         4.0     // Highest bus gain, +12 dB
+
+struct BUS
+{
+    int      idx;              // Row number, set at startup
+    float    gain;             // Gain of the bus in the main output, 0 to MX_BUSGAIN
+    float    pan;              // -1 for left, 0 for center, 1 for right
+    float    gainl;            // gain of the bus's left channel in the main output
+    float    gainr;            // gain of the bus's right channel in the main output
+};
+
+
+/***************************************************************
+ * the streams table.  Each row is a program that subscribed to
+ * the rendered audio over TCP or a Unix socket.  It is sent the
+ * same samples as standard out, or the output of one bus.  A
+ * subscriber may fall up to bufms behind before the policy says
+ * what to do with it.
+ **************************************************************/
+#define MX_STREAMS         8       // Rows in the streams table
+#define STREAM_PEER_LEN    48      // Address of the subscriber as text
+#define DEF_STRBUFMS       500     // Default ms a subscriber may fall behind
+#define MN_STRBUFMS        10      // Least ms a subscriber may fall behind
+#define MX_STRBUFMS        5000    // Most ms a subscriber may fall behind
+#define STR_SKIP           0       // skip a slow subscriber ahead to the newest audio
+#define STR_CLOSE          1       // close a slow subscriber
+
+struct STREAM
+{
+    int      idx;              // Row number, set at startup
+    int      fd;               // Socket to the subscriber, or -1 if the row is free
+    char     peer[STREAM_PEER_LEN]; // Address of the subscriber
+    int      bufms;            // Most ms of audio the subscriber may fall behind
+    int      policy;           // On falling behind, skip(0) or close(1)
+    int      bus;              // Bus to send, or -1 for the main output
+    llong    sent;             // Bytes sent to the subscriber
+    llong    drops;            // Samples skipped since the subscriber fell behind
+    int      skips;            // Times the subscriber fell behind
+    int      blocked;          // ==1 while the socket is full
+    unsigned tail;             // Bytes of the stream ring sent or skipped
+};
+
+
+/***************************************************************
+ * The render engine's hot voice state.  This is a structure of
+ * arrays holding just the fields of struct VOICE that the block
+ * renderer reads or writes every block.  The arrays are indexed
+ * by voice, so one cache line holds a field for 16 voices and a
+ * loop across voices reads memory in order.  The UI strings,
+ * the user-facing frequencies, and the ADSR table stay in
+ * struct VOICE.  Names and types match struct VOICE.
+ *  The arrays are allocated at startup.  Each is aligned to a
+ * cache line and padded to a multiple of HOT_LANES voices.
+ **************************************************************/
+#define HOT_LANES          16      // voices per 64 byte cache line
+
+struct HOTVOICES
+{
+    // voice and envelope state
+    int     *vstate;
+    int     *ontime;
+    int     *adsridx;
+    float   *envgain;
+    float   *envmul;
+    float   *envadd;
+    int     *envleft;
+    // oscillator #1 and glide
+    int     *o1type;
+    float   *o1phasestep;
+    unsigned *o1phase;
+    float   *o1symmetry;
+    float   *o1phaseoffset;
+    float   *o1gain;
+    float   *o1out;
+    int     *o1wtable;
+    float   *glidefreq;
+    int     *glidems;
+    float   *glidestep;
+    int     *glidecount;
+    // vibrato
+    int     *vibtype;
+    float   *vibphasestep;
+    unsigned *vibphase;
+    float   *vibsymmetry;
+    float   *vibphaseoffset;
+    float   *vibo1phase;
+    float   *vibout;
+    // oscillator #2 and mixer
+    int     *o2type;
+    float   *o2phasestep;
+    unsigned *o2phase;
+    float   *o2symmetry;
+    float   *o2phaseoffset;
+    float   *o2gain;
+    float   *o2out;
+    int     *o2wtable;
+    int     *sync;
+    int     *mixmode;
+    // tremolo
+    int     *tremtype;
+    float   *tremphasestep;
+    unsigned *tremphase;
+    float   *tremdepth;
+    float   *tremsymmetry;
+    float   *tremphaseoffset;
+    float   *tremout;
+    // filters
+    int     *flttype;
+    int     *fltrolloff;
+    float   *flt1b0;
+    float   *flt1b1;
+    float   *flt1b2;
+    float   *flt1a1;
+    float   *flt1a2;
+    float   *flt1z1;
+    float   *flt1z2;
+    float   *flt2b0;
+    float   *flt2b1;
+    float   *flt2b2;
+    float   *flt2a1;
+    float   *flt2a2;
+    float   *flt2z1;
+    float   *flt2z2;
+    float   *fltstep[NFLTPARAM];
+    int     *fltramp;
+    // output
+    int     *outputclipping;
+    float   *outputgain;
+    int     *outputchannel;
+    int     *bus;
+    float   *voiceout;
+    // white noise generator.  Not in struct VOICE.
+    unsigned *noise;
+};
+
+
+/***************************************************************
+ * A group of voices for the filter bank.  The block renderer
+ * gathers the filter settings of up to FILT_LANES voices into
+ * one of these so the SIMD kernels in filt.c can run the voices
+ * side by side, one voice per lane.  Each array has one entry
+ * per voice.  Entries past nvoice must be zero.  Each buffer
+ * holds nsamp samples, and the samples past the voice's nlive
+ * must be zero.  They are left zero.
+ *  The masks are all ones (-1) for true so a kernel can use
+ * them directly as lane masks.
+ *  A voice whose parameters are ramping uses the parameter less
+ * (ramp - s) steps at sample s, for s less than ramp.  See
+ * filt_retarget() in voices.c.
+ **************************************************************/
+#define FILT_LANES         8       // most voices filtered together
+
+struct FILTGROUP
+{
+    int      nvoice;               // voices in the group, 1 to FILT_LANES
+    int      nsamp;                // largest nlive in the group
+    float   *buf[FILT_LANES];      // signal in, filtered signal out
+    int      nlive[FILT_LANES];    // samples to filter for each voice
+    int      stage2[FILT_LANES];   // -1 if filter #2 runs
+    int      stop[FILT_LANES];     // -1 if band-stop, the average of two filters
+    int      only1[FILT_LANES];    // -1 if the output is filter #1 alone
+    float    b10[FILT_LANES];      // filter #1 parameters
+    float    b11[FILT_LANES];
+    float    b12[FILT_LANES];
+    float    a11[FILT_LANES];
+    float    a12[FILT_LANES];
+    float    z11[FILT_LANES];      // filter #1 state
+    float    z12[FILT_LANES];
+    float    b20[FILT_LANES];      // filter #2 parameters
+    float    b21[FILT_LANES];
+    float    b22[FILT_LANES];
+    float    a21[FILT_LANES];
+    float    a22[FILT_LANES];
+    float    z21[FILT_LANES];      // filter #2 state
+    float    z22[FILT_LANES];
+    int      ramp[FILT_LANES];     // samples left in a parameter ramp
+    float    db10[FILT_LANES];     // step of each parameter in a ramp
+    float    db11[FILT_LANES];
+    float    db12[FILT_LANES];
+    float    da11[FILT_LANES];
+    float    da12[FILT_LANES];
+    float    db20[FILT_LANES];
+    float    db21[FILT_LANES];
+    float    db22[FILT_LANES];
+    float    da21[FILT_LANES];
+    float    da22[FILT_LANES];
+};
+
+
+/***************************************************************
+ * The wavetable bank.  A bank is a file of single-cycle tables
+ * that is mapped into memory at startup and shared, read-only,
+ * by all of the voices.  The file is a header, the name of each
+ * table, then the samples of each table in the same order.
+ *  Each table has nmips levels.  Level zero has length samples
+ * and each level after it has half as many samples and half as
+ * many harmonics as the one before.  The levels of a table are
+ * back to back, level zero first.  Samples are 32 bit floats in
+ * the byte order of the machine.  Length is a power of two.
+ *  The wavetables table lists the tables in the bank.  Its rows
+ * point into the mapped file for the samples.
+ **************************************************************/
+#define WT_MAGIC           0x54575153 // "SQWT" as a little endian word
+#define WT_VERSION         1       // bank file format version
+#define WT_NAME_LEN        32      // name of a wavetable, including the NUL
+#define MN_WTLEN           4       // fewest samples in level zero
+#define MX_WTLEN           65536   // most samples in level zero
+#define MX_WTMIPS          16      // most levels in a table
+#define MX_WTABLES         65536   // most tables in a bank
+
+struct WTHEADER
+{
+    unsigned magic;            // WT_MAGIC
+    unsigned version;          // WT_VERSION
+    unsigned ntables;          // number of tables in the bank
+    unsigned length;           // samples in level zero of each table
+    unsigned nmips;            // levels in each table
+    unsigned spare[3];         // zero
+};
+
+struct WAVETBL
+{
+    int      idx;              // Index of this table.  Used in o1wtable and o2wtable
+    char     name[WT_NAME_LEN]; // Name of the table from the bank file
+    int      length;           // Samples in level zero
+    int      nmips;            // Number of levels
+    float   *data;             // Level zero in the mapped bank file
+};
+
+
 /***************************************************************
  * table of UI connections and associated constants
  **************************************************************/
@@ -197,5 +623,6 @@ typedef struct ui
     llong    nbytout;          // number of bytes sent out
     int      ctm;              // connect time (==time();)
     int      cdur;             // duration time (== now()-ctm;)
+    int      readable;         // set if socket may have more to read
 } UI;
 
@@ -0,0 +1,502 @@
+/***************************************************************
+ * stream.c --  Send the rendered audio to programs that subscribe
+ *              to it over TCP or a Unix socket.
+ *
+ * Copyright:   Copyright (C) 2023 by Atomlab, LLC
+ *
+ * License:     This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the Version 2 of the GNU General
+ *              Public License as published by the Free Software Foundation.
+ *              GPL2.txt in the docs directory is a copy of this license.
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *              GNU General Public License for more details.
+ *
+ **************************************************************/
+
+/***************************************************************
+ * Overview:
+ *    A program that wants to monitor or record the audio connects
+ * to the stream port, or to the Unix socket given with -u, and is
+ * sent the same samples as standard out.  It sends nothing.  The
+ * bus column of its row picks one output bus to send instead.
+ *    The render thread copies each converted block once into a
+ * shared stream ring and moves the ring head.  There is a ring
+ * for the main output and one for each bus, made the first time
+ * a subscriber asks for it.  The render thread never touches a
+ * subscriber's socket.  Once flushsize samples have been added
+ * it wakes the SQL thread with an eventfd.  The SQL thread sends
+ * each subscriber what it has not yet seen straight from the
+ * shared ring, so the block is not copied again per subscriber.
+ *    Each subscriber keeps its own place in the ring.  A reader
+ * that falls more than bufms behind is skipped ahead to the
+ * newest audio or closed, as its policy says.  A skip keeps the
+ * subscriber on a frame boundary.  Since nothing more than half
+ * the ring behind is ever sent, the render thread can not write
+ * over the bytes being sent.
+ *    The sockets are in an epoll set of their own.  Its fd is in
+ * the main loop's epoll set and str_service() is called when it
+ * is ready.
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "sqlizer.h"
+
+
+/***************************************************************************
+ *  - Limits and defines
+ ***************************************************************************/
+#define  STRBUFSZ    (1 << 22)     // bytes in the shared stream ring.  Power of 2
+#define  STR_WAKE    MX_STREAMS    // epoll data of the eventfd
+#define  STR_TCP     (MX_STREAMS + 1) // epoll data of the TCP listen socket
+#define  STR_UNIX    (MX_STREAMS + 2) // epoll data of the Unix listen socket
+#define  STR_NEVENTS (MX_STREAMS + 3) // subscribers, eventfd, and listeners
+#define  NRINGS      (MX_BUSES + 1) // the main output then each bus
+
+
+/***************************************************************************
+ *  - Function prototypes and external references
+ ***************************************************************************/
+int    init_streams(int tcpfd, int unixfd);
+int    str_wanted(int ring);
+void   str_write(int ring, char *block, int nbytes);
+void   str_wake(int nsamp);
+void   str_service();
+int    str_setbus(int row, int oldbus);
+static int  str_ring(int ring);
+static void str_accept(int srvfd);
+static void str_send(struct STREAM *ps);
+static void str_close(struct STREAM *ps);
+extern int  out_framesize();
+extern struct SYNTH synth;
+extern struct RSET rset;
+
+
+/***************************************************************************
+ *  - Variable allocation for this file
+ ***************************************************************************/
+struct STREAM streams[MX_STREAMS]; // the streams table
+static char    *strbuf[NRINGS];    // rings of converted audio shared by all
+static uint32_t strhead[NRINGS];   // bytes ever added to each ring
+static int      nsubs[NRINGS];     // subscribers to each ring, read by the render thread
+static int      nsuball;           // open subscribers, read by the render thread
+static int      strpend;           // samples added since the last wakeup
+static int      strepfd = -1;      // epoll set of the stream sockets
+static int      wakefd = -1;       // eventfd the render thread wakes us with
+static int      tcplisten = -1;    // TCP listen socket
+static int      unixlisten = -1;   // Unix listen socket
+
+
+/***************************************************************
+ * init_streams(): - Set up the streams table and the epoll set
+ * of the stream sockets.  The caller opens the listen sockets.
+ *
+ * Input:        TCP and Unix listen sockets, -1 if not used
+ * Output:       fd of the epoll set for the main loop to watch
+ * Effects:      streams table
+ ***************************************************************/
+int init_streams(
+    int tcpfd,         // TCP listen socket or -1
+    int unixfd)        // Unix listen socket or -1
+{
+    struct epoll_event ev;     // an fd to watch
+    int      i;
+
+    for (i = 0; i < MX_STREAMS; i++) {
+        memset(&streams[i], 0, sizeof(struct STREAM));
+        streams[i].idx = i;
+        streams[i].fd = -1;
+        streams[i].bufms = DEF_STRBUFMS;
+        streams[i].policy = STR_SKIP;
+        streams[i].bus = -1;
+    }
+    nsuball = 0;
+    strpend = 0;
+    tcplisten = tcpfd;
+    unixlisten = unixfd;
+
+    strepfd = epoll_create1(0);
+    wakefd = eventfd(0, EFD_NONBLOCK);
+    if ((strepfd < 0) || (wakefd < 0) || str_ring(0)) {
+        fprintf(stderr, "Unable to set up audio streams\n");
+        exit(1);
+    }
+    ev.events = EPOLLIN;
+    ev.data.u32 = STR_WAKE;
+    (void) epoll_ctl(strepfd, EPOLL_CTL_ADD, wakefd, &ev);
+    if (tcpfd >= 0) {
+        ev.data.u32 = STR_TCP;
+        (void) epoll_ctl(strepfd, EPOLL_CTL_ADD, tcpfd, &ev);
+    }
+    if (unixfd >= 0) {
+        ev.data.u32 = STR_UNIX;
+        (void) epoll_ctl(strepfd, EPOLL_CTL_ADD, unixfd, &ev);
+    }
+    return (strepfd);
+}
+
+
+/***************************************************************
+ * str_wanted(): - Whether anyone subscribes to a ring.  The
+ * render thread calls this so a block no one wants is not
+ * converted or copied.
+ *
+ * Input:        ring, 0 for the main output or 1 + the bus
+ * Output:       1 if the ring has a subscriber, else 0
+ * Effects:
+ ***************************************************************/
+int str_wanted(
+    int ring)          // ring to check
+{
+    return (__atomic_load_n(&nsubs[ring], __ATOMIC_ACQUIRE) > 0);
+}
+
+
+/***************************************************************
+ * str_write(): - Add a block of converted audio to a stream
+ * ring.  This is called by the render thread from out_write()
+ * and out_bus() once str_wanted() says the ring is in use.
+ *
+ * Input:        ring, converted block, and its length
+ * Output:
+ * Effects:      stream ring
+ ***************************************************************/
+void str_write(
+    int   ring,        // 0 for the main output or 1 + the bus
+    char *block,       // samples in the output format
+    int   nbytes)      // bytes in block
+{
+    char    *buf;              // the ring
+    int      pos;              // offset of the head in the ring
+    int      first;            // bytes that fit before end of the ring
+
+    buf = strbuf[ring];
+    pos = strhead[ring] & (STRBUFSZ - 1);
+    first = STRBUFSZ - pos;
+    if (first >= nbytes) {
+        memcpy(&buf[pos], block, nbytes);
+    } else {
+        memcpy(&buf[pos], block, first);
+        memcpy(buf, &block[first], nbytes - first);
+    }
+    __atomic_store_n(&strhead[ring], strhead[ring] + nbytes, __ATOMIC_RELEASE);
+}
+
+
+/***************************************************************
+ * str_wake(): - Wake the SQL thread to send the new audio once
+ * flushsize samples have been added.  This is called by the
+ * render thread from out_write() after each block.
+ *
+ * Input:        samples in the block
+ * Output:
+ * Effects:      wakes the SQL thread
+ ***************************************************************/
+void str_wake(
+    int nsamp)         // samples in the block
+{
+    uint64_t one = 1;          // eventfd increment
+
+    if (__atomic_load_n(&nsuball, __ATOMIC_RELAXED) == 0)
+        return;
+    strpend += nsamp;
+    if (strpend >= __atomic_load_n(&rset.flushsize, __ATOMIC_RELAXED)) {
+        strpend = 0;
+        (void) write(wakefd, &one, sizeof(one));
+    }
+}
+
+
+/***************************************************************
+ * str_service(): - Handle the stream sockets that are ready.
+ * Accept new subscribers, close ones that hung up, and send
+ * new audio to the rest.  This is called by the main loop when
+ * the stream epoll set is ready.
+ *
+ * Input:
+ * Output:
+ * Effects:      streams table, stream sockets
+ ***************************************************************/
+void str_service()
+{
+    struct epoll_event events[STR_NEVENTS]; // ready stream fds
+    struct STREAM *ps;         // a subscriber
+    uint64_t count;            // eventfd count
+    char     junk[256];        // what a subscriber sends us
+    int      nev;              // number of ready fds
+    int      ret;
+    int      i;
+
+    nev = epoll_wait(strepfd, events, STR_NEVENTS, 0);
+    for (i = 0; i < nev; i++) {
+        if (events[i].data.u32 == STR_WAKE) {
+            (void) read(wakefd, &count, sizeof(count));
+            continue;
+        }
+        if (events[i].data.u32 == STR_TCP) {
+            str_accept(tcplisten);
+            continue;
+        }
+        if (events[i].data.u32 == STR_UNIX) {
+            str_accept(unixlisten);
+            continue;
+        }
+        ps = &streams[events[i].data.u32];
+        if (ps->fd < 0)
+            continue;
+        if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            str_close(ps);
+            continue;
+        }
+        if (events[i].events & EPOLLIN) {
+            while ((ret = read(ps->fd, junk, sizeof(junk))) > 0)
+                ;
+            if (ret == 0) {
+                str_close(ps);
+                continue;
+            }
+        }
+        if (events[i].events & EPOLLOUT)
+            ps->blocked = 0;
+    }
+
+    // Send the new audio to everyone who can take it
+    for (i = 0; i < MX_STREAMS; i++) {
+        if ((streams[i].fd >= 0) && !streams[i].blocked)
+            str_send(&streams[i]);
+    }
+}
+
+
+/***************************************************************
+ * str_setbus(): - Move a subscriber to the ring of its new bus.
+ * It starts with the next block rendered for the bus.  This is
+ * called by the streams write callback.
+ *
+ * Input:        row of the streams table, the bus it had
+ * Output:       1 if there is no memory for the ring, else 0
+ * Effects:      the subscriber's ring and place in it
+ ***************************************************************/
+int str_setbus(
+    int row,           // row of the streams table
+    int oldbus)        // bus before the write, -1 for the main output
+{
+    struct STREAM *ps;         // the subscriber
+
+    ps = &streams[row];
+    if ((ps->fd < 0) || (ps->bus == oldbus))
+        return 0;
+    if (str_ring(ps->bus + 1))
+        return 1;
+    __atomic_sub_fetch(&nsubs[oldbus + 1], 1, __ATOMIC_RELAXED);
+    ps->tail = __atomic_load_n(&strhead[ps->bus + 1], __ATOMIC_ACQUIRE);
+    ps->blocked = 0;
+    __atomic_add_fetch(&nsubs[ps->bus + 1], 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+/***************************************************************
+ * str_ring(): - Make a stream ring if it is not already made.
+ * The render thread does not use a ring until it has a
+ * subscriber, so a new ring is ready before anyone reads it.
+ *
+ * Input:        ring, 0 for the main output or 1 + the bus
+ * Output:       1 if there is no memory for it, else 0
+ * Effects:      strbuf[]
+ ***************************************************************/
+static int str_ring(
+    int ring)          // ring to make
+{
+    if (strbuf[ring])
+        return 0;
+    strbuf[ring] = malloc(STRBUFSZ);
+    if (strbuf[ring] == (char *) NULL) {
+        fprintf(stderr, "Unable to allocate an audio stream ring\n");
+        return 1;
+    }
+    return 0;
+}
+
+
+/***************************************************************
+ * str_accept(): - Accept a new subscriber into a free row of the
+ * streams table.  It starts with the next block rendered.  If
+ * every row is in use the new connection is closed.
+ *
+ * Input:        the listen socket that is ready
+ * Output:
+ * Effects:      streams table
+ ***************************************************************/
+static void str_accept(
+    int srvfd)         // TCP or Unix listen socket
+{
+    struct sockaddr_storage cliskt; // address of the subscriber
+    struct sockaddr_in *pin;   // the address if it is TCP
+    socklen_t adrlen;          // length of the address
+    struct epoll_event ev;     // events to watch for
+    struct STREAM *ps;         // row for the new subscriber
+    char     ip[INET_ADDRSTRLEN]; // IP address as text
+    int      fd;               // socket to the subscriber
+    int      flags;            // helps set non-blocking IO
+    int      i;
+
+    adrlen = sizeof(cliskt);
+    fd = accept(srvfd, (struct sockaddr *) &cliskt, &adrlen);
+    if (fd < 0)
+        return;
+    for (i = 0; (i < MX_STREAMS) && (streams[i].fd >= 0); i++)
+        ;
+    if (i == MX_STREAMS) {
+        fprintf(stderr, "No free row for an audio stream\n");
+        close(fd);
+        return;
+    }
+
+    flags = fcntl(fd, F_GETFL, 0);
+    flags |= O_NONBLOCK;
+    (void) fcntl(fd, F_SETFL, flags);
+    ps = &streams[i];
+    if (str_ring(ps->bus + 1)) {
+        close(fd);
+        return;
+    }
+    ps->fd = fd;
+    if (cliskt.ss_family == AF_INET) {
+        pin = (struct sockaddr_in *) &cliskt;
+        (void) inet_ntop(AF_INET, &pin->sin_addr, ip, sizeof(ip));
+        snprintf(ps->peer, STREAM_PEER_LEN, "%s:%d", ip, ntohs(pin->sin_port));
+    }
+    else
+        snprintf(ps->peer, STREAM_PEER_LEN, "unix");
+    ps->sent = 0;
+    ps->drops = 0;
+    ps->skips = 0;
+    ps->blocked = 0;
+    ps->tail = __atomic_load_n(&strhead[ps->bus + 1], __ATOMIC_ACQUIRE);
+
+    // Edge-triggered so we hear once each time the socket drains
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.u32 = i;
+    if (epoll_ctl(strepfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        fprintf(stderr, "Unable to add audio stream to epoll\n");
+        close(fd);
+        ps->fd = -1;
+        return;
+    }
+    __atomic_add_fetch(&nsubs[ps->bus + 1], 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&nsuball, 1, __ATOMIC_RELAXED);
+}
+
+
+/***************************************************************
+ * str_send(): - Send a subscriber the audio it has not yet seen
+ * straight from the stream ring.  The bytes may wrap around the
+ * end of the ring so both parts go in one sendmsg().  If the
+ * subscriber is too far behind, its policy says whether to skip
+ * it ahead or close it.  A full socket is tried again when epoll
+ * says it has drained.
+ *
+ * Input:        the subscriber
+ * Output:
+ * Effects:      the subscriber's place in the ring
+ ***************************************************************/
+static void str_send(
+    struct STREAM *ps) // subscriber to send to
+{
+    struct msghdr msg;         // the one or two parts of the ring
+    struct iovec iov[2];
+    char    *buf;              // the subscriber's ring
+    uint32_t head;             // bytes in the ring so far
+    uint32_t nbytes;           // bytes to send
+    uint32_t maxlag;           // most bytes the subscriber may be behind
+    uint32_t skip;             // bytes skipped to catch up
+    int      framesize;        // bytes per sample time, all channels
+    int      pos;              // offset of the tail in the ring
+    ssize_t  ret;              // sendmsg() return value
+
+    framesize = out_framesize();
+    buf = strbuf[ps->bus + 1];
+    head = __atomic_load_n(&strhead[ps->bus + 1], __ATOMIC_ACQUIRE);
+    maxlag = (uint32_t) ((llong) ps->bufms * synth.srate / 1000) * framesize;
+    if (maxlag > (STRBUFSZ / 2))
+        maxlag = STRBUFSZ / 2;
+
+    nbytes = head - ps->tail;
+    if (nbytes > maxlag) {
+        if (ps->policy == STR_CLOSE) {
+            str_close(ps);
+            return;
+        }
+        // Skip to the newest audio but stay in step with the frames
+        skip = nbytes - (nbytes % framesize);
+        ps->tail += skip;
+        ps->drops += skip / framesize;
+        ps->skips++;
+        nbytes -= skip;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    while (nbytes > 0) {
+        pos = ps->tail & (STRBUFSZ - 1);
+        iov[0].iov_base = &buf[pos];
+        if ((pos + nbytes) <= STRBUFSZ) {
+            iov[0].iov_len = nbytes;
+            msg.msg_iovlen = 1;
+        } else {
+            iov[0].iov_len = STRBUFSZ - pos;
+            iov[1].iov_base = buf;
+            iov[1].iov_len = nbytes - iov[0].iov_len;
+            msg.msg_iovlen = 2;
+        }
+
+        // A subscriber that has gone away must not raise SIGPIPE
+        ret = sendmsg(ps->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                ps->blocked = 1;
+                return;
+            }
+            str_close(ps);
+            return;
+        }
+        ps->tail += ret;
+        ps->sent += ret;
+        nbytes -= ret;
+    }
+}
+
+
+/***************************************************************
+ * str_close(): - Close a subscriber and free its row.  The row
+ * keeps its bufms, policy, and bus for the next subscriber.  Closing
+ * the socket also takes it out of the epoll set.
+ *
+ * Input:        the subscriber
+ * Output:
+ * Effects:      streams table
+ ***************************************************************/
+static void str_close(
+    struct STREAM *ps) // subscriber to close
+{
+    close(ps->fd);
+    ps->fd = -1;
+    __atomic_sub_fetch(&nsubs[ps->bus + 1], 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&nsuball, 1, __ATOMIC_RELAXED);
+}
@@ -31,12 +31,33 @@
  **************************************************************/
 
 #include <stdio.h>          /* for 'fprintf' */
+#include <stdlib.h>         /* for 'strtol' */
 #include <stddef.h>         /* for 'offsetof' */
+#include <string.h>         /* for 'strcmp' */
 #include <math.h>           /* for cosf,sinf, and Pi/2 */
 #include "sqlizer.h"        /* for table definitions and sizes */
 
 extern UI ui[];
-extern struct VOICE voices[];
+extern struct VOICE *voices;
+extern struct SYNTH synth;
+extern struct VEVENT vevents[];
+extern struct ALLOC allocator;
+extern struct PATCH patches[];
+extern struct STREAM streams[];
+extern struct BUS buses[];
+extern void mark_voice(int v);
+extern void ev_queue(int row);
+extern void ev_cancel(int row);
+extern int alloc_voice(struct ALLOC *pal);
+extern int patch_field(int offset);
+extern void mark_written(int v, int offset);
+extern void mark_patch(int v, int p);
+extern int str_setbus(int row, int oldbus);
+extern void force_field(int v, int offset);
+extern void mark_derived(int v, unsigned fields);
+extern float filt_warp(int f);
+static int set_voicefield(char *, char *, char *, void *, int,  void *);
+static int set_dynfield(char *, char *, char *, void *, int,  void *);
 static int set_vstate(char *, char *, char *, void *, int,  void *);
 static int set_o1freq(char *, char *, char *, void *, int,  void *);
 static int set_o2freq(char *, char *, char *, void *, int,  void *);
@@ -44,6 +65,8 @@ static int set_vibfreq(char *, char *, char *, void *, int,  void *);
 static int set_tremfreq(char *, char *, char *, void *, int,  void *);
 static int get_o1freq(char *, char *, char *, void *, int);
 static int get_o2freq(char *, char *, char *, void *, int);
+static int get_phaseacc(char *, char *, char *, void *, int);
+static int set_phaseacc(char *, char *, char *, void *, int,  void *);
 static int set_glidefreq(char *, char *, char *, void *, int,  void *);
 static int set_glidems(char *, char *, char *, void *, int,  void *);
 static int set_o1symmetry(char *, char *, char *, void *, int,  void *);
@@ -52,6 +75,39 @@ static int set_vibsymmetry(char *, char *, char *, void *, int,  void *);
 static int set_vibdepth(char *, char *, char *, void *, int,  void *);
 static int set_tremsymmetry(char *, char *, char *, void *, int,  void *);
 static int set_flttype(char *, char *, char *, void *, int,  void *);
+void derive_voice(int v, struct VOICE *pvoc, unsigned fields);
+static void derive_later(int row, struct VOICE *pvoc, unsigned fields);
+static void derive_flt1(struct VOICE *pvoc);
+static void derive_flt2(struct VOICE *pvoc);
+static int set_blocksize(char *, char *, char *, void *, int,  void *);
+static int set_rendermode(char *, char *, char *, void *, int,  void *);
+static int set_flushsize(char *, char *, char *, void *, int,  void *);
+static int set_maxcatchup(char *, char *, char *, void *, int,  void *);
+static int set_osckernel(char *, char *, char *, void *, int,  void *);
+static int set_o1wtable(char *, char *, char *, void *, int,  void *);
+static int set_o2wtable(char *, char *, char *, void *, int,  void *);
+static int set_wtinterp(char *, char *, char *, void *, int,  void *);
+static int set_fltsmooth(char *, char *, char *, void *, int,  void *);
+static int set_envcurve(char *, char *, char *, void *, int,  void *);
+static int set_phasereset(char *, char *, char *, void *, int,  void *);
+static int set_patch(char *, char *, char *, void *, int,  void *);
+static int get_patchfield(char *, char *, char *, void *, int);
+static int set_patchfield(char *, char *, char *, void *, int,  void *);
+int init_patchcols();
+static int set_sinemode(char *, char *, char *, void *, int,  void *);
+static int set_evlead(char *, char *, char *, void *, int,  void *);
+static int set_event(char *, char *, char *, void *, int,  void *);
+static int set_allocnote(char *, char *, char *, void *, int,  void *);
+static int set_allocpolicy(char *, char *, char *, void *, int,  void *);
+static int set_stream(char *, char *, char *, void *, int,  void *);
+static int set_voicebus(char *, char *, char *, void *, int,  void *);
+static int set_busmix(char *, char *, char *, void *, int,  void *);
+int write_voicecol(int v, char *column, char *value);
+static int check_voicecol(char *column, char *value);
+static RTA_COLDEF *find_voicecol(char *column);
+static void wrote_voicecol(int row, char *column);
+static int parse_voicecol(RTA_COLDEF *pcol, char *value, struct VOICE *pvoc);
+extern int osc_supported(int kernel);
 
 /*INDENT-OFF*/
 
@@ -77,7 +133,7 @@ RTA_COLDEF voicecols[] = {
         offsetof(struct VOICE, noteid), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "An identified for this note.  Assigned by the UI that added the note."},
     {
         "voices",           /* the table name */
@@ -87,7 +143,7 @@ RTA_COLDEF voicecols[] = {
         offsetof(struct VOICE, chordid), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "All notes in a chord are given an ID so all the notes can be started at the same time.\
   Assigned by the UI that added the note."},
     {
@@ -110,8 +166,33 @@ RTA_COLDEF voicecols[] = {
         offsetof(struct VOICE, ontime), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_dynfield,       /* called after write */
         "The number of samples the tone has been on.  Set to zero at tone start."},
+    {
+        "voices",           /* the table name */
+        "phasereset",       /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct VOICE, phasereset), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_phasereset,     /* called after write */
+        "Set to 1 to start all four oscillator phases at zero when the voice\
+ goes from free or inuse to on.  The notes of a chord started by one UPDATE\
+ then start on the same sample in the same phase.  Default is 0, where the\
+ phases go on from where the last note left them."},
+    {
+        "voices",           /* the table name */
+        "patch",            /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct VOICE, patch), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_patch,          /* called after write */
+        "Write the index of a row of the patches table to copy the patch into\
+ the voice.  Other columns changed by the same UPDATE are kept, so a patch\
+ can be played at any frequency.  Reads as the last patch copied, or -1."},
     {
         "voices",           /* the table name */
         "o1type",           /* the column name */
@@ -120,9 +201,20 @@ RTA_COLDEF voicecols[] = {
         offsetof(struct VOICE, o1type), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Type of oscillator output as one of off(0), sine(1), square(2), triangle(3)\
- or noise(4)."},
+, noise(4), wavetable(5), band-limited square(6) or band-limited triangle(7)."},
+    {
+        "voices",           /* the table name */
+        "o1wtable",         /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct VOICE, o1wtable), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_o1wtable,       /* called after write */
+        "Index of the wavetable to play when o1type is wavetable(5).  See the\
+ wavetables table for the tables in the bank."},
     {
         "voices",           /* the table name */
         "o1freq",           /* the column name */
@@ -132,7 +224,8 @@ RTA_COLDEF voicecols[] = {
         0,                  /* no flags */
         get_o1freq,         /* called before read */
         set_o1freq,         /* called after write */
-        "Oscillator frequency in Hertz.  Range is 0.001 to 9000."},
+        "Oscillator frequency in Hertz.  Range is 0.001 to 9000, or to just below\
+ half the sample rate if that is lower."},
     {
         "voices",           /* the table name */
         "o1phaseacc",       /* the column name */
@@ -140,8 +233,8 @@ RTA_COLDEF voicecols[] = {
         sizeof(float),      /* number of bytes */
         offsetof(struct VOICE, o1phaseacc), /* location in struct */
         0,                  /* no flags */
-        (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        get_phaseacc,       /* called before read */
+        set_phaseacc,       /* called after write */
         "This is the phase of the output in the range of 0 to 1.  Multiply by 360 to get\
  degrees or by 2 pi to get radians."},
     {
@@ -169,7 +262,7 @@ RTA_COLDEF voicecols[] = {
         offsetof(struct VOICE, o1phaseoffset), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "This value plus the phase accumulator is used to compute the phase\
  of the output waveform.  This helps make an asymmetric triangle waveform into\
  a ramp."},
@@ -181,7 +274,7 @@ RTA_COLDEF voicecols[] = {
         offsetof(struct VOICE, o1gain), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "The gain (attenuation) applied to the output from osc1."},
     {
         "voices",           /* the table name */
@@ -191,9 +284,9 @@ RTA_COLDEF voicecols[] = {
         offsetof(struct VOICE, vibtype), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Type of oscillator output as one of off(0), sine(1), square(2), triangle(3)\
- or noise(4)."},
+, noise(4), band-limited square(6) or band-limited triangle(7)."},
     {
         "voices",           /* the table name */
         "vibfreq",          /* the column name */
@@ -203,7 +296,8 @@ RTA_COLDEF voicecols[] = {
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
         set_vibfreq,        /* called after write */
-        "Oscillator frequency in Hertz.  Range is 0.001 to 9000."},
+        "Oscillator frequency in Hertz.  Range is 0.001 to 9000, or to just below\
+ half the sample rate if that is lower."},
     {
         "voices",           /* the table name */
         "vibphaseacc",      /* the column name */
@@ -211,8 +305,8 @@ RTA_COLDEF voicecols[] = {
         sizeof(float),      /* number of bytes */
         offsetof(struct VOICE, vibphaseacc), /* location in struct */
         0,                  /* no flags */
-        (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        get_phaseacc,       /* called before read */
+        set_phaseacc,       /* called after write */
         "This is the phase of the vibrato oscillator in the range of 0 to 1. \
  Multiply by 360 to get degrees or by 2 pi to get radians."},
     {
@@ -251,7 +345,7 @@ RTA_COLDEF voicecols[] = {
         offsetof(struct VOICE, vibphaseoffset), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "This value plus the phase accumulator is used to compute the phase\
  of the output waveform.  This helps make an asymmetric triangle waveform into\
  a ramp."},
@@ -264,7 +358,8 @@ RTA_COLDEF voicecols[] = {
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
         set_glidefreq,      /* called after write */
-        "Target frequency at completion of glide.  Range is 0.001 to 9000."},
+        "Target frequency at completion of glide.  Range is 0.001 to 9000, or to\
+ just below half the sample rate if that is lower."},
     {
         "voices",           /* the table name */
         "glidems",          /* the column name */
@@ -283,9 +378,20 @@ RTA_COLDEF voicecols[] = {
         offsetof(struct VOICE, o2type), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Type of oscillator output as one of off(0), sine(1), square(2), triangle(3)\
- or noise(4)."},
+, noise(4), wavetable(5), band-limited square(6) or band-limited triangle(7)."},
+    {
+        "voices",           /* the table name */
+        "o2wtable",         /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct VOICE, o2wtable), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_o2wtable,       /* called after write */
+        "Index of the wavetable to play when o2type is wavetable(5).  See the\
+ wavetables table for the tables in the bank."},
     {
         "voices",           /* the table name */
         "o2freq",           /* the column name */
@@ -295,7 +401,8 @@ RTA_COLDEF voicecols[] = {
         0,                  /* no flags */
         get_o2freq,         /* called before read */
         set_o2freq,         /* called after write */
-        "Oscillator frequency in Hertz.  Range is 0.001 to 9000."},
+        "Oscillator frequency in Hertz.  Range is 0.001 to 9000, or to just below\
+ half the sample rate if that is lower."},
     {
         "voices",           /* the table name */
         "o2phaseacc",       /* the column name */
@@ -303,8 +410,8 @@ RTA_COLDEF voicecols[] = {
         sizeof(float),      /* number of bytes */
         offsetof(struct VOICE, o2phaseacc), /* location in struct */
         0,                  /* no flags */
-        (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        get_phaseacc,       /* called before read */
+        set_phaseacc,       /* called after write */
         "This is the phase of the output in the range of 0 to 1.  Multiply by 360 to get\
  degrees or by 2 pi to get radians."},
     {
@@ -332,7 +439,7 @@ RTA_COLDEF voicecols[] = {
         offsetof(struct VOICE, o2phaseoffset), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "This value plus the phase accumulator is used to compute the phase\
  of the output waveform.  This helps make an asymmetric triangle waveform into\
  a ramp."},
@@ -344,7 +451,7 @@ RTA_COLDEF voicecols[] = {
         offsetof(struct VOICE, o2gain), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "The gain (attenuation) applied to the output from osc2."},
     {
         "voices",           /* the table name */
@@ -354,7 +461,7 @@ RTA_COLDEF voicecols[] = {
         offsetof(struct VOICE, mixmode), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "How to mix osc1 and osc2.  Must be one of none (0), sum (1),\
 AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
     {
@@ -365,9 +472,9 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, tremtype), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Tremolo waveform as one of off(0), sine(1), square(2), triangle(3)\
- or noise(4)."},
+, noise(4), band-limited square(6) or band-limited triangle(7)."},
     {
         "voices",           /* the table name */
         "tremfreq",          /* the column name */
@@ -377,7 +484,8 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
         set_tremfreq,       /* called after write */
-        "Tremolo frequency in Hertz.  Range is 0.001 to 9000."},
+        "Tremolo frequency in Hertz.  Range is 0.001 to 9000, or to just below\
+ half the sample rate if that is lower."},
     {
         "voices",           /* the table name */
         "tremphaseacc",     /* the column name */
@@ -385,8 +493,8 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         sizeof(float),      /* number of bytes */
         offsetof(struct VOICE, tremphaseacc), /* location in struct */
         0,                  /* no flags */
-        (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        get_phaseacc,       /* called before read */
+        set_phaseacc,       /* called after write */
         "This is the phase of the tremelo output in the range of 0 to 1. \
  Multiply by 360 to get degrees or by 2 pi to get radians."},
     {
@@ -397,7 +505,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, tremdepth), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "This is the maximum gain that is added to o1gain as part of tremolo.  The o1\
  output gain varies between o1gain and (o1gain + tremdepth)"},
     {
@@ -425,7 +533,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, tremphaseoffset), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "This value plus the phase accumulator is used to compute the phase\
  of the output waveform.  This helps make an asymmetric triangle waveform into\
  a ramp."},
@@ -437,7 +545,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, step0time), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Number of milliseconds to apply this step/gain to the voice amplitude. \
  Set to 60000 (1 minute) to enter SUSTAIN mode."},
     {
@@ -448,7 +556,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, step0gain), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Amount of gain to apply during this step. Must be between 0 and 1. \
  Set to 0 to end the note."},
     {
@@ -459,7 +567,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, step1time), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Number of milliseconds to apply this step/gain to the voice amplitude \
  Set to 60000 (1 minute) to enter SUSTAIN mode.."},
     {
@@ -470,7 +578,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, step1gain), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Amount of gain to apply during this step. Must be between 0 and 1. \
  Set to 0 to end the note."},
     {
@@ -481,7 +589,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, step2time), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Number of milliseconds to apply this step/gain to the voice amplitude \
  Set to 60000 (1 minute) to enter SUSTAIN mode.."},
     {
@@ -492,7 +600,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, step2gain), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Amount of gain to apply during this step. Must be between 0 and 1. \
  Set to 0 to end the note."},
     {
@@ -503,7 +611,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, step3time), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Number of milliseconds to apply this step/gain to the voice amplitude \
  Set to 60000 (1 minute) to enter SUSTAIN mode.."},
     {
@@ -514,7 +622,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, step3gain), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Amount of gain to apply during this step. Must be between 0 and 1. \
  Set to 0 to end the note."},
     {
@@ -525,7 +633,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, step4time), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Number of milliseconds to apply this step/gain to the voice amplitude \
  Set to 60000 (1 minute) to enter SUSTAIN mode.."},
     {
@@ -536,7 +644,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, step4gain), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Amount of gain to apply during this step. Must be between 0 and 1. \
  Set to 0 to end the note."},
     {
@@ -547,7 +655,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, step5time), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Number of milliseconds to apply this step/gain to the voice amplitude \
  Set to 60000 (1 minute) to enter SUSTAIN mode.."},
     {
@@ -558,7 +666,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, step5gain), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Amount of gain to apply during this step. Must be between 0 and 1. \
  Set to 0 to end the note."},
     {
@@ -569,7 +677,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, step6time), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Number of milliseconds to apply this step/gain to the voice amplitude \
  Set to 60000 (1 minute) to enter SUSTAIN mode.."},
     {
@@ -580,7 +688,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, step6gain), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Amount of gain to apply during this step. Must be between 0 and 1. \
  Set to 0 to end the note."},
     {
@@ -591,7 +699,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, step7time), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Number of milliseconds to apply this step/gain to the voice amplitude \
  Set to 60000 (1 minute) to enter SUSTAIN mode."},
     {
@@ -602,9 +710,21 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, step7gain), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Amount of gain to apply during this step. Must be between 0 and 1. \
  Set to 0 to end the note."},
+    {
+        "voices",           /* the table name */
+        "envcurve",         /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct VOICE, envcurve), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_envcurve,       /* called after write */
+        "Shape of each ADSR step as linear(0) or exponential(1).  An\
+ exponential step moves quickly at first and then slows as it nears\
+ the step's gain, as an analog envelope does.  Default is 0."},
     {
         "voices",           /* the table name */
         "flttype",          /* the column name */
@@ -624,8 +744,9 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, fltf1), /* location in struct */
         0,                  /* no flags */ 
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
-        "Output filter #1 cutoff frequency in range of 1 to 20000 Hz."},
+        set_flttype,        /* called after write */
+        "Output filter #1 cutoff frequency in range of 1 to 20000 Hz, or to just\
+ below half the sample rate if that is lower."},
     {
         "voices",           /* the table name */
         "fltfreq2",         /* the column name */
@@ -634,8 +755,9 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, fltf2), /* location in struct */
         0,                  /* no flags */ 
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
-        "Output filter #2 cutoff frequency in range of 1 to 20000 Hz.."},
+        set_flttype,        /* called after write */
+        "Output filter #2 cutoff frequency in range of 1 to 20000 Hz, or to just\
+ below half the sample rate if that is lower."},
     {
         "voices",           /* the table name */
         "fltrolloff",       /* the column name */
@@ -644,7 +766,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, fltrolloff), /* location in struct */
         0,                  /* no flags */ 
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_flttype,        /* called after write */
         "Output filter rolloff in dB.  Must be either 6 or 12.  Band pass\
  and band stop filters always have 6 dB rolloff"},
     {
@@ -655,7 +777,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, fltq), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_flttype,        /* called after write */
         "The Q for the output filter in range of 0.1 to 25."},
     {
         "voices",           /* the table name */
@@ -665,7 +787,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, outputclipping), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Set to 1 to limit voice output to range of 1.0 to -1.0.  Set to 0 for no clipping."},
     {
         "voices",           /* the table name */
@@ -675,7 +797,7 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, outputgain), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "The gain (attenuation) applied to the final output.  Must be between zero and one."},
     {
         "voices",           /* the table name */
@@ -685,51 +807,786 @@ AM o1 by o2, FM o1 by o2, ring, hardsync of o1 by o2."},
         offsetof(struct VOICE, outputchannel), /* location in struct */
         0,                  /* no flags */
         (int (*)()) 0,      /* called before read */
-        (int (*)()) 0,      /* called after write */
+        set_voicefield,     /* called after write */
         "Specify the destination channel of this voice as 1 for left only, 2 for\
  right only, and 3 for output to both left and right."},
+    {
+        "voices",           /* the table name */
+        "bus",              /* the column name */
+        RTA_INT,            /* it is an int */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct VOICE, bus), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_voicebus,       /* called after write */
+        "Output bus of this voice, 0 to 7.  The voice is mixed into the bus\
+ and the bus, after its gain and pan, into the main output.  Default is 0."},
 };
 
 /***************************************************************
- *   We defined all of the data structure (column defintions)
- * for the tables above.  Now define the tables themselves.
+ *   Column definitions for the synth table
  **************************************************************/
-RTA_TBLDEF UITables[] = {
+RTA_COLDEF synthcols[] = {
     {
-        "voices",           /* table name */
-        voices,             /* address of table */
-        sizeof(struct VOICE), /* length of each row */
-        VOICE_COUNT,        /* number of rows */
-        (void *) NULL,      /* iterator function */
-        (void *) NULL,      /* iterator callback data */
-        (void *) NULL,      /* INSERT callback */
-        (void *) NULL,      /* DELETE callback */
-        voicecols,          /* array of column defs */
-        sizeof(voicecols) / sizeof(RTA_COLDEF), /* number of cols */
-        "",                 /* save file name */
-        "Table of voices and their parameters"},
+        "synth",            /* the table name */
+        "blocksize",        /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct SYNTH, blocksize), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_blocksize,      /* called after write */
+        "Number of samples each voice renders in one pass of the block renderer.\
+  Range is 1 to 256.  Larger blocks cost less per sample but add latency."},
+    {
+        "synth",            /* the table name */
+        "rendermode",       /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct SYNTH, rendermode), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_rendermode,     /* called after write */
+        "Renderer to use as one of block(0) or reference(1).  The reference renderer\
+ processes every voice one sample at a time and is kept to check the output of\
+ the block renderer."},
+    {
+        "synth",            /* the table name */
+        "flushsize",        /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct SYNTH, flushsize), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_flushsize,      /* called after write */
+        "Number of output samples to collect before writing them to standard out.\
+  Range is 1 to 16384.  Larger values mean fewer system calls but more latency."},
+    {
+        "synth",            /* the table name */
+        "outdrops",         /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct SYNTH, outdrops), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Number of output samples dropped because the program reading standard out\
+ fell too far behind.  Set to zero to reset."},
+    {
+        "synth",            /* the table name */
+        "outformat",        /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct SYNTH, outformat), /* location in struct */
+        RTA_READONLY,       /* set at startup */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Output sample format as one of S16_BE(0), S16_LE(1), S24_3LE(2), S32_LE(3),\
+ or FLOAT_LE(4).  Set with the -f command line option."},
+    {
+        "synth",            /* the table name */
+        "outchannels",      /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct SYNTH, outchannels), /* location in struct */
+        RTA_READONLY,       /* set at startup */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Number of output channels, one for mono or two for interleaved stereo.\
+  Set with the -c command line option."},
+    {
+        "synth",            /* the table name */
+        "maxcatchup",       /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct SYNTH, maxcatchup), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_maxcatchup,     /* called after write */
+        "Most samples the renderer will render late in one pass.  If the renderer\
+ falls further behind the clock than this the extra samples are skipped.\
+  Range is 1 to one second of samples.  Default is 100 ms of samples, 4410\
+ at 44100 Hz."},
+    {
+        "synth",            /* the table name */
+        "samples",          /* the column name */
+        RTA_LONG,           /* it is a long long */
+        sizeof(llong),      /* number of bytes */
+        offsetof(struct SYNTH, samples), /* location in struct */
+        RTA_READONLY,       /* counted by the renderer */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Number of samples rendered since the program started."},
+    {
+        "synth",            /* the table name */
+        "underruns",        /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct SYNTH, underruns), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Number of times the renderer fell more than maxcatchup samples behind the\
+ clock and skipped ahead.  Set to zero to reset."},
+    {
+        "synth",            /* the table name */
+        "lostsamples",      /* the column name */
+        RTA_LONG,           /* it is a long long */
+        sizeof(llong),      /* number of bytes */
+        offsetof(struct SYNTH, lostsamples), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Number of samples skipped by underruns.  Set to zero to reset."},
+    {
+        "synth",            /* the table name */
+        "overruns",         /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct SYNTH, overruns), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Number of render blocks dropped because the output buffer was full.\
+  The dropped samples are counted in outdrops.  Set to zero to reset."},
+    {
+        "synth",            /* the table name */
+        "osckernel",        /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct SYNTH, osckernel), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_osckernel,      /* called after write */
+        "Oscillator waveform kernel as one of scalar(0), SSE2(1), or AVX2(2).\
+  The fastest one the CPU supports is picked at startup.  All give the same\
+ output.  A kernel the CPU does not support is refused."},
+    {
+        "synth",            /* the table name */
+        "sinemode",         /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct SYNTH, sinemode), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_sinemode,       /* called after write */
+        "How sine waves are computed, as one of quarter(0), table(1), or poly(2).\
+  Quarter is the original quarter-wave table with no interpolation and has\
+ harmonics at about -60 dB.  Table is a 4096 entry table with linear\
+ interpolation.  Poly is a polynomial with no table.  Run sqlizer-bench to\
+ see the distortion and speed of each.  Default is 1."},
+    {
+        "synth",            /* the table name */
+        "nvoices",          /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct SYNTH, nvoices), /* location in struct */
+        RTA_READONLY,       /* set at startup */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Number of rows in the voices table.  Set with the -n command line\
+ option.  Default is 20."},
+    {
+        "synth",            /* the table name */
+        "srate",            /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct SYNTH, srate), /* location in struct */
+        RTA_READONLY,       /* set at startup */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Sample rate in Hz.  All phase steps, glide times, ADSR times, and\
+ filter coefficients are computed from it.  Set with the -s command line\
+ option.  Default is 44100."},
+    {
+        "synth",            /* the table name */
+        "nworkers",         /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct SYNTH, nworkers), /* location in struct */
+        RTA_READONLY,       /* set at startup */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Number of worker threads that help the render thread render voices.\
+  The output is the same for any number of workers.  Set with the -j\
+ command line option.  Default is 0."},
+    {
+        "synth",            /* the table name */
+        "wtinterp",         /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct SYNTH, wtinterp), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_wtinterp,       /* called after write */
+        "Interpolation between wavetable samples as one of none(0), linear(1),\
+ or cubic(2).  Cubic is the cleanest and costs the most.  Default is 1."},
+    {
+        "synth",            /* the table name */
+        "nwtables",         /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct SYNTH, nwtables), /* location in struct */
+        RTA_READONLY,       /* set at startup */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Number of tables in the wavetable bank.  The bank file is given with\
+ the -w command line option.  Zero if there is no bank."},
+    {
+        "synth",            /* the table name */
+        "fltsmooth",        /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct SYNTH, fltsmooth), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_fltsmooth,      /* called after write */
+        "Time in milliseconds for new filter settings to ramp in.  A sweep of\
+ the cutoff sent as many small updates is smooth and does not click.\
+  Zero makes new settings take effect at once.  A new note always starts\
+ with its settings.  Range is 0 to 1000.  Default is 10."},
+    {
+        "synth",            /* the table name */
+        "evlead",           /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct SYNTH, evlead), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_evlead,         /* called after write */
+        "Time in milliseconds before its sample that a scheduled event is sent\
+ to the render thread.  It must be more than a block and the time it takes\
+ to get a command to the render thread.  Other commands wait behind a sent\
+ event so a long lead delays them.  Range is 1 to 1000.  Default is 10."},
+    {
+        "synth",            /* the table name */
+        "evlate",           /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct SYNTH, evlate), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Number of batches of scheduled events that reached the render thread\
+ after their sample and were applied at once.  Set to zero to reset."},
 };
-int      nuitables = (sizeof(UITables) / sizeof(RTA_TBLDEF));
-/*INDENT-ON*/
 
+/***************************************************************
+ *   Column definitions for the wavetables table
+ **************************************************************/
+RTA_COLDEF wtablecols[] = {
+    {
+        "wavetables",       /* the table name */
+        "idx",              /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct WAVETBL, idx), /* location in struct */
+        RTA_READONLY,       /* set at startup */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Index of the wavetable.  Put this in o1wtable or o2wtable to play it."},
+    {
+        "wavetables",       /* the table name */
+        "name",             /* the column name */
+        RTA_STR,            /* it is a string */
+        WT_NAME_LEN,        /* number of bytes */
+        offsetof(struct WAVETBL, name), /* location in struct */
+        RTA_READONLY,       /* set at startup */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Name of the wavetable from the bank file."},
+    {
+        "wavetables",       /* the table name */
+        "length",           /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct WAVETBL, length), /* location in struct */
+        RTA_READONLY,       /* set at startup */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Number of samples in one cycle of the full bandwidth level of the table."},
+    {
+        "wavetables",       /* the table name */
+        "nmips",            /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct WAVETBL, nmips), /* location in struct */
+        RTA_READONLY,       /* set at startup */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Number of levels in the table.  Each level has half the samples and\
+ half the harmonics of the one before.  Higher notes play from higher levels\
+ so they do not alias."},
+};
 
+/***************************************************************
+ *   Column definitions for the patches table.  After the index
+ * and name come the voices columns that are part of a patch.
+ * They are filled in at startup by init_patchcols().
+ **************************************************************/
+RTA_COLDEF patchcols[2 + (sizeof(voicecols) / sizeof(RTA_COLDEF))] = {
+    {
+        "patches",          /* the table name */
+        "idx",              /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct PATCH, idx), /* location in struct */
+        RTA_READONLY,       /* set at startup */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Index of the patch.  Put this in the patch column of a voice to play it."},
+    {
+        "patches",          /* the table name */
+        "name",             /* the column name */
+        RTA_STR,            /* it is a string */
+        PATCH_NAME_LEN,     /* number of bytes */
+        offsetof(struct PATCH, name), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "A name for the patch.  Assigned by the UI."},
+};
 
 /***************************************************************
- * set_oXsymmetry(): - Validate a new oscillator value for
- * symmetry.  Valid values are in the range of 0.001 to 0.999.
- * return 1 if error and 0 if valid
- * 
- * Output:       0 if valid
- * Effects:      Oscillator table
- ***************************************************************/
-int set_o1symmetry (
-    char *tbl,          // "voices"
-    char *column,       // "symmetry"
-    char *SQL,          // UI command that changed symmetry
-    void *pr,           // pointer to the new row
-    int row_num,        // zero index of row in table
-    void *poldrow)      // row before any updates
-{
+ *   Column definitions for the allocator table
+ **************************************************************/
+RTA_COLDEF alloccols[] = {
+    {
+        "allocator",        /* the table name */
+        "noteid",           /* the column name */
+        RTA_STR,            /* it is a string */
+        NOTEID_LEN,         /* number of bytes */
+        offsetof(struct ALLOC, noteid), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_allocnote,      /* called after write */
+        "Writing a noteid claims a voice for the note.  The voice is given\
+ the noteid and chordid, set to inuse(1), and its ADSR is reset, so the UI\
+ can set it up with UPDATE voices ... WHERE noteid=... in the same packet.\
+  If no voice can be had voice is set to -1 and fails is counted."},
+    {
+        "allocator",        /* the table name */
+        "chordid",          /* the column name */
+        RTA_STR,            /* it is a string */
+        CHORDID_LEN,        /* number of bytes */
+        offsetof(struct ALLOC, chordid), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Chord ID given to the claimed voice.  Write it in the same UPDATE as\
+ the noteid."},
+    {
+        "allocator",        /* the table name */
+        "policy",           /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct ALLOC, policy), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_allocpolicy,    /* called after write */
+        "Which playing voice to steal when none is free as one of the voice\
+ claimed longest ago(0), the voice with the lowest ADSR gain(1), or none(2)\
+ so the claim fails.  Voices that are inuse but not yet on are never\
+ stolen.  Default is 0."},
+    {
+        "allocator",        /* the table name */
+        "retrigger",        /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct ALLOC, retrigger), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_allocpolicy,    /* called after write */
+        "Set to 1 to give a note the voice it is already playing on rather\
+ than a new one.  Default is 1."},
+    {
+        "allocator",        /* the table name */
+        "voice",            /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct ALLOC, voice), /* location in struct */
+        RTA_READONLY,       /* set by the allocator */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Index of the voice claimed by the last write of noteid."},
+    {
+        "allocator",        /* the table name */
+        "steals",           /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct ALLOC, steals), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Number of playing voices taken for a new note because none was free.\
+  Set to zero to reset."},
+    {
+        "allocator",        /* the table name */
+        "fails",            /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct ALLOC, fails), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Number of noteid writes that found no voice to claim, leaving voice\
+ at -1.  Set to zero to reset."},
+};
+
+/***************************************************************
+ *   Column definitions for the events table
+ **************************************************************/
+RTA_COLDEF eventcols[] = {
+    {
+        "events",           /* the table name */
+        "idx",              /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct VEVENT, idx), /* location in struct */
+        RTA_READONLY,       /* set at startup */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Index of the event row."},
+    {
+        "events",           /* the table name */
+        "state",            /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct VEVENT, state), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_event,          /* called after write */
+        "State of the row as free(0) or queued(1).  Fill in a free row and\
+ set state to 1 in the same UPDATE to queue it.  The row is set back to\
+ free once the event is sent to the render thread.  Set it to 0 to cancel\
+ an event not yet sent."},
+    {
+        "events",           /* the table name */
+        "time",             /* the column name */
+        RTA_LONG,           /* it is a long long */
+        sizeof(llong),      /* number of bytes */
+        offsetof(struct VEVENT, time), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_event,          /* called after write */
+        "The sample at which the change takes effect, on the same count as\
+ samples in the synth table.  Events at the same time take effect together.\
+  An event already past is applied at once."},
+    {
+        "events",           /* the table name */
+        "voice",            /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct VEVENT, voice), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_event,          /* called after write */
+        "Index of the voice to change, or -1 to change every voice with the\
+ chordid given in this row."},
+    {
+        "events",           /* the table name */
+        "chordid",          /* the column name */
+        RTA_STR,            /* it is a string */
+        CHORDID_LEN,        /* number of bytes */
+        offsetof(struct VEVENT, chordid), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_event,          /* called after write */
+        "Chord to change if voice is -1.  The voices are matched when the\
+ event is sent, not when it is queued."},
+    {
+        "events",           /* the table name */
+        "column",           /* the column name */
+        RTA_STR,            /* it is a string */
+        EV_COLUMN_LEN,      /* number of bytes */
+        offsetof(struct VEVENT, column), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_event,          /* called after write */
+        "Name of the voices column to set, such as vstate."},
+    {
+        "events",           /* the table name */
+        "value",            /* the column name */
+        RTA_STR,            /* it is a string */
+        EV_VALUE_LEN,       /* number of bytes */
+        offsetof(struct VEVENT, value), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_event,          /* called after write */
+        "New value of the column as text.  It is checked by the column's own\
+ rules when the event is sent and an event with a bad value is dropped."},
+};
+
+/***************************************************************
+ *   Column definitions for the buses table
+ **************************************************************/
+RTA_COLDEF buscols[] = {
+    {
+        "buses",            /* the table name */
+        "idx",              /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct BUS, idx), /* location in struct */
+        RTA_READONLY,       /* set at init time */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Numeric index of this row in the table."},
+    {
+        "buses",            /* the table name */
+        "gain",             /* the column name */
+        RTA_FLOAT,          /* it is a float */
+        sizeof(float),      /* number of bytes */
+        offsetof(struct BUS, gain), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_busmix,         /* called after write */
+        "Gain of the bus as it is mixed into the main output, 0.0 to 4.0.\
+  Default is 1.0."},
+    {
+        "buses",            /* the table name */
+        "pan",              /* the column name */
+        RTA_FLOAT,          /* it is a float */
+        sizeof(float),      /* number of bytes */
+        offsetof(struct BUS, pan), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_busmix,         /* called after write */
+        "Balance of the bus from -1.0 for left only to 1.0 for right only.\
+  The far side is turned down and the near side is left as is.  Default\
+ is 0.0."},
+};
+
+/***************************************************************
+ *   Column definitions for the streams table
+ **************************************************************/
+RTA_COLDEF streamcols[] = {
+    {
+        "streams",          /* the table name */
+        "idx",              /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct STREAM, idx), /* location in struct */
+        RTA_READONLY,       /* set at init time */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Numeric index of this row in the table."},
+    {
+        "streams",          /* the table name */
+        "fd",               /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct STREAM, fd), /* location in struct */
+        RTA_READONLY,       /* set on connect */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Socket to the subscriber, or -1 if the row is free."},
+    {
+        "streams",          /* the table name */
+        "peer",             /* the column name */
+        RTA_STR,            /* it is a string */
+        STREAM_PEER_LEN,    /* number of bytes */
+        offsetof(struct STREAM, peer), /* location in struct */
+        RTA_READONLY,       /* set on connect */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "IP address and port of the subscriber, or unix."},
+    {
+        "streams",          /* the table name */
+        "bufms",            /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct STREAM, bufms), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_stream,         /* called after write */
+        "Most audio in ms the subscriber may fall behind before the policy\
+ applies, 10 to 5000.  It is kept for the next subscriber to use the row.\
+  Default is 500."},
+    {
+        "streams",          /* the table name */
+        "policy",           /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct STREAM, policy), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_stream,         /* called after write */
+        "What to do with a subscriber that falls bufms behind, skip ahead to\
+ the newest audio(0) or close it(1).  Default is 0."},
+    {
+        "streams",          /* the table name */
+        "bus",              /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct STREAM, bus), /* location in struct */
+        0,                  /* no flags */
+        (int (*)()) 0,      /* called before read */
+        set_stream,         /* called after write */
+        "Bus to send to the subscriber, 0 to 7, or -1 for the main output.\
+  The bus is sent after its gain and pan.  Default is -1."},
+    {
+        "streams",          /* the table name */
+        "sent",             /* the column name */
+        RTA_LONG,           /* it is a long long */
+        sizeof(llong),      /* number of bytes */
+        offsetof(struct STREAM, sent), /* location in struct */
+        RTA_READONLY,       /* counted as sent */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Bytes of audio sent to the subscriber."},
+    {
+        "streams",          /* the table name */
+        "drops",            /* the column name */
+        RTA_LONG,           /* it is a long long */
+        sizeof(llong),      /* number of bytes */
+        offsetof(struct STREAM, drops), /* location in struct */
+        RTA_READONLY,       /* counted on a skip */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Samples the subscriber missed since it fell behind."},
+    {
+        "streams",          /* the table name */
+        "skips",            /* the column name */
+        RTA_INT,            /* it is an integer */
+        sizeof(int),        /* number of bytes */
+        offsetof(struct STREAM, skips), /* location in struct */
+        RTA_READONLY,       /* counted on a skip */
+        (int (*)()) 0,      /* called before read */
+        (int (*)()) 0,      /* called after write */
+        "Times the subscriber fell behind and was skipped ahead."},
+};
+
+/***************************************************************
+ *   We defined all of the data structure (column defintions)
+ * for the tables above.  Now define the tables themselves.
+ **************************************************************/
+RTA_TBLDEF UITables[] = {
+    {
+        "voices",           /* table name */
+        (void *) NULL,      /* address of table, set at startup */
+        sizeof(struct VOICE), /* length of each row */
+        0,                  /* number of rows, set at startup */
+        (void *) NULL,      /* iterator function */
+        (void *) NULL,      /* iterator callback data */
+        (void *) NULL,      /* INSERT callback */
+        (void *) NULL,      /* DELETE callback */
+        voicecols,          /* array of column defs */
+        sizeof(voicecols) / sizeof(RTA_COLDEF), /* number of cols */
+        "",                 /* save file name */
+        "Table of voices and their parameters"},
+    {
+        "synth",            /* table name */
+        &synth,             /* address of table */
+        sizeof(struct SYNTH), /* length of each row */
+        1,                  /* number of rows */
+        (void *) NULL,      /* iterator function */
+        (void *) NULL,      /* iterator callback data */
+        (void *) NULL,      /* INSERT callback */
+        (void *) NULL,      /* DELETE callback */
+        synthcols,          /* array of column defs */
+        sizeof(synthcols) / sizeof(RTA_COLDEF), /* number of cols */
+        "",                 /* save file name */
+        "Settings for the synthesizer render engine"},
+    {
+        "wavetables",       /* table name */
+        (void *) NULL,      /* address of table, set at startup */
+        sizeof(struct WAVETBL), /* length of each row */
+        0,                  /* number of rows, set at startup */
+        (void *) NULL,      /* iterator function */
+        (void *) NULL,      /* iterator callback data */
+        (void *) NULL,      /* INSERT callback */
+        (void *) NULL,      /* DELETE callback */
+        wtablecols,         /* array of column defs */
+        sizeof(wtablecols) / sizeof(RTA_COLDEF), /* number of cols */
+        "",                 /* save file name */
+        "The wavetables in the bank loaded at startup"},
+    {
+        "events",           /* table name */
+        vevents,            /* address of table */
+        sizeof(struct VEVENT), /* length of each row */
+        MX_VEVENTS,         /* number of rows */
+        (void *) NULL,      /* iterator function */
+        (void *) NULL,      /* iterator callback data */
+        (void *) NULL,      /* INSERT callback */
+        (void *) NULL,      /* DELETE callback */
+        eventcols,          /* array of column defs */
+        sizeof(eventcols) / sizeof(RTA_COLDEF), /* number of cols */
+        "",                 /* save file name */
+        "Voice changes scheduled to take effect at a given sample"},
+    {
+        "patches",          /* table name */
+        patches,            /* address of table */
+        sizeof(struct PATCH), /* length of each row */
+        MX_PATCHES,         /* number of rows */
+        (void *) NULL,      /* iterator function */
+        (void *) NULL,      /* iterator callback data */
+        (void *) NULL,      /* INSERT callback */
+        (void *) NULL,      /* DELETE callback */
+        patchcols,          /* array of column defs */
+        0,                  /* number of cols, set at startup */
+        "",                 /* save file name */
+        "Voice sounds ready to copy into a voice"},
+    {
+        "allocator",        /* table name */
+        &allocator,         /* address of table */
+        sizeof(struct ALLOC), /* length of each row */
+        1,                  /* number of rows */
+        (void *) NULL,      /* iterator function */
+        (void *) NULL,      /* iterator callback data */
+        (void *) NULL,      /* INSERT callback */
+        (void *) NULL,      /* DELETE callback */
+        alloccols,          /* array of column defs */
+        sizeof(alloccols) / sizeof(RTA_COLDEF), /* number of cols */
+        "",                 /* save file name */
+        "Claims a voice for a new note"},
+    {
+        "buses",            /* table name */
+        buses,              /* address of table */
+        sizeof(struct BUS), /* length of each row */
+        MX_BUSES,           /* number of rows */
+        (void *) NULL,      /* iterator function */
+        (void *) NULL,      /* iterator callback data */
+        (void *) NULL,      /* INSERT callback */
+        (void *) NULL,      /* DELETE callback */
+        buscols,            /* array of column defs */
+        sizeof(buscols) / sizeof(RTA_COLDEF), /* number of cols */
+        "",                 /* save file name */
+        "Sub-mixes of voices summed into the main output"},
+    {
+        "streams",          /* table name */
+        streams,            /* address of table */
+        sizeof(struct STREAM), /* length of each row */
+        MX_STREAMS,         /* number of rows */
+        (void *) NULL,      /* iterator function */
+        (void *) NULL,      /* iterator callback data */
+        (void *) NULL,      /* INSERT callback */
+        (void *) NULL,      /* DELETE callback */
+        streamcols,         /* array of column defs */
+        sizeof(streamcols) / sizeof(RTA_COLDEF), /* number of cols */
+        "",                 /* save file name */
+        "Programs subscribed to the rendered audio"},
+};
+int      nuitables = (sizeof(UITables) / sizeof(RTA_TBLDEF));
+/*INDENT-ON*/
+
+
+
+/***************************************************************
+ * set_oXsymmetry(): - Validate a new oscillator value for
+ * symmetry.  Valid values are in the range of 0.001 to 0.999.
+ * return 1 if error and 0 if valid
+ * 
+ * Output:       0 if valid
+ * Effects:      Oscillator table
+ ***************************************************************/
+int set_o1symmetry (
+    char *tbl,          // "voices"
+    char *column,       // "symmetry"
+    char *SQL,          // UI command that changed symmetry
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
     struct VOICE *posc;
 
     posc = (struct VOICE *) pr;
@@ -738,6 +1595,8 @@ int set_o1symmetry (
         posc->o1symmetry = 0.01;
     else if (posc->o1symmetry > 0.9991)
         posc->o1symmetry = 0.999;
+    wrote_voicecol(row_num, column);
+    mark_voice(row_num);
     return 0;
 }
 int set_o2symmetry (
@@ -756,6 +1615,8 @@ int set_o2symmetry (
         posc->o2symmetry = 0.01;
     else if (posc->o2symmetry > 0.9991)
         posc->o2symmetry = 0.999;
+    wrote_voicecol(row_num, column);
+    mark_voice(row_num);
     return 0;
 }
 int set_vibsymmetry (
@@ -774,6 +1635,8 @@ int set_vibsymmetry (
         posc->vibsymmetry = 0.01;
     else if (posc->vibsymmetry > 0.9991)
         posc->vibsymmetry = 0.999;
+    wrote_voicecol(row_num, column);
+    mark_voice(row_num);
     return 0;
 }
 int set_tremsymmetry (
@@ -792,13 +1655,16 @@ int set_tremsymmetry (
         posc->tremsymmetry = 0.01;
     else if (posc->tremsymmetry > 0.9991)
         posc->tremsymmetry = 0.999;
+    wrote_voicecol(row_num, column);
+    mark_voice(row_num);
     return 0;
 }
 
 
 /***************************************************************
  * set_XXXXfreq(): - Validate a new oscillator value for
- * frequency.  Valid values are in the range of 0.001 to MX_FREQ
+ * frequency.  Valid values are in the range of 0.001 to MX_FREQ,
+ * which stays below half the sample rate.
  * return 1 if error and 0 if valid
  * 
  * Output:       0 if valid
@@ -821,8 +1687,9 @@ int set_o1freq (
     if (posc->o1freq > MX_FREQ)
         posc->o1freq = MX_FREQ;
 
-    // Valid frequency.  Recompute phasestep
-    posc->o1phasestep = posc->o1freq / SRATE;
+    // Valid frequency.  Recompute phasestep when the command is sent
+    wrote_voicecol(row_num, column);
+    derive_later(row_num, posc, DRV_O1STEP);
     return 0;
 }
 int set_o2freq (
@@ -842,8 +1709,9 @@ int set_o2freq (
     if (posc->o2freq > MX_FREQ)
         posc->o2freq = MX_FREQ;
 
-    // Valid frequency.  Recompute phasestep
-    posc->o2phasestep = posc->o2freq / SRATE;
+    // Valid frequency.  Recompute phasestep when the command is sent
+    wrote_voicecol(row_num, column);
+    derive_later(row_num, posc, DRV_O2STEP);
     return 0;
 }
 int set_vibfreq (
@@ -863,8 +1731,8 @@ int set_vibfreq (
         posc->vibfreq = MX_FREQ;
 
     // Set vibphasestep based on the frequncy
-    // Use float to prevent integer overflow
-    posc->vibphasestep = posc->vibfreq / SRATE;
+    wrote_voicecol(row_num, column);
+    derive_later(row_num, posc, DRV_VIBSTEP);
     return 0;
 }
 int set_tremfreq (
@@ -884,8 +1752,8 @@ int set_tremfreq (
         posc->tremfreq = MX_FREQ;
 
     // Set tremphasestep based on the frequncy
-    // Use float to prevent integer overflow
-    posc->tremphasestep = posc->tremfreq / SRATE;
+    wrote_voicecol(row_num, column);
+    derive_later(row_num, posc, DRV_TREMSTEP);
     return 0;
 }
 
@@ -910,7 +1778,8 @@ int set_vibdepth (
     posc = (struct VOICE *) pr;
 
     // Set o1 max phase offset based on the vibrato depth
-    posc->vibo1phase = posc->vibdepth / SRATE;
+    wrote_voicecol(row_num, column);
+    derive_later(row_num, posc, DRV_VIBDEPTH);
     return 0;
 }
 
@@ -954,68 +1823,134 @@ int get_o2freq (
 
 
 /***************************************************************
- * set_glidefreq(): - Validate a new oscillator value for
- * glidefrequency.  Valid values are in the range of 0.001 to MX_FREQ
- * return 1 if error and 0 if valid
+ * get_phaseacc(): - Convert the fixed-point phases to the 0 to 1
+ * phase accumulator columns.  The render thread keeps each phase
+ * as a 32 bit unsigned integer with 2^32 as one cycle.
  * 
- * Output:       0 if valid
- * Effects:      oscillator glidestep
+ * Output:       0
+ * Effects:      XXXXphaseacc columns
  ***************************************************************/
-int set_glidefreq (
+int get_phaseacc (
     char *tbl,          // "voices"
-    char *column,       // "glidefreq"
-    char *SQL,          // UI command that changed glidefreq
-    void *pr,           // pointer to the new row
-    int row_num,        // zero index of row in table
-    void *poldrow)      // row before any updates
+    char *column,       // "XXXXphaseacc"
+    char *SQL,          // UI command that reads the phase
+    void *pr,           // pointer to the row
+    int row_num)        // zero index of row in table
 {
     struct VOICE *posc;
 
     posc = (struct VOICE *) pr;
-    // Comparing floats is not exactly _exact_
-    if (posc->glidefreq < 0.0099)
-        posc->glidefreq = 0.01;
-    if (posc->glidefreq > MX_FREQ)
-        posc->glidefreq = MX_FREQ;
+    posc->o1phaseacc = (float) (posc->o1phase / (double) PHASE_ONE);
+    posc->o2phaseacc = (float) (posc->o2phase / (double) PHASE_ONE);
+    posc->vibphaseacc = (float) (posc->vibphase / (double) PHASE_ONE);
+    posc->tremphaseacc = (float) (posc->tremphase / (double) PHASE_ONE);
     return 0;
 }
 
 
 /***************************************************************
- * set_glidems(): - Validate a new oscillator value for
- * glide timing.  Valid values are non-negative and less than 10M.
- * Return 1 if error and 0 if valid
+ * set_phaseacc(): - Convert a new phase accumulator value to
+ * fixed point and send it to the render thread.  Whole cycles
+ * are dropped so any value is valid.
  * 
- * Output:       0 if valid
- * Effects:      Oscillator table
+ * Output:       0
+ * Effects:      fixed-point phase, list of changed voices
  ***************************************************************/
-int set_glidems (
+int set_phaseacc (
     char *tbl,          // "voices"
-    char *column,       // "glidems"
-    char *SQL,          // UI command that changed glidems
+    char *column,       // "XXXXphaseacc"
+    char *SQL,          // UI command that changed the phase
     void *pr,           // pointer to the new row
     int row_num,        // zero index of row in table
     void *poldrow)      // row before any updates
 {
     struct VOICE *posc;
+    float   *pacc;      // the column written
+    unsigned *pphase;   // its fixed-point phase
 
     posc = (struct VOICE *) pr;
-    if (posc->glidems < 0)
-        posc->glidems = 0;
-    else if (posc->glidems > 10000000)
-        posc->glidems = 10000000;
-
-    // Set glidecount with the number audio samples in glidems
-    // Use float to prevent integer overflow
-    posc->glidecount = (int)((float)SRATE * (float)posc->glidems / 1000.0);
-
-    // We want to step from the current phasestep to the phasestep
-    // set by glidefrequency in glidecount steps.
-    if (posc->glidecount == 0)
-        posc->glidestep = 0.0;
-    else
-        posc->glidestep = ((posc->glidefreq / SRATE) - posc->o1phasestep) / (float) posc->glidecount;
-    return 0;
+    if (strcmp(column, "o1phaseacc") == 0) {
+        pacc = &posc->o1phaseacc;
+        pphase = &posc->o1phase;
+    }
+    else if (strcmp(column, "o2phaseacc") == 0) {
+        pacc = &posc->o2phaseacc;
+        pphase = &posc->o2phase;
+    }
+    else if (strcmp(column, "vibphaseacc") == 0) {
+        pacc = &posc->vibphaseacc;
+        pphase = &posc->vibphase;
+    }
+    else {
+        pacc = &posc->tremphaseacc;
+        pphase = &posc->tremphase;
+    }
+
+    *pphase = PHASE_FIX(*pacc - floorf(*pacc));
+    force_field(row_num, (char *) pphase - (char *) posc);
+    return 0;
+}
+
+
+/***************************************************************
+ * set_glidefreq(): - Validate a new oscillator value for
+ * glidefrequency.  Valid values are in the range of 0.001 to MX_FREQ,
+ * which stays below half the sample rate.
+ * return 1 if error and 0 if valid
+ * 
+ * Output:       0 if valid
+ * Effects:      oscillator glidestep
+ ***************************************************************/
+int set_glidefreq (
+    char *tbl,          // "voices"
+    char *column,       // "glidefreq"
+    char *SQL,          // UI command that changed glidefreq
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct VOICE *posc;
+
+    posc = (struct VOICE *) pr;
+    // Comparing floats is not exactly _exact_
+    if (posc->glidefreq < 0.0099)
+        posc->glidefreq = 0.01;
+    if (posc->glidefreq > MX_FREQ)
+        posc->glidefreq = MX_FREQ;
+    wrote_voicecol(row_num, column);
+    mark_voice(row_num);
+    return 0;
+}
+
+
+/***************************************************************
+ * set_glidems(): - Validate a new oscillator value for
+ * glide timing.  Valid values are non-negative and less than 10M.
+ * Return 1 if error and 0 if valid
+ * 
+ * Output:       0 if valid
+ * Effects:      Oscillator table
+ ***************************************************************/
+int set_glidems (
+    char *tbl,          // "voices"
+    char *column,       // "glidems"
+    char *SQL,          // UI command that changed glidems
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct VOICE *posc;
+
+    posc = (struct VOICE *) pr;
+    if (posc->glidems < 0)
+        posc->glidems = 0;
+    else if (posc->glidems > 10000000)
+        posc->glidems = 10000000;
+
+    // Glide starts from o1phasestep, so work it out after any new o1freq
+    wrote_voicecol(row_num, column);
+    derive_later(row_num, posc, DRV_GLIDE);
+    return 0;
 }
 
 
@@ -1027,6 +1962,9 @@ int set_glidems (
  * the voice remains on and ADSR is suspended.  Changing from 
  * SUSPEND to ON set the ADSR envelop time to 1 ms effectively 
  * moving the voice to the next state in the ADSR.
+ *  The render thread may have changed the state since our copy
+ * was last synced, so the work that goes with a change of state
+ * is done by voice_newstate() when the render thread applies it.
  * 
  * Output:       0 if valid
  * Effects:      voice state
@@ -1039,63 +1977,41 @@ int set_vstate (
     int row_num,        // zero index of row in table
     void *poldrow)      // row before any updates
 {
-    int    newstate;
-    int    oldstate;
-    struct VOICE *pvoc;
-
-    pvoc = (struct VOICE *) pr;
-    newstate = pvoc->vstate;
-    oldstate = ((struct VOICE *) poldrow)->vstate;
-
-    // If going from OFF to ON, clear the ADSR note timer
-    if ((newstate == VSTATE_ON) && (oldstate == VSTATE_FREE)) {
-        pvoc->ontime = 0;
-        pvoc->adsridx = 0;
-    }
-
-    // if going from SUSTAIN to ON increment to the next step in ADSR
-    else if ((newstate == VSTATE_ON) && (oldstate == VSTATE_SUSTAIN)) {
-        if (pvoc->adsridx == MXADSRSTEP) {
-            // can't go past last step.  Turn voice off.
-            pvoc->vstate = VSTATE_FREE;
-            pvoc->voiceout = 0.0;
-        }
-    }
-
+    force_field(row_num, offsetof(struct VOICE, vstate));
     return 0;
 }
 
 
 /***************************************************************
- * set_flttype(): - Validate and limit the parameters for a filter
- * and compute the filter parameters.
- * We do all filter processing here even though, logically, we should
- * have callbacks for Q, rolloff, and frequencies.
- * 
+ * set_flttype(): - Validate and limit the parameters for a filter.
+ * This is the callback for the type, Q, rolloff, and both cutoff
+ * frequencies.  The coefficients are worked out when the command
+ * is sent, and only for the filter stages the column feeds.
+ *
  * Output:       0 if valid
  * Effects:      filter parameters
  ***************************************************************/
 int set_flttype (
     char *tbl,          // "voices"
-    char *column,       // "flttype
-    char *SQL,          // UI command that changed glidefreq
+    char *column,       // "flttype", "fltQ", "fltrolloff", "fltfreqX"
+    char *SQL,          // UI command that changed the filter
     void *pr,           // pointer to the new row
     int row_num,        // zero index of row in table
     void *poldrow)      // row before any updates
 {
-    float  d, g;                     // to simplify coefficient calculations
     struct VOICE *pvoc;
+    unsigned fields;                 // filter stages to work out
 
     pvoc = (struct VOICE *) pr;
     // Comparing floats is not exactly _exact_
     if (pvoc->fltf1 < 1)             // validate/limit cutoff frequency
         pvoc->fltf1 = 1;
-    else if (pvoc->fltf1 > 20000)
-        pvoc->fltf1 = 20000;
+    else if (pvoc->fltf1 > MX_CUTOFF)
+        pvoc->fltf1 = MX_CUTOFF;
     if (pvoc->fltf2 < 1)
         pvoc->fltf2 = 1;
-    else if (pvoc->fltf2 > 20000)
-        pvoc->fltf2 = 20000;
+    else if (pvoc->fltf2 > MX_CUTOFF)
+        pvoc->fltf2 = MX_CUTOFF;
     if (pvoc->fltq < 0.1)          // validate/limit filter Q factor
         pvoc->fltq = 0.1;
     else if (pvoc->fltq > 25.0)
@@ -1106,13 +2022,118 @@ int set_flttype (
         pvoc->fltrolloff = 12;
     pvoc->fltrolloff = 6 * (pvoc->fltrolloff / 6);  // forces value to 6 or 12
 
-    // Just return if off
+    // The second cutoff and the rolloff only change filter #2
+    if ((strcmp(column, "fltfreq2") == 0) || (strcmp(column, "fltrolloff") == 0))
+        fields = DRV_FLT2;
+    else if (strcmp(column, "fltfreq1") == 0)
+        fields = DRV_FLT1;
+    else
+        fields = DRV_FLT1 | DRV_FLT2;
+    wrote_voicecol(row_num, column);
+    derive_later(row_num, pvoc, fields);
+    return 0;
+}
+
+
+/***************************************************************
+ * derive_voice(): - Work out the fields of a voice that come from
+ * its columns, the phase steps, glide, and filter coefficients.
+ * The write callbacks only say which fields need it so a command
+ * that writes several columns does the work once.  This is called
+ * from commit_voices() before the voice is sent.
+ *
+ * Input:        voice index or -1 for a patch, the voice, and
+ *               the DRV_ fields to work out
+ * Output:
+ * Effects:      derived fields of the voice
+ ***************************************************************/
+void derive_voice (
+    int v,              // index of voice, -1 if not in voices[]
+    struct VOICE *pvoc, // the voice to work on
+    unsigned fields)    // DRV_ fields to work out
+{
+    // Glide changes o1phasestep so always send it
+    if (fields & DRV_O1STEP) {
+        pvoc->o1phasestep = pvoc->o1freq / SRATE;
+        force_field(v, offsetof(struct VOICE, o1phasestep));
+    }
+    if (fields & DRV_O2STEP)
+        pvoc->o2phasestep = pvoc->o2freq / SRATE;
+    if (fields & DRV_VIBSTEP)
+        pvoc->vibphasestep = pvoc->vibfreq / SRATE;
+    if (fields & DRV_TREMSTEP)
+        pvoc->tremphasestep = pvoc->tremfreq / SRATE;
+    if (fields & DRV_VIBDEPTH)
+        pvoc->vibo1phase = pvoc->vibdepth / SRATE;
+
+    if (fields & DRV_GLIDE) {
+        // Set glidecount with the number audio samples in glidems
+        // Use float to prevent integer overflow
+        pvoc->glidecount = (int)((float)SRATE * (float)pvoc->glidems / 1000.0);
+
+        // We want to step from the current phasestep to the phasestep
+        // set by glidefrequency in glidecount steps.
+        if (pvoc->glidecount == 0)
+            pvoc->glidestep = 0.0;
+        else
+            pvoc->glidestep = ((pvoc->glidefreq / SRATE) - pvoc->o1phasestep) / (float) pvoc->glidecount;
+
+        // The render thread counts these down so always send them
+        force_field(v, offsetof(struct VOICE, glidems));
+        force_field(v, offsetof(struct VOICE, glidecount));
+        force_field(v, offsetof(struct VOICE, glidestep));
+    }
+
+    // Nothing to work out if the filter is off
     if (pvoc->flttype == FILT_OFF)
-        return 0;
+        return;
+    if (fields & DRV_FLT1)
+        derive_flt1(pvoc);
+    // Filter #2 is a copy of filter #1 for 12 dB low and high pass filters
+    if ((fields & DRV_FLT2) || ((fields & DRV_FLT1) && (pvoc->fltrolloff == 12) &&
+        ((pvoc->flttype == FILT_LOW) || (pvoc->flttype == FILT_HIGH))))
+        derive_flt2(pvoc);
+}
+
 
-    // Computer the digital filter coefficients based on type, freq, rolloff, and Q
-    // Filter #1 is low pass for low-pass and band-stop filters.  
-    g = tan(M_PI * pvoc->fltf1 / (float) SRATE);
+/***************************************************************
+ * derive_later(): - Ask for derived fields to be worked out when
+ * the command is sent.  A patch is not sent so its fields are
+ * worked out at once.
+ *
+ * Input:        row of the voices table or -1, the voice, and
+ *               the DRV_ fields to work out
+ * Output:
+ * Effects:      derived fields mask or the derived fields
+ ***************************************************************/
+static void derive_later (
+    int row,            // index of voice, -1 if not in voices[]
+    struct VOICE *pvoc, // the voice written
+    unsigned fields)    // DRV_ fields to work out
+{
+    if (row < 0)
+        derive_voice(row, pvoc, fields);
+    else
+        mark_derived(row, fields);
+}
+
+
+/***************************************************************
+ * derive_flt1(): - Compute the coefficients of filter #1 from
+ * the type, cutoff, and Q.  Filter #1 is low pass for low-pass
+ * and band-stop filters and high pass for the others.
+ * filt_warp(f) is tan(M_PI * f / SRATE) from a table.
+ *
+ * Input:        the voice
+ * Output:
+ * Effects:      filter #1 coefficients
+ ***************************************************************/
+static void derive_flt1 (
+    struct VOICE *pvoc) // the voice to work on
+{
+    float  d, g;                     // to simplify coefficient calculations
+
+    g = filt_warp(pvoc->fltf1);
     d = (pvoc->fltq * g * g) + g + pvoc->fltq;
     if ((pvoc->flttype == FILT_LOW) || (pvoc->flttype == FILT_STOP)) {
         pvoc->flt1b0 = pvoc->fltq * g * g / d;
@@ -1129,7 +2150,24 @@ int set_flttype (
         pvoc->flt1a1 = 2 * pvoc->fltq * ((g * g) -1) / d;
         pvoc->flt1a2 = ((pvoc->fltq * g * g) - g + pvoc->fltq) / d;
     }
-    // Filter #2 is identical to filter #1 for 12 dB low and high pass filters
+}
+
+
+/***************************************************************
+ * derive_flt2(): - Compute the coefficients of filter #2.  It is
+ * a copy of filter #1 for 12 dB low and high pass filters, low
+ * pass for band pass, and high pass for band-stop.  Filter #1
+ * must already be worked out.
+ *
+ * Input:        the voice
+ * Output:
+ * Effects:      filter #2 coefficients
+ ***************************************************************/
+static void derive_flt2 (
+    struct VOICE *pvoc) // the voice to work on
+{
+    float  d, g;                     // to simplify coefficient calculations
+
     if (((pvoc->flttype == FILT_LOW) || (pvoc->flttype == FILT_HIGH)) && (pvoc->fltrolloff == 12)) {
         pvoc->fltf2 = pvoc->fltf1;
         pvoc->flt2b0 = pvoc->flt1b0;
@@ -1138,9 +2176,8 @@ int set_flttype (
         pvoc->flt2a1 = pvoc->flt1a1;
         pvoc->flt2a2 = pvoc->flt1a2;
     }
-    // Filter #2 is low pass for band pass, and high pass for band-stop.
     else if (pvoc->flttype == FILT_BAND) {
-        g = tan(M_PI * pvoc->fltf2 / (float) SRATE);
+        g = filt_warp(pvoc->fltf2);
         d = (pvoc->fltq * g * g) + g + pvoc->fltq;
         pvoc->flt2b0 = pvoc->fltq * g * g / d;
         pvoc->flt2b1 = 2 * pvoc->flt2b0;
@@ -1149,7 +2186,7 @@ int set_flttype (
         pvoc->flt2a2 = ((pvoc->fltq * g * g) - g + pvoc->fltq) / d;
     }
     else if (pvoc->flttype == FILT_STOP) {
-        g = tan(M_PI * pvoc->fltf2 / (float) SRATE);
+        g = filt_warp(pvoc->fltf2);
         d = (pvoc->fltq * g * g) + g + pvoc->fltq;
         pvoc->flt2b0 = pvoc->fltq / d;
         pvoc->flt2b1 = -2 * pvoc->flt2b0;
@@ -1157,8 +2194,805 @@ int set_flttype (
         pvoc->flt2a1 = 2 * pvoc->fltq * ((g * g) -1) / d;
         pvoc->flt2a2 = ((pvoc->fltq * g * g) - g + pvoc->fltq) / d;
     }
+}
+
+
+/***************************************************************
+ * set_blocksize(): - Limit the render block size to the range
+ * of 1 to MX_BLOCK samples.
+ * 
+ * Output:       0 if valid
+ * Effects:      block size used by do_synth()
+ ***************************************************************/
+int set_blocksize (
+    char *tbl,          // "synth"
+    char *column,       // "blocksize"
+    char *SQL,          // UI command that changed blocksize
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct SYNTH *psyn;
+
+    psyn = (struct SYNTH *) pr;
+    if (psyn->blocksize < 1)
+        psyn->blocksize = 1;
+    else if (psyn->blocksize > MX_BLOCK)
+        psyn->blocksize = MX_BLOCK;
+    return 0;
+}
+
+
+/***************************************************************
+ * set_rendermode(): - Select the block or reference renderer.
+ * Return 1 if the mode is not one we know.
+ * 
+ * Output:       0 if valid
+ * Effects:      renderer used by do_synth()
+ ***************************************************************/
+int set_rendermode (
+    char *tbl,          // "synth"
+    char *column,       // "rendermode"
+    char *SQL,          // UI command that changed rendermode
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct SYNTH *psyn;
+
+    psyn = (struct SYNTH *) pr;
+    if ((psyn->rendermode != RENDER_BLOCK) && (psyn->rendermode != RENDER_REF))
+        return 1;
+    return 0;
+}
+
+
+/***************************************************************
+ * set_flushsize(): - Limit the number of samples to buffer
+ * before writing to the range of 1 to MX_FLUSH.
+ * 
+ * Output:       0 if valid
+ * Effects:      how often the output buffer is written
+ ***************************************************************/
+int set_flushsize (
+    char *tbl,          // "synth"
+    char *column,       // "flushsize"
+    char *SQL,          // UI command that changed flushsize
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct SYNTH *psyn;
+
+    psyn = (struct SYNTH *) pr;
+    if (psyn->flushsize < 1)
+        psyn->flushsize = 1;
+    else if (psyn->flushsize > MX_FLUSH)
+        psyn->flushsize = MX_FLUSH;
+    return 0;
+}
+
+
+/***************************************************************
+ * set_maxcatchup(): - Limit the number of late samples to render
+ * in one pass to the range of 1 to MX_CATCHUPMS of samples at
+ * the sample rate.
+ * 
+ * Output:       0 if valid
+ * Effects:      how far do_synth() will catch up after a stall
+ ***************************************************************/
+int set_maxcatchup (
+    char *tbl,          // "synth"
+    char *column,       // "maxcatchup"
+    char *SQL,          // UI command that changed maxcatchup
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct SYNTH *psyn;
+
+    psyn = (struct SYNTH *) pr;
+    if (psyn->maxcatchup < 1)
+        psyn->maxcatchup = 1;
+    else if (psyn->maxcatchup > (MX_CATCHUPMS * psyn->srate / 1000))
+        psyn->maxcatchup = MX_CATCHUPMS * psyn->srate / 1000;
+    return 0;
+}
+
+
+/***************************************************************
+ * set_voicefield(): - Note that a voice column was written so
+ * the change is sent to the render thread.  This is the write
+ * callback for voice columns that need no validation.
+ * 
+ * Output:       0
+ * Effects:      list of changed voices
+ ***************************************************************/
+int set_voicefield (
+    char *tbl,          // "voices"
+    char *column,       // the column written
+    char *SQL,          // UI command that changed the column
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    wrote_voicecol(row_num, column);
+    mark_voice(row_num);
+    return 0;
+}
+
+
+/***************************************************************
+ * set_dynfield(): - Send a column that the render thread also
+ * changes, such as ontime or a phase accumulator.  It is sent
+ * even if the value looks unchanged since our copy of it may
+ * be out of date.
+ * 
+ * Output:       0
+ * Effects:      list of changed voices
+ ***************************************************************/
+int set_dynfield (
+    char *tbl,          // "voices"
+    char *column,       // the column written
+    char *SQL,          // UI command that changed the column
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    int    i;
+
+    for (i = 0; i < (int) (sizeof(voicecols) / sizeof(RTA_COLDEF)); i++) {
+        if (strcmp(column, voicecols[i].name) == 0) {
+            force_field(row_num, voicecols[i].offset);
+            break;
+        }
+    }
+    return 0;
+}
+
+
+/***************************************************************
+ * set_osckernel(): - Select the oscillator waveform kernel.
+ * Return 1 if the CPU can not run the kernel.
+ * 
+ * Output:       0 if valid
+ * Effects:      kernel used by osc_wave()
+ ***************************************************************/
+int set_osckernel (
+    char *tbl,          // "synth"
+    char *column,       // "osckernel"
+    char *SQL,          // UI command that changed osckernel
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct SYNTH *psyn;
+
+    psyn = (struct SYNTH *) pr;
+    if (osc_supported(psyn->osckernel) == 0)
+        return 1;
+    return 0;
+}
+
+
+/***************************************************************
+ * set_oXwtable(): - Validate a wavetable index.  Return 1 if
+ * there is no such table in the bank.  Zero is always accepted
+ * so a voice can be reset when there is no bank.
+ * 
+ * Output:       0 if valid
+ * Effects:      wavetable played by the oscillator
+ ***************************************************************/
+int set_o1wtable (
+    char *tbl,          // "voices"
+    char *column,       // "o1wtable"
+    char *SQL,          // UI command that changed o1wtable
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct VOICE *posc;
+
+    posc = (struct VOICE *) pr;
+    if ((posc->o1wtable != 0) &&
+        ((posc->o1wtable < 0) || (posc->o1wtable >= synth.nwtables)))
+        return 1;
+    wrote_voicecol(row_num, column);
+    mark_voice(row_num);
+    return 0;
+}
+int set_o2wtable (
+    char *tbl,          // "voices"
+    char *column,       // "o2wtable"
+    char *SQL,          // UI command that changed o2wtable
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct VOICE *posc;
+
+    posc = (struct VOICE *) pr;
+    if ((posc->o2wtable != 0) &&
+        ((posc->o2wtable < 0) || (posc->o2wtable >= synth.nwtables)))
+        return 1;
+    wrote_voicecol(row_num, column);
+    mark_voice(row_num);
+    return 0;
+}
+
+
+/***************************************************************
+ * set_wtinterp(): - Validate the wavetable interpolation.
+ * Return 1 if it is not none, linear, or cubic.
+ * 
+ * Output:       0 if valid
+ * Effects:      interpolation used by wavetable oscillators
+ ***************************************************************/
+int set_wtinterp (
+    char *tbl,          // "synth"
+    char *column,       // "wtinterp"
+    char *SQL,          // UI command that changed wtinterp
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct SYNTH *psyn;
+
+    psyn = (struct SYNTH *) pr;
+    if ((psyn->wtinterp < WTINTERP_NONE) || (psyn->wtinterp > WTINTERP_CUBIC))
+        return 1;
+    return 0;
+}
+
+
+/***************************************************************
+ * set_sinemode(): - Validate the sine mode.  Return 1 if it is
+ * not quarter, table, or poly.
+ * 
+ * Output:       0 if valid
+ * Effects:      how osc_sine() and the kernels compute a sine
+ ***************************************************************/
+int set_sinemode (
+    char *tbl,          // "synth"
+    char *column,       // "sinemode"
+    char *SQL,          // UI command that changed sinemode
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct SYNTH *psyn;
+
+    psyn = (struct SYNTH *) pr;
+    if ((psyn->sinemode < SINE_QUARTER) || (psyn->sinemode > SINE_POLY))
+        return 1;
+    return 0;
+}
+
+
+/***************************************************************
+ * set_fltsmooth(): - Validate the filter ramp time.  Return 1
+ * if it is less than zero or more than MX_FLTSMOOTH ms.
+ * 
+ * Output:       0 if valid
+ * Effects:      length of the ramps that filt_retarget() starts
+ ***************************************************************/
+int set_fltsmooth (
+    char *tbl,          // "synth"
+    char *column,       // "fltsmooth"
+    char *SQL,          // UI command that changed fltsmooth
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct SYNTH *psyn;
+
+    psyn = (struct SYNTH *) pr;
+    if ((psyn->fltsmooth < 0) || (psyn->fltsmooth > MX_FLTSMOOTH))
+        return 1;
+    return 0;
+}
+
+
+/***************************************************************
+ * set_envcurve(): - Validate the ADSR step shape.  Return 1 if
+ * it is not linear or exponential.
+ * 
+ * Output:       0 if valid
+ * Effects:      shape of the voice's ADSR steps
+ ***************************************************************/
+int set_envcurve (
+    char *tbl,          // "voices"
+    char *column,       // "envcurve"
+    char *SQL,          // UI command that changed envcurve
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct VOICE *pvoc;
+
+    pvoc = (struct VOICE *) pr;
+    if ((pvoc->envcurve < ENV_LINEAR) || (pvoc->envcurve > ENV_EXP))
+        return 1;
+    wrote_voicecol(row_num, column);
+    mark_voice(row_num);
+    return 0;
+}
+
+
+/***************************************************************
+ * set_evlead(): - Validate how far ahead scheduled events are
+ * sent.  Return 1 if it is out of range.
+ * 
+ * Output:       0 if valid
+ * Effects:      when run_events() sends an event
+ ***************************************************************/
+int set_evlead (
+    char *tbl,          // "synth"
+    char *column,       // "evlead"
+    char *SQL,          // UI command that changed evlead
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct SYNTH *psyn;
+
+    psyn = (struct SYNTH *) pr;
+    if ((psyn->evlead < 1) || (psyn->evlead > MX_EVLEAD))
+        return 1;
+    return 0;
+}
+
+
+/***************************************************************
+ * set_event(): - Queue or cancel a scheduled event.  A queued
+ * row must name a voice or a chord, a time that is not negative,
+ * and a voices column that can be written with a value of the
+ * right type.  Every column of the row has this callback and
+ * each call checks the whole row, so a row changed while it is
+ * queued is moved to its new time.
+ * 
+ * Output:       0 if valid
+ * Effects:      event heap
+ ***************************************************************/
+int set_event (
+    char *tbl,          // "events"
+    char *column,       // the column written
+    char *SQL,          // UI command that changed the column
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct VEVENT *pev;
+
+    pev = (struct VEVENT *) pr;
+    if (pev->state == EV_FREE) {
+        ev_cancel(row_num);
+        return 0;
+    }
+    if (pev->state != EV_QUEUED)
+        return 1;
+    if ((pev->voice < -1) || (pev->voice >= synth.nvoices))
+        return 1;
+    if ((pev->voice == -1) && (pev->chordid[0] == (char) 0))
+        return 1;
+    if (pev->time < 0)
+        return 1;
+    if (check_voicecol(pev->column, pev->value))
+        return 1;
+    ev_queue(row_num);
+    return 0;
+}
+
 
+/***************************************************************
+ * write_voicecol(): - Set a column of a voice from its value as
+ * text, as an UPDATE would.  The column's write callback checks
+ * the new value and does its usual work.  If it fails the voice
+ * is left as it was.  This is how scheduled events are applied.
+ * 
+ * Input:        voice index, column name, value as text
+ * Output:       0 if the column was set
+ * Effects:      voices[] and the list of changed voices
+ ***************************************************************/
+int write_voicecol (
+    int   v,            // index of the voice
+    char *column,       // name of the voices column
+    char *value)        // new value as text
+{
+    struct VOICE old;   // voice before the change
+    RTA_COLDEF *pcol;
+
+    pcol = find_voicecol(column);
+    if ((pcol == (RTA_COLDEF *) NULL) || (pcol->flags & RTA_READONLY))
+        return 1;
+    old = voices[v];
+    if (parse_voicecol(pcol, value, &voices[v]) ||
+        (pcol->writecb && pcol->writecb("voices", pcol->name, "", &voices[v], v, &old))) {
+        voices[v] = old;
+        return 1;
+    }
+    mark_voice(v);
     return 0;
 }
 
 
+/***************************************************************
+ * check_voicecol(): - Return 1 if a scheduled event could not
+ * set the column to the value given.  The column must exist and
+ * be writable, and the value must be of the column's type.  The
+ * range of the value is checked when the event is sent.
+ * 
+ * Output:       0 if valid
+ * Effects:
+ ***************************************************************/
+static int check_voicecol (
+    char *column,       // name of the voices column
+    char *value)        // new value as text
+{
+    struct VOICE scratch; // somewhere to parse the value into
+    RTA_COLDEF *pcol;
+
+    pcol = find_voicecol(column);
+    if ((pcol == (RTA_COLDEF *) NULL) || (pcol->flags & RTA_READONLY))
+        return 1;
+    return (parse_voicecol(pcol, value, &scratch));
+}
+
+
+/***************************************************************
+ * find_voicecol(): - Look up a column of the voices table by
+ * name.
+ * 
+ * Output:       the column definition or NULL
+ * Effects:
+ ***************************************************************/
+static RTA_COLDEF *find_voicecol (
+    char *column)       // name of the voices column
+{
+    int    i;
+
+    for (i = 0; i < (int) (sizeof(voicecols) / sizeof(RTA_COLDEF)); i++) {
+        if (strncmp(column, voicecols[i].name, EV_COLUMN_LEN) == 0)
+            return (&voicecols[i]);
+    }
+    return ((RTA_COLDEF *) NULL);
+}
+
+
+/***************************************************************
+ * wrote_voicecol(): - Note that a command wrote a column of a
+ * voice so a patch set by the same command leaves it alone.
+ * Nothing is noted for the voice in a patch, whose row is -1.
+ * 
+ * Output:
+ * Effects:      written bitmap for the voice
+ ***************************************************************/
+static void wrote_voicecol (
+    int   row,          // index of the voice, -1 for a patch
+    char *column)       // name of the voices column
+{
+    RTA_COLDEF *pcol;
+
+    if (row < 0)
+        return;
+    pcol = find_voicecol(column);
+    if (pcol != (RTA_COLDEF *) NULL)
+        mark_written(row, pcol->offset);
+}
+
+
+/***************************************************************
+ * parse_voicecol(): - Convert a value given as text to the type
+ * of a voices column and put it in a voice.  Return 1 if it is
+ * not a number or is too long for the column.
+ * 
+ * Output:       0 if valid
+ * Effects:      the column in *pvoc
+ ***************************************************************/
+static int parse_voicecol (
+    RTA_COLDEF *pcol,   // the column to set
+    char *value,        // new value as text
+    struct VOICE *pvoc) // voice to put it in
+{
+    char  *pfield;      // the column in the voice
+    char  *end;         // first character not converted
+    long   l;
+    float  f;
+
+    pfield = (char *) pvoc + pcol->offset;
+    switch (pcol->type) {
+    case RTA_INT:
+        l = strtol(value, &end, 0);
+        if ((end == value) || (*end != (char) 0))
+            return 1;
+        *(int *) pfield = (int) l;
+        return 0;
+    case RTA_FLOAT:
+        f = strtof(value, &end);
+        if ((end == value) || (*end != (char) 0))
+            return 1;
+        *(float *) pfield = f;
+        return 0;
+    case RTA_STR:
+        if (strnlen(value, EV_VALUE_LEN) >= (size_t) pcol->length)
+            return 1;
+        strncpy(pfield, value, pcol->length);
+        return 0;
+    }
+    return 1;
+}
+
+
+/***************************************************************
+ * set_phasereset(): - Validate the phase reset flag.  Return 1
+ * if it is not 0 or 1.
+ * 
+ * Output:       0 if valid
+ * Effects:      whether a new note starts its phases at zero
+ ***************************************************************/
+int set_phasereset (
+    char *tbl,          // "voices"
+    char *column,       // "phasereset"
+    char *SQL,          // UI command that changed phasereset
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct VOICE *pvoc;
+
+    pvoc = (struct VOICE *) pr;
+    if ((pvoc->phasereset != 0) && (pvoc->phasereset != 1))
+        return 1;
+    wrote_voicecol(row_num, column);
+    mark_voice(row_num);
+    return 0;
+}
+
+
+/***************************************************************
+ * set_allocnote(): - Claim a voice for the noteid just written.
+ * Return 1 if the row is not valid.  Finding no voice is not an
+ * error.  The write stands so the row keeps voice at -1, which
+ * librta would undo by putting back the old row, and the failed
+ * claim is counted.
+ * 
+ * Output:       0 if the row is valid
+ * Effects:      voices[] and the list of changed voices
+ ***************************************************************/
+int set_allocnote (
+    char *tbl,          // "allocator"
+    char *column,       // "noteid"
+    char *SQL,          // UI command that wrote noteid
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct ALLOC *pal;
+
+    pal = (struct ALLOC *) pr;
+    if ((pal->policy < STEAL_OLDEST) || (pal->policy > STEAL_NONE) ||
+        (pal->retrigger < 0) || (pal->retrigger > 1))
+        return 1;
+    if (pal->noteid[0] == (char) 0)
+        return 1;
+    if (alloc_voice(pal) != 0)
+        pal->fails++;
+    return 0;
+}
+
+
+/***************************************************************
+ * set_allocpolicy(): - Validate the stealing policy and the
+ * retrigger flag.  Return 1 if either is out of range.
+ * 
+ * Output:       0 if valid
+ * Effects:      which voice the allocator picks
+ ***************************************************************/
+int set_allocpolicy (
+    char *tbl,          // "allocator"
+    char *column,       // "policy" or "retrigger"
+    char *SQL,          // UI command that changed the column
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct ALLOC *pal;
+
+    pal = (struct ALLOC *) pr;
+    if ((pal->policy < STEAL_OLDEST) || (pal->policy > STEAL_NONE))
+        return 1;
+    if ((pal->retrigger < 0) || (pal->retrigger > 1))
+        return 1;
+    return 0;
+}
+
+
+/***************************************************************
+ * set_stream(): - Validate how far an audio stream subscriber
+ * may fall behind, what to do when it does, and the bus it is
+ * sent.  Return 1 if any is out of range.  A subscriber moved to
+ * another bus starts with the next block of that bus.
+ * 
+ * Output:       0 if valid
+ * Effects:      buffering and source of the subscriber
+ ***************************************************************/
+int set_stream (
+    char *tbl,          // "streams"
+    char *column,       // "bufms", "policy", or "bus"
+    char *SQL,          // UI command that changed the column
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct STREAM *ps;
+
+    ps = (struct STREAM *) pr;
+    if ((ps->bufms < MN_STRBUFMS) || (ps->bufms > MX_STRBUFMS))
+        return 1;
+    if ((ps->policy < STR_SKIP) || (ps->policy > STR_CLOSE))
+        return 1;
+    if ((ps->bus < -1) || (ps->bus >= MX_BUSES))
+        return 1;
+    return (str_setbus(row_num, ((struct STREAM *) poldrow)->bus));
+}
+
+
+/***************************************************************
+ * set_voicebus(): - Validate the output bus of a voice.  Return
+ * 1 if there is no such bus.
+ * 
+ * Output:       0 if valid
+ * Effects:      the bus the voice is mixed into
+ ***************************************************************/
+int set_voicebus (
+    char *tbl,          // "voices"
+    char *column,       // "bus"
+    char *SQL,          // UI command that changed bus
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct VOICE *pvoc;
+
+    pvoc = (struct VOICE *) pr;
+    if ((pvoc->bus < 0) || (pvoc->bus >= MX_BUSES))
+        return 1;
+    wrote_voicecol(row_num, column);
+    mark_voice(row_num);
+    return 0;
+}
+
+
+/***************************************************************
+ * set_busmix(): - Validate the gain and pan of a bus and work
+ * out the gain of each side.  Return 1 if either is out of
+ * range.  The render thread reads gainl and gainr once a block
+ * so a new mix takes effect at the next block.
+ * 
+ * Output:       0 if valid
+ * Effects:      the mix of the bus into the main output
+ ***************************************************************/
+int set_busmix (
+    char *tbl,          // "buses"
+    char *column,       // "gain" or "pan"
+    char *SQL,          // UI command that changed the column
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct BUS *pbus;
+
+    pbus = (struct BUS *) pr;
+    if ((pbus->gain < 0.0) || (pbus->gain > MX_BUSGAIN))
+        return 1;
+    if ((pbus->pan < -1.0) || (pbus->pan > 1.0))
+        return 1;
+    pbus->gainl = pbus->gain * ((pbus->pan > 0.0) ? (1.0 - pbus->pan) : 1.0);
+    pbus->gainr = pbus->gain * ((pbus->pan < 0.0) ? (1.0 + pbus->pan) : 1.0);
+    return 0;
+}
+
+
+/***************************************************************
+ * set_patch(): - Have a patch copied into the voice when the
+ * command is sent.  Return 1 if there is no such patch.
+ * 
+ * Output:       0 if valid
+ * Effects:      voices[] and the list of changed voices
+ ***************************************************************/
+int set_patch (
+    char *tbl,          // "voices"
+    char *column,       // "patch"
+    char *SQL,          // UI command that wrote patch
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    struct VOICE *pvoc;
+
+    pvoc = (struct VOICE *) pr;
+    if ((pvoc->patch < 0) || (pvoc->patch >= MX_PATCHES))
+        return 1;
+    mark_patch(row_num, pvoc->patch);
+    return 0;
+}
+
+
+/***************************************************************
+ * init_patchcols(): - Fill in the patches table columns from
+ * the voices columns that are part of a patch.  They keep their
+ * names, types, and help, and point into the voice in the patch.
+ * Their callbacks go through get_patchfield() and
+ * set_patchfield() to the voices column callbacks.
+ * 
+ * Output:       number of columns in the patches table
+ * Effects:      patchcols[]
+ ***************************************************************/
+int init_patchcols ()
+{
+    RTA_COLDEF *pcol;
+    int    ncol;
+    int    i;
+
+    ncol = 2;           // idx and name
+    for (i = 0; i < (int) (sizeof(voicecols) / sizeof(RTA_COLDEF)); i++) {
+        if ((voicecols[i].flags & RTA_READONLY) || !patch_field(voicecols[i].offset))
+            continue;
+        pcol = &patchcols[ncol++];
+        *pcol = voicecols[i];
+        pcol->table = "patches";
+        pcol->offset += offsetof(struct PATCH, voice);
+        if (voicecols[i].readcb)
+            pcol->readcb = get_patchfield;
+        if (voicecols[i].writecb)
+            pcol->writecb = set_patchfield;
+    }
+    return (ncol);
+}
+
+
+/***************************************************************
+ * get_patchfield(): - Run the voices column read callback on
+ * the voice in a patch.
+ * 
+ * Output:       what the voices column callback returns
+ * Effects:      the voice in the patch
+ ***************************************************************/
+int get_patchfield (
+    char *tbl,          // "patches"
+    char *column,       // the column read
+    char *SQL,          // UI command that reads the column
+    void *pr,           // pointer to the row
+    int row_num)        // zero index of row in table
+{
+    RTA_COLDEF *pcol;
+
+    pcol = find_voicecol(column);
+    return (pcol->readcb(tbl, column, SQL, &((struct PATCH *) pr)->voice, -1));
+}
+
+
+/***************************************************************
+ * set_patchfield(): - Run the voices column write callback on
+ * the voice in a patch.  It checks the value and works out the
+ * phase steps or filter coefficients as it does for a voice.
+ * The voice index given to it is -1 so nothing is sent to the
+ * render thread.
+ * 
+ * Output:       what the voices column callback returns
+ * Effects:      the voice in the patch
+ ***************************************************************/
+int set_patchfield (
+    char *tbl,          // "patches"
+    char *column,       // the column written
+    char *SQL,          // UI command that changed the column
+    void *pr,           // pointer to the new row
+    int row_num,        // zero index of row in table
+    void *poldrow)      // row before any updates
+{
+    RTA_COLDEF *pcol;
+
+    pcol = find_voicecol(column);
+    return (pcol->writecb(tbl, column, SQL, &((struct PATCH *) pr)->voice, -1,
+        &((struct PATCH *) poldrow)->voice));
+}
@@ -16,80 +16,232 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
 #include <unistd.h>
-#include <sys/time.h>
+#include <time.h>
 #include <stdint.h>
 #include <math.h>
+#include <pthread.h>
 #include "sqlizer.h"
 
 
 /***************************************************************************
  *  - Limits and defines
  ***************************************************************************/
-#define  FULLVOLUME ((1 << 15) -1)
-#define  NSINES     1000
-#define  LFSRINIT   0x11111111   // any non-zero value is good random seed
+#define  LFSRINIT   0x11111111   // any non-zero value is good random seed.  Plus voice index.
 #define  LFSRPOLY   0x46000000   // polynomial coefficients for lfsr
+#define  NSPERSEC   1000000000   // nanoseconds in a second
+#define  NVWORDS    (sizeof(struct VOICE) / sizeof(uint32_t))
+#define  ENV_KILL   (-2)         // env_enter() found the note is over
+#define  ENV_SUSTAIN (-3)        // env_enter() found a sustain step
+#define  ENV_SHAPE  4.0          // time constants in an exponential ADSR step
+#define  HOTARRAY(hoff)  (*(uint32_t **) ((char *) &hot + (hoff))) // hot array as words
 
 
 /***************************************************************************
  *  - Function prototypes and external references
  ***************************************************************************/
-void   init_synth();
+void   init_synth(int nvoices, int srate);
 void   do_synth();
 void   do_voice(int v);
-extern struct VOICE voices[VOICE_COUNT];
+void   voice_newstate(struct VOICE *pvoc, int oldstate);
+void   hot_load(int v);
+void   hot_save(int v);
+uint32_t *hot_word(int v, int offset);
+void   update_active(int v);
+int    filt_retarget(int v, int offset, uint32_t value);
+void   init_workers(int nworkers);
+void  *voice_worker(void *arg);
+static void run_tasks();
+static void render_ref(int nsamp);
+static void render_block(int nsamp);
+static void mix_buses(int nsamp);
+static void build_tasks();
+static int  do_voice_block(int v, int nsamp, float *vout, float *env, int *pnlive, int *pkilled);
+static void end_voice_block(int v, int nsamp, float *vout, float *env, int nlive, int killed);
+static int  env_block(int v, int nsamp, float *env, int *pkilled);
+static int  env_enter(struct VOICE *pvoc, int adsridx, int ontime, float *pgain,
+                float *pmul, float *padd);
+static void osc_block(int type, int wtable, float phasestep, unsigned *pphase,
+                float symmetry, float phaseoffset, uint32_t *noise, float *out,
+                int *sync, int nsamp);
+static void filt_voices(int *idx, int *nlive, int n);
+static void *hot_alloc(int nvoices);
+extern void init_osc();
+extern void init_filt();
+extern void osc_wave(int type, float *out, float *dt, uint32_t *noise, int nsamp);
+extern float osc_bl(int type, float phout, float dt);
+extern float osc_sine(float phout);
+extern void wt_wave(int tbl, float *out, float *dt, int nsamp);
+extern void filt_group(struct FILTGROUP *pg);
+extern void flush_denormals();
+extern float wt_sample(int tbl, float phout, float dt);
+extern void out_write(float *left, float *right, int nsamp);
+extern void out_bus(int bus, float *left, float *right, int nsamp);
+extern int  apply_changes(llong now, int nsamp);
+extern void mark_status(int v);
+extern void publish_status();
+extern struct VOICE *voices;
+extern struct VOICE *rvoices;
+extern struct SYNTH synth;
+extern struct RSET rset;
 
 
 /***************************************************************************
  *  - Variable allocation for this file
  ***************************************************************************/
-static int64_t  oldnow;           // microseconds from epoch to previous now
-static float    sinetbl[NSINES];  // Sine look-up table. First quadrant only
-static uint32_t whitenoise;       // linear feedback shift register
+static struct timespec starttime; // monotonic time of sample zero
+static int64_t  rendered;         // samples rendered since starttime
+static float    mixleft[MX_BLOCK];  // left output for each sample in a block
+static float    mixright[MX_BLOCK]; // right output for each sample in a block
+static float    busleft[MX_BUSES][MX_BLOCK];  // left output of each bus
+static float    busright[MX_BUSES][MX_BLOCK]; // right output of each bus
+static char     busused[MX_BUSES]; // set if a voice played into the bus
+static float    silence[MX_BLOCK]; // output of a bus nothing played into
+struct BUS      buses[MX_BUSES];  // the buses table
+static int     *active;           // playing voices in index order
+static int      nactive;          // number of voices in active[]
+static char    *isactive;         // set if voice is in active[]
+static float   *voutbuf;          // output of each active voice, MX_BLOCK apart
+static char    *played;           // set if the active voice made output
+static int     *tasklist;         // active list indexes in task order
+static int     *taskfirst;        // first tasklist entry of each task
+static int      ntasks;           // number of tasks in this block
+static int      nexttask;         // next task for a worker to take
+static int      tasknsamp;        // number of samples in this block
+static pthread_barrier_t startbar; // workers wait here for a block
+static pthread_barrier_t donebar;  // and here for the block to finish
+struct HOTVOICES hot;             // render thread's hot voice state
+
+// The fields of struct VOICE that have a copy in the hot state
+#define HOTFIELD(f)  { offsetof(struct VOICE, f), offsetof(struct HOTVOICES, f) }
+static const struct {
+    int   voff;                   // byte offset in struct VOICE
+    int   hoff;                   // byte offset of the array in struct HOTVOICES
+} hotfields[] = {
+    HOTFIELD(vstate), HOTFIELD(ontime), HOTFIELD(adsridx),
+    HOTFIELD(envgain), HOTFIELD(envmul), HOTFIELD(envadd), HOTFIELD(envleft),
+    HOTFIELD(o1type), HOTFIELD(o1phasestep), HOTFIELD(o1phase),
+    HOTFIELD(o1symmetry), HOTFIELD(o1phaseoffset), HOTFIELD(o1gain),
+    HOTFIELD(o1out), HOTFIELD(o1wtable), HOTFIELD(glidefreq), HOTFIELD(glidems),
+    HOTFIELD(glidestep), HOTFIELD(glidecount),
+    HOTFIELD(vibtype), HOTFIELD(vibphasestep), HOTFIELD(vibphase),
+    HOTFIELD(vibsymmetry), HOTFIELD(vibphaseoffset), HOTFIELD(vibo1phase),
+    HOTFIELD(vibout),
+    HOTFIELD(o2type), HOTFIELD(o2phasestep), HOTFIELD(o2phase),
+    HOTFIELD(o2symmetry), HOTFIELD(o2phaseoffset), HOTFIELD(o2gain),
+    HOTFIELD(o2out), HOTFIELD(o2wtable), HOTFIELD(sync), HOTFIELD(mixmode),
+    HOTFIELD(tremtype), HOTFIELD(tremphasestep), HOTFIELD(tremphase),
+    HOTFIELD(tremdepth), HOTFIELD(tremsymmetry), HOTFIELD(tremphaseoffset),
+    HOTFIELD(tremout),
+    HOTFIELD(flttype), HOTFIELD(fltrolloff),
+    HOTFIELD(flt1b0), HOTFIELD(flt1b1), HOTFIELD(flt1b2), HOTFIELD(flt1a1),
+    HOTFIELD(flt1a2), HOTFIELD(flt1z1), HOTFIELD(flt1z2),
+    HOTFIELD(flt2b0), HOTFIELD(flt2b1), HOTFIELD(flt2b2), HOTFIELD(flt2a1),
+    HOTFIELD(flt2a2), HOTFIELD(flt2z1), HOTFIELD(flt2z2),
+    HOTFIELD(fltstep[0]), HOTFIELD(fltstep[1]), HOTFIELD(fltstep[2]),
+    HOTFIELD(fltstep[3]), HOTFIELD(fltstep[4]), HOTFIELD(fltstep[5]),
+    HOTFIELD(fltstep[6]), HOTFIELD(fltstep[7]), HOTFIELD(fltstep[8]),
+    HOTFIELD(fltstep[9]), HOTFIELD(fltramp),
+    HOTFIELD(outputclipping), HOTFIELD(outputgain), HOTFIELD(outputchannel),
+    HOTFIELD(bus),
+    HOTFIELD(voiceout),
+};
+#define NHOTFIELDS   (int)(sizeof(hotfields) / sizeof(hotfields[0]))
+static int hotmap[NVWORDS];       // hot array offset for each word of a voice, or -1
+
+// The filter parameters in the order of fltstep[]
+static const int fltparams[NFLTPARAM] = {
+    offsetof(struct VOICE, flt1b0), offsetof(struct VOICE, flt1b1),
+    offsetof(struct VOICE, flt1b2), offsetof(struct VOICE, flt1a1),
+    offsetof(struct VOICE, flt1a2),
+    offsetof(struct VOICE, flt2b0), offsetof(struct VOICE, flt2b1),
+    offsetof(struct VOICE, flt2b2), offsetof(struct VOICE, flt2a1),
+    offsetof(struct VOICE, flt2a2),
+};
 
 
 /***************************************************************
- * init_synth(): - Initialize tables and static values
+ * init_synth(): - Allocate the voices and initialize tables and
+ * static values.  The number of voices and the sample rate are
+ * fixed from here on.
  *
- * Input:
+ * Input:        number of voices, sample rate in Hz
  * Output:
  * Effects:      init index values in tables
  ***************************************************************/
-void init_synth()
+void init_synth(
+    int nvoices,       // number of voices
+    int srate)         // sample rate in Hz
 {
-    struct timeval tv;         // "now" as the time since the epoch
-    float  angle;              // angle for sine table init
     int    i;
 
-    // Get old now as the number of milliseconds since the Epoch
-    if (gettimeofday(&tv, 0) < 0) {
+    synth.nvoices = nvoices;
+    synth.srate = srate;
+    voices = calloc(nvoices, sizeof(struct VOICE));
+    rvoices = calloc(nvoices, sizeof(struct VOICE));
+    active = calloc(nvoices, sizeof(int));
+    isactive = calloc(nvoices, sizeof(char));
+    voutbuf = calloc(nvoices * MX_BLOCK, sizeof(float));
+    played = calloc(nvoices, sizeof(char));
+    tasklist = calloc(nvoices, sizeof(int));
+    taskfirst = calloc(nvoices + 1, sizeof(int));
+    if (!voices || !rvoices || !active || !isactive || !voutbuf || !played ||
+        !tasklist || !taskfirst) {
+        fprintf(stderr, "Unable to allocate %d voices\n", nvoices);
+        exit(1);
+    }
+    nactive = 0;
+    for (i = 0; i < NHOTFIELDS; i++)
+        HOTARRAY(hotfields[i].hoff) = hot_alloc(nvoices);
+    hot.noise = hot_alloc(nvoices);
+
+    // Sample zero is now.  The monotonic clock does not jump when
+    // the wall clock is set or adjusted by NTP.
+    if (clock_gettime(CLOCK_MONOTONIC, &starttime) < 0) {
         // LOG(LOG_WARNING, TM, E_No_Date);
         exit(-1);
     }
-    oldnow = (((long long) tv.tv_sec) * 1000000) + tv.tv_usec;
+    rendered = 0;
 
-    // init the shared white noise generator
-    whitenoise = LFSRINIT;
+    // init the render engine settings
+    synth.blocksize = DEF_BLOCK;
+    synth.maxcatchup = DEF_CATCHUPMS * srate / 1000;
+    synth.samples = 0;
+    synth.underruns = 0;
+    synth.lostsamples = 0;
+    synth.overruns = 0;
+    synth.rendermode = RENDER_BLOCK;
+    synth.wtinterp = WTINTERP_LINEAR;
+    synth.fltsmooth = DEF_FLTSMOOTH;
+    synth.evlead = DEF_EVLEAD;
+    synth.evlate = 0;
 
     // init the tables
-    for (i = 0; i < VOICE_COUNT; i++) {
+    for (i = 0; i < nvoices; i++) {
         voices[i].idx = i;
         voices[i].noteid[0] = (char) 0;
         voices[i].chordid[0] = (char) 0;
         voices[i].vstate = VSTATE_FREE;
         voices[i].ontime = 0;
+        voices[i].phasereset = 0;
+        voices[i].patch = -1;
         voices[i].o1type = OTYPE_OFF;
         voices[i].o1freq = 440.0;
         voices[i].o1phasestep = 0.0;
         voices[i].o1phaseacc = 0.0;
+        voices[i].o1phase = 0;
         voices[i].o1symmetry = 0.5;
         voices[i].o1phaseoffset = 0.0;
         voices[i].o1gain = 0.2;
+        voices[i].o1wtable = 0;
         voices[i].vibtype = OTYPE_OFF;
         voices[i].vibfreq = 0.0;
         voices[i].vibo1phase = 0.0;
         voices[i].vibphasestep = 0.0;
+        voices[i].vibphaseacc = 0.0;
+        voices[i].vibphase = 0;
         voices[i].vibdepth = 0.0;
         voices[i].vibsymmetry = 0.5;
         voices[i].vibphaseoffset = 0.0;
@@ -101,13 +253,17 @@ void init_synth()
         voices[i].o2freq = 440.0;
         voices[i].o2phasestep = 0.0;
         voices[i].o2phaseacc = 0.0;
+        voices[i].o2phase = 0;
         voices[i].o2symmetry = 0.5;
         voices[i].o2phaseoffset = 0.0;
         voices[i].o2gain = 0.0;
+        voices[i].o2wtable = 0;
         voices[i].mixmode = MIXMODE_NONE;
         voices[i].tremtype = OTYPE_OFF;
         voices[i].tremfreq = 0.0;
         voices[i].tremphasestep = 0.0;
+        voices[i].tremphaseacc = 0.0;
+        voices[i].tremphase = 0;
         voices[i].tremdepth = 0.0;
         voices[i].tremsymmetry = 0.5;
         voices[i].tremphaseoffset = 0.0;
@@ -132,6 +288,11 @@ void init_synth()
         voices[i].step5gain = 0.0;
         voices[i].step6gain = 0.0;
         voices[i].step7gain = 0.0;
+        voices[i].envcurve = ENV_LINEAR;
+        voices[i].envgain = 0.0;
+        voices[i].envmul = 1.0;
+        voices[i].envadd = 0.0;
+        voices[i].envleft = ENV_ENTER;
         voices[i].flttype  = FILT_OFF;
         voices[i].fltq = 1.0;
         voices[i].fltrolloff = 6;
@@ -141,41 +302,193 @@ void init_synth()
         voices[i].flt1b2 = 0.0;
         voices[i].flt1a1 = 0.0;
         voices[i].flt1a2 = 0.0;
-        voices[i].flt1in1 = 0.0;
-        voices[i].flt1in2 = 0.0;
-        voices[i].flt1out0 = 0.0;
-        voices[i].flt1out1 = 0.0;
-        voices[i].flt1out2 = 0.0;
+        voices[i].flt1z1 = 0.0;
+        voices[i].flt1z2 = 0.0;
         voices[i].fltf2 = 440;
         voices[i].flt2b0 = 1.0;
         voices[i].flt2b1 = 0.0;
         voices[i].flt2b2 = 0.0;
         voices[i].flt2a1 = 0.0;
         voices[i].flt2a2 = 0.0;
-        voices[i].flt2in1 = 0.0;
-        voices[i].flt2in2 = 0.0;
-        voices[i].flt2out0 = 0.0;
-        voices[i].flt2out1 = 0.0;
-        voices[i].flt2out2 = 0.0;
+        voices[i].flt2z1 = 0.0;
+        voices[i].flt2z2 = 0.0;
         voices[i].sync = 0;
         voices[i].outputclipping = 1;        // Clipping is on
         voices[i].outputchannel = OUTBOTH;
         voices[i].outputgain = 1.0;
+        voices[i].bus = 0;
         voices[i].sync = 0;
     }
 
-    // init the sine look-up table (0 to pi/2 radians, 0-90 degrees)
-    for (i = 0; i < NSINES; i++) {
-        angle = 3.1415926 * (float)i / (2.0 * (float)NSINES);
-        sinetbl[i] = sinf(angle);
+    // Every bus starts at full gain in the center
+    for (i = 0; i < MX_BUSES; i++) {
+        buses[i].idx = i;
+        buses[i].gain = 1.0;
+        buses[i].pan = 0.0;
+        buses[i].gainl = 1.0;
+        buses[i].gainr = 1.0;
+    }
+
+    // Each voice has its own white noise generator.  It only runs
+    // while the voice plays so idle voices cost nothing.
+    for (i = 0; i < nvoices; i++)
+        hot.noise[i] = LFSRINIT + i;
+
+    // map each word of struct VOICE to its hot array, if it has one
+    for (i = 0; i < (int) NVWORDS; i++)
+        hotmap[i] = -1;
+    for (i = 0; i < NHOTFIELDS; i++)
+        hotmap[hotfields[i].voff / sizeof(uint32_t)] = hotfields[i].hoff;
+
+    // build the sine table and pick the waveform kernels
+    init_osc();
+    init_filt();
+}
+
+
+/***************************************************************
+ * hot_alloc(): - Allocate one array of the hot state.  It is
+ * aligned to a cache line and padded to whole cache lines.
+ *
+ * Input:        number of voices
+ * Output:       zeroed array of 32 bit words
+ * Effects:      exits if out of memory
+ ***************************************************************/
+static void *hot_alloc(
+    int nvoices)       // number of voices
+{
+    void    *parray;           // new array
+    size_t   len;              // bytes in array
+
+    len = ((nvoices + HOT_LANES - 1) / HOT_LANES) * HOT_LANES * sizeof(uint32_t);
+    parray = aligned_alloc(64, len);
+    if (parray == NULL) {
+        fprintf(stderr, "Unable to allocate %d voices\n", nvoices);
+        exit(1);
+    }
+    memset(parray, 0, len);
+    return parray;
+}
+
+
+/***************************************************************
+ * hot_load(): - Copy a voice from rvoices[] into the hot state.
+ * The render thread does this when the whole voice changes,
+ * such as on a change of vstate.
+ *
+ * Input:        index of the voice
+ * Output:
+ * Effects:      hot state of the voice
+ ***************************************************************/
+void hot_load(
+    int v)             // index of voice to load
+{
+    int      f;
+
+    for (f = 0; f < NHOTFIELDS; f++)
+        HOTARRAY(hotfields[f].hoff)[v] =
+            *(uint32_t *) ((char *) &rvoices[v] + hotfields[f].voff);
+}
+
+
+/***************************************************************
+ * hot_save(): - Copy the hot state of a voice back into
+ * rvoices[] so code that works on struct VOICE sees the voice
+ * as it is now.
+ *
+ * Input:        index of the voice
+ * Output:
+ * Effects:      rvoices[v]
+ ***************************************************************/
+void hot_save(
+    int v)             // index of voice to save
+{
+    int      f;
+
+    for (f = 0; f < NHOTFIELDS; f++)
+        *(uint32_t *) ((char *) &rvoices[v] + hotfields[f].voff) =
+            HOTARRAY(hotfields[f].hoff)[v];
+}
+
+
+/***************************************************************
+ * hot_word(): - Return a pointer to where the render thread keeps
+ * a word of a voice.  This is the hot state for the fields that
+ * have a hot copy and rvoices[] for the rest.
+ *
+ * Input:        index of the voice, byte offset in struct VOICE
+ * Output:       pointer to the word
+ * Effects:
+ ***************************************************************/
+uint32_t *hot_word(
+    int v,             // index of the voice
+    int offset)        // byte offset of the word in struct VOICE
+{
+    int      hoff;             // offset of hot array or -1
+
+    hoff = hotmap[offset / sizeof(uint32_t)];
+    if (hoff < 0)
+        return (uint32_t *) ((char *) &rvoices[v] + offset);
+    return &HOTARRAY(hoff)[v];
+}
+
+
+/***************************************************************
+ * update_active(): - Add or remove a voice from the list of
+ * playing voices to match its vstate.  The block renderer only
+ * looks at voices in the list.  The list is kept in index order
+ * so the voices are summed in the same order as in render_ref().
+ * This is called by the render thread after anything that can
+ * change vstate.
+ *
+ * Input:        index of the voice
+ * Output:
+ * Effects:      active voice list
+ ***************************************************************/
+void update_active(
+    int v)             // index of voice that may have changed state
+{
+    int      playing;          // set if voice should be in the list
+    int      i;
+
+    playing = (hot.vstate[v] != VSTATE_FREE) && (hot.vstate[v] != VSTATE_INUSE);
+    if (playing == isactive[v])
+        return;
+    isactive[v] = playing;
+
+    if (playing) {
+        for (i = nactive; (i > 0) && (active[i - 1] > v); i--)
+            active[i] = active[i - 1];
+        active[i] = v;
+        nactive++;
+    }
+    else {
+        for (i = 0; active[i] != v; i++)
+            ;
+        for ( ; i < nactive - 1; i++)
+            active[i] = active[i + 1];
+        nactive--;
+        mark_status(v);         // SQL must see that it stopped
     }
 }
 
 
 /***************************************************************
  * do_synth(): - Compute the number of samples to output and
- * for each sample update the oscillators and voices.  Write to
- * the output computed sample values.
+ * render them in blocks of up to rset.blocksize samples.  Pass
+ * the computed sample values to the buffered output.
+ *  The number of samples due is the time since starttime on the
+ * monotonic clock times the sample rate.  We keep a count of the
+ * samples rendered so no roundoff is lost from pass to pass.  If
+ * we fall more than rset.maxcatchup samples behind, the extra
+ * samples are skipped and counted as an underrun rather than
+ * rendered in one long burst.
+ *  Only whole blocks are rendered.  The render timer ticks once
+ * per block so each pass normally renders one block, and any
+ * part of a block that is due waits for the next tick.
+ *  This runs on the render thread and works on rvoices[].
+ * Changes from SQL are applied between blocks.  A scheduled
+ * event due inside a block splits the block at its sample.
  *
  * Input:
  * Output:
@@ -183,59 +496,1077 @@ void init_synth()
  ***************************************************************/
 void do_synth()
 {
-    struct timeval tv;         // "now" as the time since the epoch
-    int64_t  now;              // now in microseconds since the epoch
+    struct timespec now;       // monotonic "now"
+    int64_t  sec;              // whole seconds since starttime
+    int64_t  nsec;             // and nanoseconds past that
+    int64_t  due;              // samples that should be out by now
     int64_t  dosamples;        // how many sample to add to the output
-    int64_t  s, v;             // loop variables for Samples, Voice
-    float    outputleft;       // left output for one sample
-    float    outputright;      // right output for one sample
+    int      nsamp;            // number of samples in this block
+    int      done;             // samples of the block rendered so far
+    int      piece;            // samples to render before the next timed change
+    int      blocksize;        // block size for this pass
+    int      catchup;          // most samples to render in this pass
+    int      rendermode;       // block or reference renderer for this pass
+    int      i;                // index into active list
 
-    // Get "now" in milliseconds since the Epoch
-    if (gettimeofday(&tv, 0) < 0) {
+    if (clock_gettime(CLOCK_MONOTONIC, &now) < 0) {
         // LOG(LOG_WARNING, TM, E_No_Date);
         exit(-1);
     }
-    now = (((long long) tv.tv_sec) * 1000000) + tv.tv_usec;
 
-    // We are not really interested in elapsed microseconds.  We want
-    // to know how many samples to add to the output.  Roundoff error
-    // means this is not just the elapsed seconds times the sample rate
-    dosamples = (now * 44100 / 1000000) - (oldnow * 44100 / 1000000);
-    oldnow = now;
+    // Scale seconds and nanoseconds apart so the sample count can
+    // not overflow no matter how long we run.
+    sec = (int64_t) now.tv_sec - (int64_t) starttime.tv_sec;
+    nsec = (int64_t) now.tv_nsec - (int64_t) starttime.tv_nsec;
+    if (nsec < 0) {
+        sec--;
+        nsec += NSPERSEC;
+    }
+    due = (sec * synth.srate) + (nsec * synth.srate / NSPERSEC);
+    dosamples = due - rendered;
+
+    // Take this pass's settings once, and keep them in range even
+    // if the copy in rset somehow is not.
+    blocksize = __atomic_load_n(&rset.blocksize, __ATOMIC_RELAXED);
+    if (blocksize < 1)
+        blocksize = 1;
+    else if (blocksize > MX_BLOCK)
+        blocksize = MX_BLOCK;
+    catchup = __atomic_load_n(&rset.maxcatchup, __ATOMIC_RELAXED);
+    rendermode = __atomic_load_n(&rset.rendermode, __ATOMIC_RELAXED);
+
+    // Do not try to make up for a long stall all at once
+    if (catchup < blocksize)
+        catchup = blocksize;
+    if (dosamples > catchup) {
+        synth.underruns++;
+        synth.lostsamples += dosamples - catchup;
+        rendered += dosamples - catchup;
+        dosamples = catchup;
+    }
+
+    // Whole blocks only
+    dosamples -= dosamples % blocksize;
+
+    // for each block of samples ...
+    while (dosamples > 0) {
+        nsamp = blocksize;
+        dosamples -= nsamp;
+
+        // The block is cut short where a scheduled event is due
+        for (done = 0; done < nsamp; done += piece) {
+            // Pick up any changes made by SQL commands
+            piece = apply_changes(rendered, nsamp - done);
+
+            // Fill mixleft and mixright with the sum of the voice outputs
+            if (rendermode == RENDER_REF)
+                render_ref(piece);
+            else
+                render_block(piece);
+
+            // send to audio output
+            out_write(mixleft, mixright, piece);
+            rendered += piece;
+        }
+
+        // let SQL see where the playing voices are now
+        synth.samples = rendered;
+        for (i = 0; i < nactive; i++)
+            mark_status(active[i]);
+        publish_status();
+    }
+
+    return;
+}
+
+
+/***************************************************************
+ * render_ref(): - The reference renderer.  For each sample
+ * period update every voice by one sample and sum the voice
+ * outputs into the left and right channels.  This is slow
+ * but easy to verify, and the block renderer must match it.
+ * The hot state is copied to rvoices[] before the block and
+ * back after it.
+ *
+ * Input:        number of samples to render
+ * Output:
+ * Effects:      mixleft, mixright, and all voice state
+ ***************************************************************/
+static void render_ref(
+    int nsamp)         // number of samples to render
+{
+    int      s, v, b;          // loop variables for Samples, Voice, Bus
+
+    // do_voice() works on struct VOICE, not the hot state
+    for (v = 0; v < synth.nvoices; v++)
+        hot_save(v);
 
     // for each sample period ...
-    for (s = 0; s < dosamples; s++) {
+    memset(busused, 0, sizeof(busused));
+    for (s = 0; s < nsamp; s++) {
+        for (b = 0; b < MX_BUSES; b++) {
+            busleft[b][s] = 0.0;
+            busright[b][s] = 0.0;
+        }
         // process each of the voices
-        outputleft = 0.0;
-        outputright = 0.0;
-        for (v = 0; v < VOICE_COUNT; v++) {
+        for (v = 0; v < synth.nvoices; v++) {
             do_voice(v);
-            if ((voices[v].outputchannel & 0x01) == 1) // 1 or 3
-                outputleft += voices[v].voiceout;
-            if (voices[v].outputchannel >= 2)        // 2 or 3
-                outputright += voices[v].voiceout;
-        }
-
-        // clip outputs
-        if (outputleft > 1.0)
-            outputleft = 1.0;
-        else if (outputleft < -1.0)
-            outputleft = -1.0;
-        if (outputright > 1.0)
-            outputright = 1.0;
-        else if (outputright < -1.0)
-            outputright = -1.0;
-
-        // send to audio output
-        static int val = 0;
-        char x[2];
-        val = (int) (outputleft * (float)FULLVOLUME);
-        x[1] = val & 0x0000ff;
-        x[0] = (val >> 8) & 0x0000ff;
-        write(1, x, 2);
+            b = rvoices[v].bus;
+            if (rvoices[v].vstate != VSTATE_FREE)
+                busused[b] = 1;
+            if ((rvoices[v].outputchannel & 0x01) == 1) // 1 or 3
+                busleft[b][s] += rvoices[v].voiceout;
+            if (rvoices[v].outputchannel >= 2)        // 2 or 3
+                busright[b][s] += rvoices[v].voiceout;
+        }
     }
+    mix_buses(nsamp);
 
-    return;
+    // Every voice was run so every voice is published
+    for (v = 0; v < synth.nvoices; v++) {
+        hot_load(v);
+        update_active(v);
+        mark_status(v);
+    }
+}
+
+
+/***************************************************************
+ * render_block(): - The block renderer.  Each voice computes
+ * all of its samples for the block in one call.  The per-voice
+ * decisions on waveform, mix mode, and filter type are made
+ * once per block instead of once per sample.
+ *  Only the voices in the active list are rendered, so voices
+ * that are not playing cost nothing.  A voice that ends in the
+ * block is taken off the list after it is mixed.
+ *  The block renderer works on the hot state, not rvoices[].
+ * Only the ADSR steps are read from rvoices[].
+ *  The voices are rendered as tasks.  A task is one voice with
+ * no filter or a group of up to FILT_LANES voices with filters,
+ * which the filter bank runs side by side.  If there are worker
+ * threads they and the render thread take tasks until none are
+ * left.  Each voice renders into its own buffer.  The buffers
+ * are summed in active list order once all are done, so the
+ * output is the same no matter how many workers there are or
+ * which one ran a voice.
+ *
+ * Input:        number of samples to render
+ * Output:
+ * Effects:      mixleft, mixright, and all voice state
+ ***************************************************************/
+static void render_block(
+    int nsamp)         // number of samples to render
+{
+    float   *vout;             // output of one voice
+    float   *bl, *br;          // left and right of the voice's bus
+    int      s, v, b;          // loop variables for Samples, Voice, Bus
+    int      i;                // index into active list
+
+    // Render every active voice
+    build_tasks();
+    nexttask = 0;
+    tasknsamp = nsamp;
+    if ((synth.nworkers > 0) && (ntasks > 1)) {
+        pthread_barrier_wait(&startbar);
+        run_tasks();
+        pthread_barrier_wait(&donebar);
+    }
+    else {
+        run_tasks();
+    }
+
+    // Clear the buses that have a voice to mix
+    memset(busused, 0, sizeof(busused));
+    for (i = 0; i < nactive; i++) {
+        if (played[i])
+            busused[hot.bus[active[i]]] = 1;
+    }
+    for (b = 0; b < MX_BUSES; b++) {
+        if (busused[b]) {
+            memset(busleft[b], 0, nsamp * sizeof(float));
+            memset(busright[b], 0, nsamp * sizeof(float));
+        }
+    }
+
+    // Mix each voice into its bus in active list order
+    for (i = 0; i < nactive; i++) {
+        if (played[i] == 0)
+            continue;           // voice is not playing
+        v = active[i];
+        vout = &voutbuf[i * MX_BLOCK];
+        bl = busleft[hot.bus[v]];
+        br = busright[hot.bus[v]];
+        if ((hot.outputchannel[v] & 0x01) == 1) { // 1 or 3
+            for (s = 0; s < nsamp; s++)
+                bl[s] += vout[s];
+        }
+        if (hot.outputchannel[v] >= 2) {          // 2 or 3
+            for (s = 0; s < nsamp; s++)
+                br[s] += vout[s];
+        }
+    }
+    mix_buses(nsamp);
+
+    // A voice that went free is removed from active[i]
+    i = 0;
+    while (i < nactive) {
+        v = active[i];
+        update_active(v);
+        if ((i < nactive) && (active[i] == v))
+            i++;
+    }
+}
+
+
+/***************************************************************
+ * mix_buses(): - Add each bus to the main output at its gain
+ * and pan, and pass it to the bus's audio streams.  Only the
+ * buses a voice played into are mixed, so a bus costs two
+ * multiply-adds per sample when it is in use and nothing when
+ * it is not.  The buses are added in order so the output does
+ * not depend on which voices are on which bus.
+ *
+ * Input:        number of samples in the block
+ * Output:
+ * Effects:      mixleft, mixright, and the bus outputs
+ ***************************************************************/
+static void mix_buses(
+    int nsamp)         // number of samples in the block
+{
+    float   *bl, *br;          // left and right of a bus
+    float    gl, gr;           // left and right gain of a bus
+    int      s, b;             // loop variables for Samples, Bus
+
+    for (s = 0; s < nsamp; s++) {
+        mixleft[s] = 0.0;
+        mixright[s] = 0.0;
+    }
+    for (b = 0; b < MX_BUSES; b++) {
+        if (busused[b] == 0) {
+            out_bus(b, silence, silence, nsamp);
+            continue;
+        }
+        bl = busleft[b];
+        br = busright[b];
+        gl = buses[b].gainl;
+        gr = buses[b].gainr;
+        for (s = 0; s < nsamp; s++) {
+            bl[s] *= gl;
+            mixleft[s] += bl[s];
+            br[s] *= gr;
+            mixright[s] += br[s];
+        }
+        out_bus(b, bl, br, nsamp);
+    }
+}
+
+
+/***************************************************************
+ * build_tasks(): - Split the active list into tasks.  Each voice
+ * with no filter is a task of its own.  The voices with a filter
+ * are put in groups of FILT_LANES in active list order, and each
+ * group is a task.  The groups do not depend on the number of
+ * workers so neither does the output.
+ *
+ * Input:
+ * Output:
+ * Effects:      tasklist, taskfirst, ntasks
+ ***************************************************************/
+static void build_tasks()
+{
+    int      n;                // entries in tasklist
+    int      ingroup;          // voices in the last filter group
+    int      i;                // index into active list
+
+    ntasks = 0;
+    n = 0;
+    for (i = 0; i < nactive; i++) {
+        if (hot.flttype[active[i]] == FILT_OFF) {
+            taskfirst[ntasks++] = n;
+            tasklist[n++] = i;
+        }
+    }
+    ingroup = 0;
+    for (i = 0; i < nactive; i++) {
+        if (hot.flttype[active[i]] != FILT_OFF) {
+            if (ingroup == 0)
+                taskfirst[ntasks++] = n;
+            tasklist[n++] = i;
+            ingroup = (ingroup + 1) % FILT_LANES;
+        }
+    }
+    taskfirst[ntasks] = n;
+}
+
+
+/***************************************************************
+ * run_tasks(): - Render tasks until none are left.  The render
+ * thread and each worker run this at the same time.  Taking the
+ * next task is the only shared write.  The voices of a task are
+ * rendered up to the filter, filtered together, and then given
+ * their envelope and gain.
+ *
+ * Input:
+ * Output:
+ * Effects:      voice buffers and the state of the voices rendered
+ ***************************************************************/
+static void run_tasks()
+{
+    float    env[FILT_LANES][MX_BLOCK]; // ADSR gain of each voice
+    int      idx[FILT_LANES];  // active list index of each voice that played
+    int      nlive[FILT_LANES]; // samples each voice plays
+    int      killed[FILT_LANES]; // set if the voice went free
+    int      n;                // voices in idx[]
+    int      t;                // task index
+    int      i, j;
+
+    while ((t = __atomic_fetch_add(&nexttask, 1, __ATOMIC_RELAXED)) < ntasks) {
+        n = 0;
+        for (j = taskfirst[t]; j < taskfirst[t + 1]; j++) {
+            i = tasklist[j];
+            played[i] = do_voice_block(active[i], tasknsamp, &voutbuf[i * MX_BLOCK],
+                                       env[n], &nlive[n], &killed[n]);
+            if (played[i])
+                idx[n++] = i;
+        }
+        if ((n > 0) && (hot.flttype[active[idx[0]]] != FILT_OFF))
+            filt_voices(idx, nlive, n);
+        for (j = 0; j < n; j++)
+            end_voice_block(active[idx[j]], tasknsamp, &voutbuf[idx[j] * MX_BLOCK],
+                            env[j], nlive[j], killed[j]);
+    }
+}
+
+
+/***************************************************************
+ * init_workers(): - Set up the barriers the render thread uses
+ * to start the workers on a block and wait for them to finish.
+ * The threads themselves are started by init_render().
+ *
+ * Input:        number of worker threads
+ * Output:
+ * Effects:      worker barriers
+ ***************************************************************/
+void init_workers(
+    int nworkers)      // number of worker threads
+{
+    synth.nworkers = nworkers;
+    if (nworkers == 0)
+        return;
+    if ((pthread_barrier_init(&startbar, NULL, nworkers + 1) != 0) ||
+        (pthread_barrier_init(&donebar, NULL, nworkers + 1) != 0)) {
+        fprintf(stderr, "Unable to set up %d render workers\n", nworkers);
+        exit(1);
+    }
+}
+
+
+/***************************************************************
+ * voice_worker(): - The body of a render worker thread.  Wait
+ * for the render thread to start a block, help render it, and
+ * wait for the others to finish.
+ *
+ * Input:        unused
+ * Output:       never returns
+ * Effects:      voice buffers and voice state
+ ***************************************************************/
+void *voice_worker(
+    void *arg)         // unused
+{
+    flush_denormals();
+    while (1) {
+        pthread_barrier_wait(&startbar);
+        run_tasks();
+        pthread_barrier_wait(&donebar);
+    }
+    return NULL;
+}
+
+
+/***************************************************************
+ * do_voice_block(): - Update the specified voice to process
+ * a block of samples.  This is do_voice() turned inside out:
+ * each stage of the voice (oscillators, mixer, tremolo, filter,
+ * ADSR) runs over the whole block before the next stage starts.
+ *  The ADSR envelope runs first since it alone decides how many
+ * samples the voice plays before it goes free.  The other stages
+ * only process that many samples so the voice state matches
+ * what do_voice() would leave behind.
+ *  This stops short of the filter, which filt_voices() runs
+ * for a group of voices.  end_voice_block() does the rest.
+ *
+ * Input:        index of voice, number of samples, output buffer,
+ *               envelope buffer
+ * Output:       zero if the voice is not playing, else one.
+ *               vout has the unfiltered voice output and env
+ *               the ADSR gain for each sample.
+ * Effects:      internal voice state
+ ***************************************************************/
+static int do_voice_block(
+    int    v,          // index of voice to update
+    int    nsamp,      // number of samples to render
+    float *vout,       // voice output for each sample
+    float *env,        // ADSR gain for each sample
+    int   *pnlive,     // number of samples the voice plays
+    int   *pkilled)    // set if the voice went free in this block
+{
+    float   o2out[MX_BLOCK];  // oscillator #2 output
+    int     o2sync[MX_BLOCK]; // set when osc #2 phase wraps
+    float   vibout[MX_BLOCK]; // vibrato oscillator output
+    float   tremout[MX_BLOCK]; // tremolo oscillator output
+    uint32_t noiseblk[MX_BLOCK]; // white noise for each sample
+    float   o1dt[MX_BLOCK]; // o1 phase step of each sample
+    int     nlive;     // number of samples before the voice goes free
+    float   phstep;    // the actual value to step the accumulator
+    float   steplo;    // o1 phase step in first half of cycle
+    float   stephi;    // o1 phase step in second half of cycle
+    unsigned fixlo;    // steplo in fixed point
+    unsigned fixhi;    // stephi in fixed point
+    unsigned phase;    // local copy of the o1 phase accumulator
+    unsigned offset;   // o1 phase offset in fixed point
+    float   o1phasestep; // local copy of the o1 phase step
+    int     glidecount; // local copy of the glide count
+    uint32_t whitenoise; // local copy of the noise generator
+    int     s;         // sample index
+
+    // Check to see if voice is in use
+    if ((hot.vstate[v] == VSTATE_FREE) || (hot.vstate[v] == VSTATE_INUSE)) {
+        return 0;
+    }
+
+    // The envelope does not depend on the signal so we do it first.
+    nlive = env_block(v, nsamp, env, pkilled);
+    *pnlive = nlive;
+    for (s = nlive; s < nsamp; s++)
+        vout[s] = 0.0;
+
+    // Step the voice's noise generator once for each live sample
+    whitenoise = hot.noise[v];
+    for (s = 0; s < nlive; s++) {
+        if (whitenoise & 0x80000000)
+            whitenoise = ((whitenoise << 1) ^ LFSRPOLY) + 1;
+        else
+            whitenoise = whitenoise << 1;
+        noiseblk[s] = whitenoise;
+    }
+    hot.noise[v] = whitenoise;
+
+    // oscillator #2 affects oscillator #1 if they are to be mixed.
+    if (hot.mixmode[v] != MIXMODE_NONE) {
+        osc_block(hot.o2type[v], hot.o2wtable[v], hot.o2phasestep[v], &hot.o2phase[v],
+            hot.o2symmetry[v], hot.o2phaseoffset[v], noiseblk, o2out,
+            o2sync, nlive);
+        for (s = 0; s < nlive; s++)
+            o2out[s] = o2out[s] * hot.o2gain[v];
+        hot.o2out[v] = o2out[nlive - 1];
+        hot.sync[v] = o2sync[nlive - 1];
+    }
+
+    // Compute vibrato as an adjustment to the o1 phase step
+    if ((hot.vibtype[v] != OTYPE_OFF) && (hot.vibtype[v] != OTYPE_WAVETBL)) {
+        osc_block(hot.vibtype[v], 0, hot.vibphasestep[v], &hot.vibphase[v],
+            hot.vibsymmetry[v], hot.vibphaseoffset[v], noiseblk, vibout,
+            (int *) NULL, nlive);
+        hot.vibout[v] = vibout[nlive - 1];
+    }
+    else {
+        // vibout keeps its last value
+        for (s = 0; s < nlive; s++)
+            vibout[s] = hot.vibout[v];
+    }
+
+    // Compute the o1 phase plus offset for each sample into vout.
+    // The phase step is constant over the block unless there is a
+    // glide, vibrato, or FM, so we check for that common case first.
+    phase = hot.o1phase[v];
+    offset = PHASE_FIX(hot.o1phaseoffset[v]);
+    if ((hot.glidecount[v] == 0) && (hot.vibtype[v] == OTYPE_OFF) &&
+        ((hot.o2type[v] == OTYPE_OFF) || (hot.mixmode[v] != MIXMODE_FM)) &&
+        (hot.mixmode[v] != MIXMODE_HARDSYNC)) {
+        steplo = 0.5 * hot.o1phasestep[v] / (1.0 - hot.o1symmetry[v]);
+        stephi = 0.5 * hot.o1phasestep[v] / hot.o1symmetry[v];
+        fixlo = PHASE_FIX(steplo);
+        fixhi = PHASE_FIX(stephi);
+        for (s = 0; s < nlive; s++) {
+            if (phase < PHASE_HALF) {
+                o1dt[s] = steplo;
+                phase += fixlo;
+            }
+            else {
+                o1dt[s] = stephi;
+                phase += fixhi;
+            }
+            vout[s] = PHASE_FLOAT(phase + offset);
+        }
+    }
+    else {
+        o1phasestep = hot.o1phasestep[v];
+        glidecount = hot.glidecount[v];
+        for (s = 0; s < nlive; s++) {
+            // Adjust oscillator #1 phase step based on glide
+            if (glidecount != 0) {
+                o1phasestep += hot.glidestep[v];
+                glidecount--;
+                // If done, reset glidems and set phase step to correct value
+                if (glidecount == 0) {
+                    hot.glidems[v] = 0;
+                    o1phasestep = hot.glidefreq[v] / SRATE;
+                }
+            }
+            // Compute osc #1 phase based on vibrato, osc #2, and symmetry
+            if (hot.vibtype[v] == OTYPE_OFF) {
+                phstep = o1phasestep;
+            } else {
+                phstep = o1phasestep + (hot.vibo1phase[v] * vibout[s]);
+            }
+            // Adjust o1 phase based on FM mixing and osc #2 output
+            if ((hot.o2type[v] != OTYPE_OFF) && (hot.mixmode[v] == MIXMODE_FM)) {
+                phstep = phstep + (o1phasestep * o2out[s]);
+            }
+            // Adjust o1 phase step based on symmetry
+            if (phase < PHASE_HALF)
+                phstep = 0.5 * phstep / (1.0 - hot.o1symmetry[v]);
+            else
+                phstep = 0.5 * phstep / hot.o1symmetry[v];
+            o1dt[s] = phstep;
+
+            // The fixed-point phase wraps by itself, even for a step
+            // that is negative or more than a cycle.
+            phase += PHASE_FIX(phstep);
+            vout[s] = PHASE_FLOAT(phase + offset);
+
+            // Hard sync forces the phase to zero if osc #2 crosses zero
+            if ((o2sync[s] == 1) && (hot.mixmode[v] == MIXMODE_HARDSYNC)) {
+                phase = 0;
+            }
+        }
+        hot.o1phasestep[v] = o1phasestep;
+        hot.glidecount[v] = glidecount;
+    }
+    hot.o1phase[v] = phase;
+
+    // compute o1 output value based on waveform type and apply gain
+    if (hot.o1type[v] == OTYPE_WAVETBL)
+        wt_wave(hot.o1wtable[v], vout, o1dt, nlive);
+    else
+        osc_wave(hot.o1type[v], vout, o1dt, noiseblk, nlive);
+    for (s = 0; s < nlive; s++)
+        vout[s] = vout[s] * hot.o1gain[v];
+    hot.o1out[v] = vout[nlive - 1];
+
+    // Mix oscillator #1 and oscillator #2
+    if (hot.mixmode[v] == MIXMODE_SUM) {
+        for (s = 0; s < nlive; s++)
+            vout[s] = vout[s] + o2out[s];
+    }
+    else if (hot.mixmode[v] == MIXMODE_AM) {
+        for (s = 0; s < nlive; s++)
+            vout[s] = vout[s] * (o2out[s] + 1.0);
+    }
+    else if (hot.mixmode[v] == MIXMODE_RING) {
+        for (s = 0; s < nlive; s++)
+            vout[s] = vout[s] * o2out[s];
+    }
+
+    // Compute tremolo as an adjustment to the mixed signal amplitude
+    if ((hot.tremtype[v] != OTYPE_OFF) && (hot.tremtype[v] != OTYPE_WAVETBL)) {
+        osc_block(hot.tremtype[v], 0, hot.tremphasestep[v], &hot.tremphase[v],
+            hot.tremsymmetry[v], hot.tremphaseoffset[v], noiseblk, tremout,
+            (int *) NULL, nlive);
+        for (s = 0; s < nlive; s++)
+            vout[s] = vout[s] * (1.0 - (hot.tremdepth[v] * tremout[s]));
+        hot.tremout[v] = tremout[nlive - 1];
+    }
+    return 1;
+}
+
+
+/***************************************************************
+ * end_voice_block(): - Finish a block of a voice after the
+ * filter.  Apply the envelope, clipping, and output gain.
+ *
+ * Input:        index of voice, number of samples, voice output,
+ *               ADSR gain, and the play count from do_voice_block()
+ * Output:       vout has the voice output for each sample
+ * Effects:      voiceout
+ ***************************************************************/
+static void end_voice_block(
+    int    v,          // index of voice to finish
+    int    nsamp,      // number of samples to render
+    float *vout,       // filtered voice output for each sample
+    float *env,        // ADSR gain for each sample
+    int    nlive,      // number of samples the voice plays
+    int    killed)     // set if the voice went free in this block
+{
+    int     s;         // sample index
+
+    // Apply the ADSR envelope.  The sample that ends the note is zero.
+    if (killed) {
+        nlive--;
+        vout[nlive] = 0.0;
+    }
+    for (s = 0; s < nlive; s++)
+        vout[s] = vout[s] * env[s];
+
+    // Output clipping and gain
+    if (hot.outputclipping[v] == 1) {
+        for (s = 0; s < nlive; s++) {
+            if (vout[s] > 1.0)
+                vout[s] = 1.0;
+            else if (vout[s] < -1.0)
+                vout[s] = -1.0;
+        }
+    }
+    for (s = 0; s < nlive; s++)
+        vout[s] = vout[s] * hot.outputgain[v];
+
+    hot.voiceout[v] = vout[nsamp - 1];
+}
+
+
+/***************************************************************
+ * env_block(): - Compute the ADSR gain for each sample of the
+ * block.  See do_voice() for a description of the envelope.
+ * This returns the number of samples the voice plays in this
+ * block.  If the voice goes free in the block then the last of
+ * those samples is the one that ended the note and *pkilled
+ * is set.
+ *  The samples of a step up to its last are a tight loop of one
+ * add per sample, or one multiply and add for an exponential
+ * step.  A step is worked out by env_enter() when it starts.
+ *
+ * Input:        index of voice, number of samples, gain buffer
+ * Output:       number of samples the voice plays
+ * Effects:      ADSR state and vstate of the voice
+ ***************************************************************/
+static int env_block(
+    int    v,          // index of voice to update
+    int    nsamp,      // number of samples to render
+    float *env,        // ADSR gain for each sample
+    int   *pkilled)    // set if the voice goes free
+{
+    struct VOICE *pvoc; // voice with the ADSR steps
+    float  *stepgain;  // step gains as an array
+    float   prevgain;  // Gain of previous ADSR step
+    float   gain;      // local copy of the ADSR gain
+    float   mul;       // local copy of the gain multiplier
+    float   add;       // local copy of the gain increment
+    int     left;      // local copy of the samples left in the step
+    int     vstate;    // local copy of the voice state
+    int     adsridx;   // local copy of the ADSR step
+    int     ontime;    // local copy of the ADSR step timer
+    int     nlive;     // number of samples the voice plays
+    int     n;         // samples of the step in this block
+    int     s, i;      // sample index
+
+    // Librta does not do tables-of-tables so the step gains and
+    // times are consecutive fields in the voice structure.
+    pvoc = &rvoices[v];
+    stepgain = &(pvoc->step0gain);
+    *pkilled = 0;
+
+    // Work on local copies.  Other threads may be writing the hot
+    // state of voices that share these cache lines.
+    vstate = hot.vstate[v];
+    adsridx = hot.adsridx[v];
+    ontime = hot.ontime[v];
+    gain = hot.envgain[v];
+    mul = hot.envmul[v];
+    add = hot.envadd[v];
+    left = hot.envleft[v];
+    nlive = nsamp;
+
+    for (s = 0; s < nsamp; ) {
+        // If in SUSTAIN mode use just the previous gain
+        if (vstate == VSTATE_SUSTAIN) {
+            prevgain = (adsridx == 0) ? 0.0 : stepgain[adsridx - 1];
+            for ( ; s < nsamp; s++)
+                env[s] = prevgain;
+            break;
+        }
+
+        if (left == ENV_ENTER) {
+            left = env_enter(pvoc, adsridx, ontime, &gain, &mul, &add);
+            if (left == ENV_KILL) {
+                left = ENV_ENTER;
+                vstate = VSTATE_FREE;
+                *pkilled = 1;
+                nlive = s + 1;
+                break;
+            }
+            if (left == ENV_SUSTAIN) {
+                // the first sample of a sustain step has the previous gain
+                env[s++] = gain;
+                adsridx++;
+                vstate = VSTATE_SUSTAIN;
+                left = ENV_ENTER;
+                continue;
+            }
+        }
+
+        // The samples of the step before its last
+        n = (left < nsamp - s) ? left : nsamp - s;
+        if (mul == 1.0f) {
+            for (i = 0; i < n; i++) {
+                env[s + i] = gain;
+                gain = gain + add;
+            }
+        }
+        else {
+            for (i = 0; i < n; i++) {
+                env[s + i] = gain;
+                gain = (gain * mul) + add;
+            }
+        }
+        s += n;
+        left -= n;
+        ontime += n;
+        if (s == nsamp)
+            break;
+
+        // The last sample of the step is the step's gain, not the
+        // sum of the increments, which rounding leaves a little off
+        gain = stepgain[adsridx];
+        env[s++] = gain;
+        adsridx++;
+        ontime = 0;
+        left = ENV_ENTER;
+        // done if we just passed the maximum ADSR step
+        if (adsridx > MXADSRSTEP) {
+            vstate = VSTATE_FREE;
+            *pkilled = 1;
+            nlive = s;
+            break;
+        }
+    }
+
+    hot.vstate[v] = vstate;
+    hot.adsridx[v] = adsridx;
+    hot.ontime[v] = ontime;
+    hot.envgain[v] = gain;
+    hot.envmul[v] = mul;
+    hot.envadd[v] = add;
+    hot.envleft[v] = left;
+    return nlive;
+}
+
+
+/***************************************************************
+ * env_enter(): - Work out the ADSR step a voice is in from its
+ * adsridx and ontime.  A step of N ms ends on the first sample
+ * at which ontime is N ms, as it always has.  The gain goes
+ * from the gain of the previous step to the gain of this one
+ * along a straight line.  If envcurve is set it goes along an
+ * exponential that is ENV_SHAPE time constants long and is
+ * scaled to reach the gain at the end of the step, which is how
+ * an analog envelope sounds.  Both are a multiply and an add
+ * per sample.  The step is worked out in double so a long
+ * linear step starts on its line, and ontime can be anywhere in
+ * the step so an UPDATE of the steps takes effect at once.
+ *
+ * Input:        voice with the ADSR steps, ADSR step and timer
+ * Output:       samples to the last sample of the step, ENV_KILL
+ *               if the note is over, or ENV_SUSTAIN if this is a
+ *               sustain step
+ * Effects:      gain, multiplier, and increment for the step
+ ***************************************************************/
+static int env_enter(
+    struct VOICE *pvoc, // voice with the ADSR steps
+    int     adsridx,   // ADSR step
+    int     ontime,    // samples into the step
+    float  *pgain,     // gain of the next sample
+    float  *pmul,      // gain multiplier per sample
+    float  *padd)      // gain increment per sample
+{
+    float  *stepgain;  // step gains as an array
+    int    *steptimes; // step times as an array
+    double  prevgain;  // Gain of previous ADSR step
+    double  targetgain; // Target gain in current ADSR step
+    double  top;       // gain the exponential heads for
+    double  k;         // exponential decay per sample
+    long long nstep;   // ontime of the last sample of the step
+    int     steptime;  // duration of this step in milliseconds
+
+    stepgain = &(pvoc->step0gain);
+    steptimes = &(pvoc->step0time);
+    if ((adsridx < 0) || (adsridx >= MXADSRSTEP))
+        return ENV_KILL;
+
+    // if target gain is zero then the note is finished
+    prevgain = (adsridx == 0) ? 0.0 : stepgain[adsridx - 1];
+    targetgain = stepgain[adsridx];
+    if (targetgain == 0.0)
+        return ENV_KILL;
+
+    *pgain = prevgain;
+    *pmul = 1.0;
+    *padd = 0.0;
+    steptime = steptimes[adsridx];
+    if (steptime == SUSTAINVALUE)
+        return ENV_SUSTAIN;
+
+    // The first sample at which 1000 * ontime / SRATE is steptime
+    steptime = (steptime <= 0) ? 1 : steptime;
+    nstep = (((long long) steptime * synth.srate) + 999) / 1000;
+    if (ontime >= nstep) {
+        *pgain = targetgain;
+        return 0;
+    }
+
+    if (pvoc->envcurve == ENV_EXP) {
+        k = exp(-ENV_SHAPE / (double) nstep);
+        top = prevgain + ((targetgain - prevgain) / (1.0 - exp(-ENV_SHAPE)));
+        *pgain = top - ((top - prevgain) * pow(k, (double) ontime));
+        *pmul = k;
+        *padd = top * (1.0 - k);
+    }
+    else {
+        *pgain = prevgain + ((targetgain - prevgain) * (double) ontime / (double) nstep);
+        *padd = (targetgain - prevgain) / (double) nstep;
+    }
+    return ((nstep - ontime) > 0x7fffffff) ? 0x7fffffff : (int) (nstep - ontime);
+}
+
+
+/***************************************************************
+ * osc_block(): - Run one of the o2, vibrato, or tremolo
+ * oscillators for a block of samples.  The phase step for each
+ * half of the cycle is computed once for the block.
+ *
+ * Input:        oscillator parameters and a pointer to the
+ *               fixed-point phase, noise, and output buffers
+ * Output:       waveform value for each sample in out[], and
+ *               in sync[], if given, a one where the phase wrapped
+ * Effects:      phase accumulator
+ ***************************************************************/
+static void osc_block(
+    int       type,        // Sine, square, triangle, noise, wavetable
+    int       wtable,      // wavetable index if type is wavetable
+    float     phasestep,   // phase step each sample
+    unsigned *pphase,      // fixed-point phase accumulator
+    float     symmetry,    // symmetry (0 to 1)
+    float     phaseoffset, // added to accumulator before computing output
+    uint32_t *noise,       // white noise for each sample
+    float    *out,         // waveform output for each sample
+    int      *sync,        // set to one when phase wraps, may be NULL
+    int       nsamp)       // number of samples to render
+{
+    float    steplo;       // phase step in first half of cycle
+    float    stephi;       // phase step in second half of cycle
+    unsigned fixlo;        // steplo in fixed point
+    unsigned fixhi;        // stephi in fixed point
+    unsigned phase;        // local copy of the phase accumulator
+    unsigned prev;         // phase before this sample's step
+    unsigned offset;       // phase offset in fixed point
+    float    dt[MX_BLOCK]; // phase step of each sample
+    int      s;
+
+    steplo = 0.5 * phasestep / (1.0 - symmetry);
+    stephi = 0.5 * phasestep / symmetry;
+    fixlo = PHASE_FIX(steplo);
+    fixhi = PHASE_FIX(stephi);
+    offset = PHASE_FIX(phaseoffset);
+    phase = *pphase;
+    for (s = 0; s < nsamp; s++) {
+        prev = phase;
+        if (phase < PHASE_HALF) {
+            dt[s] = steplo;
+            phase += fixlo;
+        }
+        else {
+            dt[s] = stephi;
+            phase += fixhi;
+        }
+        // The phase wrapped if the step carried out of the top
+        if (sync)
+            sync[s] = (phase < prev);
+        out[s] = PHASE_FLOAT(phase + offset);
+    }
+    *pphase = phase;
+
+    if (type == OTYPE_WAVETBL)
+        wt_wave(wtable, out, dt, nsamp);
+    else
+        osc_wave(type, out, dt, noise, nsamp);
+}
+
+
+/***************************************************************
+ * filt_voices(): - Run the filters of a group of voices for a
+ * block.  The filter settings and state are gathered from the
+ * hot state into a struct FILTGROUP for the filter bank, and the
+ * state is put back after.  See do_voice() for how the two
+ * filters are used for each filter type.
+ *
+ * Input:        active list index and play count of each voice,
+ *               number of voices
+ * Output:       the voice buffers have the filtered signal
+ * Effects:      filter state of the voices
+ ***************************************************************/
+static void filt_voices(
+    int   *idx,        // active list index of each voice
+    int   *nlive,      // number of samples each voice plays
+    int    n)          // number of voices, at most FILT_LANES
+{
+    struct FILTGROUP grp;  // the voices gathered for the filter bank
+    int      l;        // lane in the group
+    int      v;
+
+    memset(&grp, 0, sizeof(grp));
+    grp.nvoice = n;
+    for (l = 0; l < n; l++) {
+        v = active[idx[l]];
+        grp.buf[l] = &voutbuf[idx[l] * MX_BLOCK];
+        grp.nlive[l] = nlive[l];
+        if (nlive[l] > grp.nsamp)
+            grp.nsamp = nlive[l];
+        // Filter #2 runs if 12 dB or band-pass or band-stop filters
+        grp.stage2[l] = ((hot.fltrolloff[v] == 12) || (hot.flttype[v] == FILT_BAND) ||
+                         (hot.flttype[v] == FILT_STOP)) ? -1 : 0;
+        grp.stop[l] = (hot.flttype[v] == FILT_STOP) ? -1 : 0;
+        grp.only1[l] = (hot.fltrolloff[v] == 6) ? -1 : 0;
+        grp.b10[l] = hot.flt1b0[v]; grp.b11[l] = hot.flt1b1[v]; grp.b12[l] = hot.flt1b2[v];
+        grp.a11[l] = hot.flt1a1[v]; grp.a12[l] = hot.flt1a2[v];
+        grp.z11[l] = hot.flt1z1[v]; grp.z12[l] = hot.flt1z2[v];
+        grp.b20[l] = hot.flt2b0[v]; grp.b21[l] = hot.flt2b1[v]; grp.b22[l] = hot.flt2b2[v];
+        grp.a21[l] = hot.flt2a1[v]; grp.a22[l] = hot.flt2a2[v];
+        grp.z21[l] = hot.flt2z1[v]; grp.z22[l] = hot.flt2z2[v];
+        grp.ramp[l] = (hot.fltramp[v] > 0) ? hot.fltramp[v] : 0;
+        if (grp.ramp[l] > 0) {
+            grp.db10[l] = hot.fltstep[0][v]; grp.db11[l] = hot.fltstep[1][v];
+            grp.db12[l] = hot.fltstep[2][v]; grp.da11[l] = hot.fltstep[3][v];
+            grp.da12[l] = hot.fltstep[4][v];
+            grp.db20[l] = hot.fltstep[5][v]; grp.db21[l] = hot.fltstep[6][v];
+            grp.db22[l] = hot.fltstep[7][v]; grp.da21[l] = hot.fltstep[8][v];
+            grp.da22[l] = hot.fltstep[9][v];
+        }
+    }
+
+    filt_group(&grp);
+
+    for (l = 0; l < n; l++) {
+        v = active[idx[l]];
+        hot.flt1z1[v] = grp.z11[l]; hot.flt1z2[v] = grp.z12[l];
+        hot.flt2z1[v] = grp.z21[l]; hot.flt2z2[v] = grp.z22[l];
+        hot.fltramp[v] = (grp.ramp[l] > nlive[l]) ? grp.ramp[l] - nlive[l] : 0;
+    }
+}
+
+
+/***************************************************************
+ * filt_retarget(): - Set a filter parameter of a voice and ramp
+ * to it from where the filter is now.  The parameters in use are
+ * the ones set less fltramp steps, so this works out where each
+ * of them is, sets the new one, and gives all of them new steps
+ * that reach the parameters set in rset.fltsmooth ms.  A change
+ * in the middle of a ramp starts from where the ramp got to.
+ * Linear steps keep the filter stable, as any mix of two stable
+ * sets of a1 and a2 is stable.  The render thread calls this for
+ * each change it takes from the SQL thread, before the block.
+ *
+ * Input:        index of the voice, byte offset in struct VOICE,
+ *               new value
+ * Output:       0 if the word is not a filter parameter
+ * Effects:      hot filter parameters and ramp of the voice
+ ***************************************************************/
+int filt_retarget(
+    int      v,        // index of the voice
+    int      offset,   // byte offset of the word in struct VOICE
+    uint32_t value)    // new value of the word
+{
+    float    now[NFLTPARAM];   // parameters in use now
+    float    left;             // steps left in the ramp
+    float   *pp;               // hot copy of a parameter
+    int      nsamp;            // length of the new ramp
+    int      k;
+
+    for (k = 0; k < NFLTPARAM; k++) {
+        if (fltparams[k] == offset)
+            break;
+    }
+    if (k == NFLTPARAM)
+        return 0;
+    if (hot.fltramp[v] < 0) {
+        *hot_word(v, offset) = value;     // new note, no ramp
+        return 1;
+    }
+
+    left = (float) hot.fltramp[v];
+    for (k = 0; k < NFLTPARAM; k++) {
+        pp = (float *) hot_word(v, fltparams[k]);
+        now[k] = (hot.fltramp[v] > 0) ? *pp - (hot.fltstep[k][v] * left) : *pp;
+    }
+    *hot_word(v, offset) = value;
+
+    nsamp = (__atomic_load_n(&rset.fltsmooth, __ATOMIC_RELAXED) * synth.srate) / 1000;
+    for (k = 0; k < NFLTPARAM; k++) {
+        pp = (float *) hot_word(v, fltparams[k]);
+        hot.fltstep[k][v] = (nsamp > 0) ? (*pp - now[k]) / (float) nsamp : 0.0f;
+    }
+    hot.fltramp[v] = nsamp;
+    return 1;
+}
+
+
+/***************************************************************
+ * voice_newstate(): - Do the work that goes with a change of
+ * voice state.  Going from FREE to ON restarts the ADSR.  Going
+ * from SUSTAIN to ON past the last ADSR step ends the note.  A
+ * new note skips the filter parameter ramp.  A voice that is
+ * not playing contributes nothing to the output.
+ * This is called by the render thread when it applies a new
+ * vstate so the old state is the one the voice really had.
+ *
+ * Input:        voice with its new vstate, the previous vstate
+ * Output:
+ * Effects:      voice state
+ ***************************************************************/
+void voice_newstate(
+    struct VOICE *pvoc,    // voice with new vstate
+    int oldstate)          // vstate before the change
+{
+    int    newstate;
+
+    newstate = pvoc->vstate;
+
+    // A new note takes its filter settings at once, even ones that
+    // come after the note on, until the filter runs
+    if ((newstate == VSTATE_ON) && (oldstate != VSTATE_SUSTAIN))
+        pvoc->fltramp = -1;
+
+    // Work out the ADSR step again at the next sample played
+    if (newstate == VSTATE_ON)
+        pvoc->envleft = ENV_ENTER;
+
+    // A new note can start its oscillators in step with the other
+    // notes started in the same command
+    if ((newstate == VSTATE_ON) && (pvoc->phasereset) &&
+        ((oldstate == VSTATE_FREE) || (oldstate == VSTATE_INUSE))) {
+        pvoc->o1phase = 0;
+        pvoc->o2phase = 0;
+        pvoc->vibphase = 0;
+        pvoc->tremphase = 0;
+    }
+
+    // If going from OFF to ON, clear the ADSR note timer
+    if ((newstate == VSTATE_ON) && (oldstate == VSTATE_FREE)) {
+        pvoc->ontime = 0;
+        pvoc->adsridx = 0;
+    }
+
+    // if going from SUSTAIN to ON increment to the next step in ADSR
+    else if ((newstate == VSTATE_ON) && (oldstate == VSTATE_SUSTAIN)) {
+        if (pvoc->adsridx == MXADSRSTEP) {
+            // can't go past last step.  Turn voice off.
+            pvoc->vstate = VSTATE_FREE;
+            pvoc->voiceout = 0.0;
+        }
+    }
+
+    // A voice that is not playing contributes nothing to the output
+    else if ((newstate == VSTATE_FREE) || (newstate == VSTATE_INUSE)) {
+        pvoc->voiceout = 0.0;
+    }
 }
 
 
@@ -244,7 +1575,8 @@ void do_synth()
  * one sample interval.
  *
  * The oscillators phase accumulates by "oXphasestep" at every
- * sample time.  Phase wraps around if the computed value is below
+ * sample time.  The phase is kept in 32 bit fixed point with 2^32
+ * as one cycle, so it wraps around by itself when the sum is below
  * zero or greater than one.
  * Asymmetry scales the phasestep to a higher or lower value when
  * the accumulated phase is less than or greater than the symmetry
@@ -263,50 +1595,48 @@ void do_voice(
     struct  VOICE  *pvoc;  // makes code easier to read
     float   phstep;    // the actual value to step the accumulator
     float   phout;     // Sum of accumulator and phasestep
-    float   sineidx;   // Index into the sine table as a float
     float   prevgain;  // Gain of previous ADSR step
-    float   targetgain; // Target gain in current ADSR step
-    int     steptime;  // duration of this step in milliseconds
-    int     ontimems;  // pvoc->ontime in ms instead of sample ticks
     float   flt2input; // filter #2 input == Filter #1 out or same input as #1
+    float   flt1out;   // output of filter #1
+    float   flt2out;   // output of filter #2
+    float   b10, b11, b12, a11, a12; // filter #1 parameters in use
+    float   b20, b21, b22, a21, a22; // filter #2 parameters in use
+    float   left;      // steps left in a filter parameter ramp
+    uint32_t whitenoise; // this voice's white noise for this sample
+    unsigned prev;     // o2 phase before this sample's step
 
-    // update the white noise generator whether or not we use this voice
-    if (whitenoise & 0x80000000)
-        whitenoise = ((whitenoise << 1) ^ LFSRPOLY) + 1;
-    else
-        whitenoise = whitenoise << 1;
-
-    pvoc = &voices[v];
+    pvoc = &rvoices[v];
 
     // Check to see if voice is in use
     if ((pvoc->vstate == VSTATE_FREE) || (pvoc->vstate == VSTATE_INUSE)) {
         return;
     }
 
+    // update the voice's white noise generator
+    whitenoise = hot.noise[v];
+    if (whitenoise & 0x80000000)
+        whitenoise = ((whitenoise << 1) ^ LFSRPOLY) + 1;
+    else
+        whitenoise = whitenoise << 1;
+    hot.noise[v] = whitenoise;
+
     // oscillator #2 affects oscillator #1 if they are to be mixed.
     if (pvoc->mixmode != MIXMODE_NONE) {
         phstep = pvoc->o2phasestep;
 
         // Adjust o2 phase step based on symmetry
-        if (pvoc->o2phaseacc < 0.5) 
+        if (pvoc->o2phase < PHASE_HALF) 
             phstep = 0.5 * phstep / (1.0 - pvoc->o2symmetry);
         else
             phstep = 0.5 * phstep / pvoc->o2symmetry;
 
-        // Adjust the phase of the oscillator.  Subtract floor since phase might > 2.0!
-        pvoc->o2phaseacc += phstep;
-        if (pvoc->o2phaseacc > 1.0) {
-            pvoc->o2phaseacc -= floorf(pvoc->o2phaseacc);
-            pvoc->sync = 1;
-        }
-        else
-            pvoc->sync = 0;
+        // Adjust the phase of the oscillator.  A carry out of the top is a wrap.
+        prev = pvoc->o2phase;
+        pvoc->o2phase += PHASE_FIX(phstep);
+        pvoc->sync = (pvoc->o2phase < prev);
 
         // The o2 phase accumulator is set.  Add offset to compute output value
-        phout = pvoc->o2phaseacc + pvoc->o2phaseoffset;
-        if (phout > 1.0) {
-            phout -= floorf(phout);
-        }
+        phout = PHASE_FLOAT(pvoc->o2phase + PHASE_FIX(pvoc->o2phaseoffset));
 
         // compute o2 output value based on waveform type
         if (pvoc->o2type == OTYPE_SQUARE) {
@@ -316,17 +1646,7 @@ void do_voice(
                 pvoc->o2out = -1.0;
         }
         else if (pvoc->o2type == OTYPE_SINE) {
-            if (phout < 0.25)
-                sineidx = phout * 4.0;     // table is just the first quadrant
-            else if (phout < 0.5)
-                sineidx = 2.0 - (phout * 4.0);  // goes 1 down to 0
-            else if (phout < 0.75)
-                sineidx = (phout - 0.5) * 4.0;
-            else
-                sineidx = 2.0 - ((phout - 0.5) * 4.0);  // goes 1 down to 0
-            pvoc->o2out = sinetbl[(int)((float)(NSINES -1) * sineidx)];
-            if (phout > 0.5)
-                pvoc->o2out = -pvoc->o2out;   // negative in second half of cycle
+            pvoc->o2out = osc_sine(phout);
         }
         else if (pvoc->o2type == OTYPE_TRIANGLE) {
             if (phout < 0.25)
@@ -336,13 +1656,18 @@ void do_voice(
             else
                 pvoc->o2out = (phout * 4.0) + -4.0;
         }
+        else if ((pvoc->o2type == OTYPE_BLSQUARE) || (pvoc->o2type == OTYPE_BLTRIANGLE)) {
+            pvoc->o2out = osc_bl(pvoc->o2type, phout, phstep);
+        }
         else if (pvoc->o2type == OTYPE_NOISE) {
             // whitenoise is an unsigned 32 bit integer.  We need to map its value
             // into a float between -1.0 and 1.0.  First to 0-1 then sign using MSB
             pvoc->o2out = ((float) (whitenoise & 0x7ffffff) / (float)(1 << 27));
             pvoc->o2out = (whitenoise & 0x8000000) ? -pvoc->o2out : pvoc->o2out;
         }
-        // else wavetable, which is not implemented
+        else if (pvoc->o2type == OTYPE_WAVETBL) {
+            pvoc->o2out = wt_sample(pvoc->o2wtable, phout, phstep);
+        }
         else
             pvoc->o2out = 0.0;
 
@@ -355,22 +1680,16 @@ void do_voice(
         phstep = pvoc->vibphasestep;
 
         // Adjust vib phase step based on symmetry
-        if (pvoc->vibphaseacc < 0.5) 
+        if (pvoc->vibphase < PHASE_HALF) 
             phstep = 0.5 * phstep / (1.0 - pvoc->vibsymmetry);
         else
             phstep = 0.5 * phstep / pvoc->vibsymmetry;
 
-        // Adjust the phase of the oscillator.  Subtract floor since phase might > 2.0!
-        pvoc->vibphaseacc += phstep;
-        if (pvoc->vibphaseacc > 1.0) {
-            pvoc->vibphaseacc -= floorf(pvoc->vibphaseacc);
-        }
+        // Adjust the phase of the oscillator.  It wraps by itself.
+        pvoc->vibphase += PHASE_FIX(phstep);
 
         // The vib phase accumulator is set.  Add offset to compute output value
-        phout = pvoc->vibphaseacc + pvoc->vibphaseoffset;
-        if (phout > 1.0) {
-            phout -= floorf(phout);
-        }
+        phout = PHASE_FLOAT(pvoc->vibphase + PHASE_FIX(pvoc->vibphaseoffset));
 
         // compute vib output value based on waveform type
         if (pvoc->vibtype == OTYPE_SQUARE) {
@@ -380,17 +1699,7 @@ void do_voice(
                 pvoc->vibout = -1.0;
         }
         else if (pvoc->vibtype == OTYPE_SINE) {
-            if (phout < 0.25)
-                sineidx = phout * 4.0;     // table is just the first quadrant
-            else if (phout < 0.5)
-                sineidx = 2.0 - (phout * 4.0);  // goes 1 down to 0
-            else if (phout < 0.75)
-                sineidx = (phout - 0.5) * 4.0;
-            else
-                sineidx = 2.0 - ((phout - 0.5) * 4.0);  // goes 1 down to 0
-            pvoc->vibout = sinetbl[(int)((float)(NSINES -1) * sineidx)];
-            if (phout > 0.5)
-                pvoc->vibout = -pvoc->vibout;   // negative in second half of cycle
+            pvoc->vibout = osc_sine(phout);
         }
         else if (pvoc->vibtype == OTYPE_TRIANGLE) {
             if (phout < 0.25)
@@ -400,6 +1709,9 @@ void do_voice(
             else
                 pvoc->vibout = (phout * 4.0) + -4.0;
         }
+        else if ((pvoc->vibtype == OTYPE_BLSQUARE) || (pvoc->vibtype == OTYPE_BLTRIANGLE)) {
+            pvoc->vibout = osc_bl(pvoc->vibtype, phout, phstep);
+        }
         else if (pvoc->vibtype == OTYPE_NOISE) {
             // whitenoise is an unsigned 32 bit integer.  We need to map its value
             // into a float between -1.0 and 1.0.  First to 0-1 then sign using MSB
@@ -425,38 +1737,27 @@ void do_voice(
         phstep = pvoc->o1phasestep;
     } else {
         phstep = pvoc->o1phasestep + (pvoc->vibo1phase * pvoc->vibout);
-        if (phstep > 1.0) {
-            phstep -= floorf(phstep);
-        }
     }
     // Adjust o1 phase based on FM mixing and osc #2 output
     if ((pvoc->o2type != OTYPE_OFF) && (pvoc->mixmode == MIXMODE_FM)) {
         phstep = phstep + (pvoc->o1phasestep * pvoc->o2out);
-        if (phstep > 1.0) {
-            phstep -= floorf(phstep);
-        }
     }
     // Adjust o1 phase step based on symmetry
-    if (pvoc->o1phaseacc < 0.5) 
+    if (pvoc->o1phase < PHASE_HALF) 
         phstep = 0.5 * phstep / (1.0 - pvoc->o1symmetry);
     else
         phstep = 0.5 * phstep / pvoc->o1symmetry;
 
-    // Adjust the phase of the oscillator.  Subtract floor since phase might > 2.0!
-    pvoc->o1phaseacc += phstep;
-    if (pvoc->o1phaseacc > 1.0) {
-        pvoc->o1phaseacc -= floorf(pvoc->o1phaseacc);
-    }
+    // Adjust the phase of the oscillator.  It wraps by itself, even
+    // for a step that is negative or more than a cycle.
+    pvoc->o1phase += PHASE_FIX(phstep);
 
     // The o1 phase accumulator is set.  Add offset to compute output value
-    phout = pvoc->o1phaseacc + pvoc->o1phaseoffset;
-    if (phout > 1.0) {
-        phout -= floorf(phout);
-    }
+    phout = PHASE_FLOAT(pvoc->o1phase + PHASE_FIX(pvoc->o1phaseoffset));
 
     // Hard sync forces the phase to zero if enabled and osc #2 crosses zero
     if ((pvoc->sync == 1) && (pvoc->mixmode == MIXMODE_HARDSYNC)) {
-        pvoc->o1phaseacc = 0.0;
+        pvoc->o1phase = 0;
     }
 
     // compute o1 output value based on waveform type
@@ -467,17 +1768,7 @@ void do_voice(
             pvoc->o1out = -1.0;
     }
     else if (pvoc->o1type == OTYPE_SINE) {
-        if (phout < 0.25)
-            sineidx = phout * 4.0;     // table is just the first quadrant
-        else if (phout < 0.5)
-            sineidx = 2.0 - (phout * 4.0);  // goes 1 down to 0
-        else if (phout < 0.75)
-            sineidx = (phout - 0.5) * 4.0;
-        else
-            sineidx = 2.0 - ((phout - 0.5) * 4.0);  // goes 1 down to 0
-        pvoc->o1out = sinetbl[(int)((float)(NSINES -1) * sineidx)];
-        if (phout > 0.5)
-            pvoc->o1out = -pvoc->o1out;   // negative in second half of cycle
+        pvoc->o1out = osc_sine(phout);
     }
     else if (pvoc->o1type == OTYPE_TRIANGLE) {
             if (phout < 0.25)
@@ -487,12 +1778,18 @@ void do_voice(
             else
                 pvoc->o1out = (phout * 4.0) + -4.0;
     }
+    else if ((pvoc->o1type == OTYPE_BLSQUARE) || (pvoc->o1type == OTYPE_BLTRIANGLE)) {
+        pvoc->o1out = osc_bl(pvoc->o1type, phout, phstep);
+    }
     else if (pvoc->o1type == OTYPE_NOISE) {
         // whitenoise is an unsigned 32 bit integer.  We need to map its value
         // into a float between -1.0 and 1.0.  First to 0-1 then sign using MSB
         pvoc->o1out = ((float) (whitenoise & 0x7ffffff) / (float)(1 << 27));
         pvoc->o1out = (whitenoise & 0x8000000) ? -pvoc->o1out : pvoc->o1out;
     }
+    else if (pvoc->o1type == OTYPE_WAVETBL) {
+        pvoc->o1out = wt_sample(pvoc->o1wtable, phout, phstep);
+    }
     else   // should not get here
         pvoc->o1out = 0.0;
     // apply the gain for osc #1
@@ -518,22 +1815,16 @@ void do_voice(
         phstep = pvoc->tremphasestep;
 
         // Adjust trem phase step based on symmetry
-        if (pvoc->tremphaseacc < 0.5) 
+        if (pvoc->tremphase < PHASE_HALF) 
             phstep = 0.5 * phstep / (1.0 - pvoc->tremsymmetry);
         else
             phstep = 0.5 * phstep / pvoc->tremsymmetry;
 
-        // Adjust the phase of the oscillator.  Subtract floor since phase might > 2.0!
-        pvoc->tremphaseacc += phstep;
-        if (pvoc->tremphaseacc > 1.0) {
-            pvoc->tremphaseacc -= floorf(pvoc->tremphaseacc);
-        }
+        // Adjust the phase of the oscillator.  It wraps by itself.
+        pvoc->tremphase += PHASE_FIX(phstep);
 
         // The trem phase accumulator is set.  Add offset to compute output value
-        phout = pvoc->tremphaseacc + pvoc->tremphaseoffset;
-        if (phout > 1.0) {
-            phout -= floorf(phout);
-        }
+        phout = PHASE_FLOAT(pvoc->tremphase + PHASE_FIX(pvoc->tremphaseoffset));
 
         // compute trem output value based on waveform type
         if (pvoc->tremtype == OTYPE_SQUARE) {
@@ -543,17 +1834,7 @@ void do_voice(
                 pvoc->tremout = -1.0;
         }
         else if (pvoc->tremtype == OTYPE_SINE) {
-            if (phout < 0.25)
-                sineidx = phout * 4.0;     // table is just the first quadrant
-            else if (phout < 0.5)
-                sineidx = 2.0 - (phout * 4.0);  // goes 1 down to 0
-            else if (phout < 0.75)
-                sineidx = (phout - 0.5) * 4.0;
-            else
-                sineidx = 2.0 - ((phout - 0.5) * 4.0);  // goes 1 down to 0
-            pvoc->tremout = sinetbl[(int)((float)(NSINES -1) * sineidx)];
-            if (phout > 0.5)
-                pvoc->tremout = -pvoc->tremout;   // negative in second half of cycle
+            pvoc->tremout = osc_sine(phout);
         }
         else if (pvoc->tremtype == OTYPE_TRIANGLE) {
             if (phout < 0.25)
@@ -563,6 +1844,9 @@ void do_voice(
             else
                 pvoc->tremout = (phout * 4.0) + -4.0;
         }
+        else if ((pvoc->tremtype == OTYPE_BLSQUARE) || (pvoc->tremtype == OTYPE_BLTRIANGLE)) {
+            pvoc->tremout = osc_bl(pvoc->tremtype, phout, phstep);
+        }
         else if (pvoc->tremtype == OTYPE_NOISE) {
             // whitenoise is an unsigned 32 bit integer.  We need to map its value
             // into a float between -1.0 and 1.0.  First to 0-1 then sign using MSB
@@ -579,100 +1863,108 @@ void do_voice(
     // Voiceout now has the new generated value. Pass it through the filters
     // and the ADSR amplitude envelope.
     //  The filter is second order with both poles and zeros. This filter is
-    // of Type I so has separate stores for past inputs and past outputs.
+    // in transposed direct form II so it needs only two stores, which hold
+    // the parts of the next two outputs that are already known.
     if (pvoc->flttype != FILT_OFF) {
+        // New parameters ramp in.  Those in use are the ones set less
+        // a step for each sample left in the ramp.
+        b10 = pvoc->flt1b0; b11 = pvoc->flt1b1; b12 = pvoc->flt1b2;
+        a11 = pvoc->flt1a1; a12 = pvoc->flt1a2;
+        b20 = pvoc->flt2b0; b21 = pvoc->flt2b1; b22 = pvoc->flt2b2;
+        a21 = pvoc->flt2a1; a22 = pvoc->flt2a2;
+        if (pvoc->fltramp > 0) {
+            left = (float) pvoc->fltramp--;
+            b10 -= pvoc->fltstep[0] * left; b11 -= pvoc->fltstep[1] * left;
+            b12 -= pvoc->fltstep[2] * left; a11 -= pvoc->fltstep[3] * left;
+            a12 -= pvoc->fltstep[4] * left;
+            b20 -= pvoc->fltstep[5] * left; b21 -= pvoc->fltstep[6] * left;
+            b22 -= pvoc->fltstep[7] * left; a21 -= pvoc->fltstep[8] * left;
+            a22 -= pvoc->fltstep[9] * left;
+        }
+        else
+            pvoc->fltramp = 0;
+
         // Filter #1 always runs if filters are enabled
-        pvoc->flt1out0 = (pvoc->flt1b0 * pvoc->voiceout) +
-                         (pvoc->flt1b1 * pvoc->flt1in1) +
-                         (pvoc->flt1b2 * pvoc->flt1in2) +
-                         (-pvoc->flt1a1 * pvoc->flt1out1) +
-                         (-pvoc->flt1a2 * pvoc->flt1out2);
-        pvoc->flt1out2 = pvoc->flt1out1;
-        pvoc->flt1out1 = pvoc->flt1out0;
-        pvoc->flt1in2  = pvoc->flt1in1;
-        pvoc->flt1in1  = pvoc->voiceout;
+        flt1out = (b10 * pvoc->voiceout) + pvoc->flt1z1;
+        pvoc->flt1z1 = (b11 * pvoc->voiceout) - (a11 * flt1out) + pvoc->flt1z2;
+        pvoc->flt1z2 = (b12 * pvoc->voiceout) - (a12 * flt1out);
+        flt2out = 0.0;
         // Filter #2 runs if 12 dB or band-pass or band-stop filters
         if ((pvoc->fltrolloff == 12) || (pvoc->flttype == FILT_BAND) || (pvoc->flttype == FILT_STOP)) {
             // The input to the second filter is the same as filter #1's input if
             // the type is STOP.  Else it is the output of filter #1.
-            flt2input = (pvoc->flttype == FILT_STOP) ? pvoc->voiceout : pvoc->flt1out0;
-            pvoc->flt2out0 = (pvoc->flt2b0 * flt2input) +
-                             (pvoc->flt2b1 * pvoc->flt2in1) +
-                             (pvoc->flt2b2 * pvoc->flt2in2) +
-                             (-pvoc->flt2a1 * pvoc->flt2out1) +
-                             (-pvoc->flt2a2 * pvoc->flt2out2);
-            pvoc->flt2out2 = pvoc->flt2out1;
-            pvoc->flt2out1 = pvoc->flt2out0;
-            pvoc->flt2in2  = pvoc->flt2in1;
-            pvoc->flt2in1  = flt2input;
+            flt2input = (pvoc->flttype == FILT_STOP) ? pvoc->voiceout : flt1out;
+            flt2out = (b20 * flt2input) + pvoc->flt2z1;
+            pvoc->flt2z1 = (b21 * flt2input) - (a21 * flt2out) + pvoc->flt2z2;
+            pvoc->flt2z2 = (b22 * flt2input) - (a22 * flt2out);
         }
         
         // Output of the filters is filter #2's output for low, high, and band
         // pass filters, and the average of both filters for band reject
         if (pvoc->flttype == FILT_STOP)
-            pvoc->voiceout = (pvoc->flt1out0 + pvoc->flt2out0) / 2.0;
+            pvoc->voiceout = (flt1out + flt2out) * 0.5f;
         else if (pvoc->fltrolloff == 6)
-            pvoc->voiceout = pvoc->flt1out0;   // just filter 1 for 6 db rolloff
+            pvoc->voiceout = flt1out;   // just filter 1 for 6 db rolloff
         else
-            pvoc->voiceout = pvoc->flt2out0;
+            pvoc->voiceout = flt2out;
     }
 
     // The ADSR envelope has eight steps.  Librta does not do tables-of-tables
     // so we compute the step time and gain using the index multiplied by the
     // sizeof int or float. 
-    //  Compute the current gain as a linear interpolation of the previous gain
-    // up (down) to this step's target gain.  Base this on the fraction of ontime
-    // divided by this step's steptime.
-    //  Start by getting the previous gain.
-    if (pvoc->adsridx == 0) {
-        prevgain = 0.0;
-    } else {
-        prevgain = *(float *)((long long int)&(pvoc->step0gain) + (long long int)(sizeof(float) * (pvoc->adsridx -1)));
-    }
-
-    // If in SUSTAIN mode use just the previous gain to compute output
+    //  The gain goes from the previous step's gain to this step's target gain
+    // over the step's time.  The step is worked out by env_enter() at its first
+    // sample, then the gain takes a multiply and add for each sample.
     if (pvoc->vstate == VSTATE_SUSTAIN) {
+        // If in SUSTAIN mode use just the previous gain to compute output
+        if (pvoc->adsridx == 0) {
+            prevgain = 0.0;
+        } else {
+            prevgain = *(float *)((long long int)&(pvoc->step0gain) + (long long int)(sizeof(float) * (pvoc->adsridx -1)));
+        }
         pvoc->voiceout = pvoc->voiceout * prevgain;
     }
     else {
-        //  Get the target gain
-        if (pvoc->adsridx == MXADSRSTEP) {
-            targetgain = 0.0;
-        } else {
-            targetgain = *(float *)((long long int)&(pvoc->step0gain) + (sizeof(float) * (pvoc->adsridx)));
-        }
-        // if target gain is zero then the note is finished
-        if (targetgain == 0.0) {
-            pvoc->voiceout = 0.0;
-            pvoc->vstate = VSTATE_FREE;
-            return;
+        if (pvoc->envleft == ENV_ENTER) {
+            pvoc->envleft = env_enter(pvoc, pvoc->adsridx, pvoc->ontime,
+                                      &pvoc->envgain, &pvoc->envmul, &pvoc->envadd);
+            // if target gain is zero then the note is finished
+            if (pvoc->envleft == ENV_KILL) {
+                pvoc->envleft = ENV_ENTER;
+                pvoc->voiceout = 0.0;
+                pvoc->vstate = VSTATE_FREE;
+                return;
+            }
         }
-        // Get this step's duration
-        steptime = *(int *)((long long int)&(pvoc->step0time) + (long long int)(sizeof(int) * (pvoc->adsridx)));
-        steptime = (steptime == 0) ? 1 : steptime;
-        ontimems = (1000 * pvoc->ontime) / SRATE;  // ms to seconds since SRATE is in seconds
 
         // multiply voiceout by scaled gain value going from prevgain to target gain
-        pvoc->voiceout = pvoc->voiceout * (prevgain + ((targetgain - prevgain) * ((float)ontimems / (float)steptime)));
+        pvoc->voiceout = pvoc->voiceout * pvoc->envgain;
 
-        // Increment to next ADSR step if at end of this step
-        if (steptime == ontimems) {
+        if (pvoc->envleft == ENV_SUSTAIN) {
+            // If steptime is the SUSTAIN value then set vstate to SUSTAIN and
+            // increment to the next step (so adsridx will be correct when we leave sustain).
+            pvoc->adsridx++;
+            pvoc->vstate = VSTATE_SUSTAIN;
+            pvoc->envleft = ENV_ENTER;
+        }
+        else if (pvoc->envleft == 0) {
+            // Increment to next ADSR step if at end of this step
             pvoc->adsridx++;
             pvoc->ontime = 0;
+            pvoc->envleft = ENV_ENTER;
             // done if we just passed the maximum ADSR step
             if (pvoc->adsridx > MXADSRSTEP) {
                 pvoc->voiceout = 0.0;
                 pvoc->vstate = VSTATE_FREE;
             }
         }
-        else if (steptime == SUSTAINVALUE) {
-            // If steptime is the SUSTAIN value then set vstate to SUSTAIN and
-            // increment to the next step (so adsridx will be correct when we leave sustain).
-            pvoc->adsridx++;
-            pvoc->vstate = VSTATE_SUSTAIN;
-        }
         else {
+            pvoc->envgain = (pvoc->envgain * pvoc->envmul) + pvoc->envadd;
+            pvoc->envleft--;
             pvoc->ontime++;
+            // The last sample of the step is the step's gain
+            if (pvoc->envleft == 0)
+                pvoc->envgain = (&(pvoc->step0gain))[pvoc->adsridx];
         }
     }
 
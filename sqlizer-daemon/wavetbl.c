@@ -0,0 +1,253 @@
+/***************************************************************
+ * wavetbl.c -- The wavetable bank and the wavetable oscillator.
+ *
+ * Copyright:   Copyright (C) 2023 by Atomlab, LLC
+ *
+ * License:     This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the Version 2 of the GNU General
+ *              Public License as published by the Free Software Foundation.
+ *              GPL2.txt in the docs directory is a copy of this license.
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *              GNU General Public License for more details.
+ *
+ **************************************************************/
+
+/***************************************************************
+ * Overview:
+ *    The bank file is mapped read-only and the samples are used
+ * where they lie.  Nothing is copied or read at startup except
+ * the header and the table names, so a bank of thousands of
+ * tables loads at once and its pages are shared by every voice
+ * and with the page cache.  The file format is described with
+ * struct WTHEADER in sqlizer.h.
+ *    A wavetable oscillator picks, for each sample, the level of
+ * its table with the most harmonics that are all below half the
+ * sample rate.  That is the level with no more than one sample
+ * per phase step.  The phase is then looked up in that level
+ * with the interpolation set in rset.wtinterp.
+ *    The block renderer calls wt_wave() and the reference
+ * renderer calls wt_sample().  Both use wt_lookup() so their
+ * output is the same.
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sqlizer.h"
+
+
+/***************************************************************************
+ *  - Function prototypes and external references
+ ***************************************************************************/
+void   load_wavetables(char *path);
+float  wt_sample(int tbl, float phout, float dt);
+void   wt_wave(int tbl, float *out, float *dt, int nsamp);
+static inline float wt_lookup(struct WAVETBL *pwt, float phout, float dt, int interp);
+extern struct SYNTH synth;
+extern struct RSET rset;
+
+
+/***************************************************************************
+ *  - Variable allocation for this file
+ ***************************************************************************/
+struct WAVETBL *wtables;       // the tables in the bank, one per row
+
+
+/***************************************************************
+ * load_wavetables(): - Map a bank file and build the list of
+ * its tables.  Any problem with the file is fatal since it was
+ * named on the command line.  With no file there are no tables
+ * and wavetable oscillators are silent.
+ *
+ * Input:        path to the bank file or NULL
+ * Output:
+ * Effects:      wtables, synth.nwtables.  Exits on error.
+ ***************************************************************/
+void load_wavetables(
+    char *path)        // bank file name, may be NULL
+{
+    struct WTHEADER *phdr; // header at the start of the file
+    struct stat st;    // gives the file size
+    char    *pmap;     // the mapped file
+    char    *pname;    // name of a table in the file
+    float   *pdata;    // samples of a table in the file
+    size_t   need;     // bytes the header says the file has
+    size_t   per;      // samples in all levels of one table
+    int      fd;
+    int      i;
+
+    synth.nwtables = 0;
+    if (path == (char *) NULL)
+        return;
+
+    fd = open(path, O_RDONLY);
+    if ((fd < 0) || (fstat(fd, &st) < 0)) {
+        fprintf(stderr, "Unable to open wavetable bank %s\n", path);
+        exit(1);
+    }
+    if ((size_t) st.st_size < sizeof(struct WTHEADER)) {
+        fprintf(stderr, "Wavetable bank %s is too short\n", path);
+        exit(1);
+    }
+
+    // Shared and read-only so the pages are the page cache's
+    pmap = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pmap == MAP_FAILED) {
+        fprintf(stderr, "Unable to map wavetable bank %s\n", path);
+        exit(1);
+    }
+
+    // Check the header before trusting any offset computed from it
+    phdr = (struct WTHEADER *) pmap;
+    if ((phdr->magic != WT_MAGIC) || (phdr->version != WT_VERSION) ||
+        (phdr->ntables < 1) || (phdr->ntables > MX_WTABLES) ||
+        (phdr->length < MN_WTLEN) || (phdr->length > MX_WTLEN) ||
+        ((phdr->length & (phdr->length - 1)) != 0) ||
+        (phdr->nmips < 1) || (phdr->nmips > MX_WTMIPS) ||
+        ((phdr->length >> (phdr->nmips - 1)) < 2)) {
+        fprintf(stderr, "%s is not a valid wavetable bank\n", path);
+        exit(1);
+    }
+    per = 2 * (phdr->length - (phdr->length >> phdr->nmips));
+    need = sizeof(struct WTHEADER) + (phdr->ntables * WT_NAME_LEN) +
+           (phdr->ntables * per * sizeof(float));
+    if ((size_t) st.st_size < need) {
+        fprintf(stderr, "Wavetable bank %s is too short\n", path);
+        exit(1);
+    }
+
+    wtables = calloc(phdr->ntables, sizeof(struct WAVETBL));
+    if (wtables == (struct WAVETBL *) NULL) {
+        fprintf(stderr, "Unable to allocate %u wavetables\n", phdr->ntables);
+        exit(1);
+    }
+    pname = pmap + sizeof(struct WTHEADER);
+    pdata = (float *) (pname + (phdr->ntables * WT_NAME_LEN));
+    for (i = 0; i < (int) phdr->ntables; i++) {
+        wtables[i].idx = i;
+        strncpy(wtables[i].name, pname + (i * WT_NAME_LEN), WT_NAME_LEN - 1);
+        wtables[i].name[WT_NAME_LEN - 1] = (char) 0;
+        wtables[i].length = phdr->length;
+        wtables[i].nmips = phdr->nmips;
+        wtables[i].data = pdata + (i * per);
+    }
+    synth.nwtables = phdr->ntables;
+
+    // Start reading the samples in but do not wait for them
+    (void) madvise(pmap, st.st_size, MADV_WILLNEED);
+}
+
+
+/***************************************************************
+ * wt_sample(): - Compute one sample of a wavetable oscillator.
+ * A table index outside the bank gives silence.
+ *
+ * Input:        table index, phase after offset, phase step
+ * Output:       waveform value
+ * Effects:
+ ***************************************************************/
+float wt_sample(
+    int       tbl,         // index into wtables
+    float     phout,       // phase, 0 to 1
+    float     dt)          // phase step for this sample
+{
+    if ((tbl < 0) || (tbl >= synth.nwtables))
+        return 0.0f;
+    return wt_lookup(&wtables[tbl], phout, dt,
+        __atomic_load_n(&rset.wtinterp, __ATOMIC_RELAXED));
+}
+
+
+/***************************************************************
+ * wt_wave(): - Convert a buffer of oscillator phases into
+ * wavetable values.  This is osc_wave() for a wavetable.
+ *
+ * Input:        table index, phases after offset, phase step
+ *               of each sample, number of samples
+ * Output:       out[] has the waveform value of each phase
+ * Effects:
+ ***************************************************************/
+void wt_wave(
+    int       tbl,         // index into wtables
+    float    *out,         // phase in, waveform value out
+    float    *dt,          // phase step of each sample
+    int       nsamp)       // number of samples to convert
+{
+    struct WAVETBL *pwt;   // the table
+    int      interp;       // interpolation for the whole buffer
+    int      s;
+
+    if ((tbl < 0) || (tbl >= synth.nwtables)) {
+        for (s = 0; s < nsamp; s++)
+            out[s] = 0.0f;
+        return;
+    }
+    pwt = &wtables[tbl];
+    interp = __atomic_load_n(&rset.wtinterp, __ATOMIC_RELAXED);
+    for (s = 0; s < nsamp; s++)
+        out[s] = wt_lookup(pwt, out[s], dt[s], interp);
+}
+
+
+/***************************************************************
+ * wt_lookup(): - Pick the level of a table for the phase step
+ * and look up the phase in it.  Level k starts after levels 0
+ * to k-1, which hold 2 * (length - (length >> k)) samples.
+ *
+ * Input:        table, phase, phase step, interpolation
+ * Output:       waveform value
+ * Effects:
+ ***************************************************************/
+static inline float wt_lookup(
+    struct WAVETBL *pwt,   // the table
+    float     phout,       // phase, 0 to 1
+    float     dt,          // phase step for this sample
+    int       interp)      // none, linear, or cubic
+{
+    float   *lvl;          // samples of the level used
+    float    steps;        // samples per phase step in this level
+    float    pos;          // phase as a sample position
+    float    frac;         // fraction of a sample past i
+    float    y0, y1, y2, y3; // samples around the position
+    int      len;          // samples in the level used
+    int      mask;         // len - 1
+    int      k;            // level used
+    int      i;
+
+    // One sample per phase step or less keeps every harmonic in
+    // the level below half the sample rate.
+    len = pwt->length;
+    steps = fabsf(dt) * (float) len;
+    for (k = 0; (steps > 1.0f) && (k < pwt->nmips - 1); k++) {
+        steps *= 0.5f;
+        len >>= 1;
+    }
+    lvl = pwt->data + 2 * (pwt->length - len);
+    mask = len - 1;
+
+    pos = phout * (float) len;
+    i = (int) pos;
+    frac = pos - (float) i;
+    i &= mask;                  // a phase of exactly 1.0 is sample 0
+    if (interp == WTINTERP_NONE)
+        return lvl[i];
+    y1 = lvl[i];
+    y2 = lvl[(i + 1) & mask];
+    if (interp != WTINTERP_CUBIC)
+        return y1 + (frac * (y2 - y1));
+
+    // Catmull-Rom cubic through the two samples on each side
+    y0 = lvl[(i - 1) & mask];
+    y3 = lvl[(i + 2) & mask];
+    return y1 + 0.5f * frac * ((y2 - y0) +
+           frac * ((2.0f * y0 - 5.0f * y1 + 4.0f * y2 - y3) +
+           frac * (3.0f * (y1 - y2) + y3 - y0)));
+}